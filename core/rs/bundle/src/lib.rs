@@ -1,12 +1,14 @@
-#![no_std]
+#![cfg_attr(not(feature = "std"), no_std)]
 #![feature(core_intrinsics)]
 #![feature(lang_items)]
 
 extern crate alloc;
 
 use core::alloc::GlobalAlloc;
+#[cfg(all(target_family = "wasm", not(feature = "std")))]
 use core::alloc::Layout;
 use core::ffi::c_char;
+#[cfg(not(feature = "std"))]
 use core::panic::PanicInfo;
 use crsql_core;
 use crsql_core::sqlite3_crsqlcore_init;
@@ -23,16 +25,18 @@ static ALLOCATOR: SQLite3Allocator = SQLite3Allocator {};
 
 // This must be our panic handler for WASM builds. For simplicity, we make it our panic handler for
 // all builds. Abort is also more portable than unwind, enabling us to go to more embedded use cases.
+// Builds with the `std` feature get std's, which aborts too as the profiles set `panic = "abort"`.
+#[cfg(not(feature = "std"))]
 #[panic_handler]
 fn panic(_info: &PanicInfo) -> ! {
     core::intrinsics::abort()
 }
 
-#[cfg(not(target_family = "wasm"))]
+#[cfg(not(any(target_family = "wasm", feature = "std")))]
 #[lang = "eh_personality"]
 extern "C" fn eh_personality() {}
 
-#[cfg(target_family = "wasm")]
+#[cfg(all(target_family = "wasm", not(feature = "std")))]
 #[no_mangle]
 pub fn __rust_alloc_error_handler(_: Layout) -> ! {
     core::intrinsics::abort()
@@ -1,3 +1,3 @@
-#![no_std]
+#![cfg_attr(not(feature = "std"), no_std)]
 
 pub use crsql_bundle;
@@ -6,13 +6,12 @@ use alloc::string::String;
 use alloc::vec::Vec;
 use core::ffi::{c_char, c_int, CStr};
 use core::mem;
-#[cfg(not(feature = "std"))]
 use num_traits::FromPrimitive;
 use sqlite_nostd::{sqlite3, Connection, ResultCode, StrRef};
 
 use crate::c::crsql_ExtData;
 use crate::db_version::fill_db_version_if_needed;
-use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, TableInfo};
+use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, find_table_info_index, TableInfo};
 
 #[no_mangle]
 pub unsafe extern "C" fn crsql_compact_post_alter(
@@ -102,12 +101,10 @@ unsafe fn compact_post_alter(
         }
         let table_infos =
             mem::ManuallyDrop::new(Box::from_raw((*ext_data).tableInfos as *mut Vec<TableInfo>));
-        let table_info = table_infos.iter().find(|x| x.tbl_name == tbl_name_str);
-        if table_info.is_none() {
-            return Err(ResultCode::ERROR);
-        }
-        // TODO: safe since we checked above but make more idiomatic
-        let table_info = table_info.unwrap();
+        let table_info = match find_table_info_index(ext_data, &table_infos, tbl_name_str) {
+            Some(i) => &table_infos[i],
+            None => return Err(ResultCode::ERROR),
+        };
 
         // for each pk col, append \"%w\".\"%w\" = \"%w__crsql_pks\".\"%w\"
         // to the where clause then close the statement.
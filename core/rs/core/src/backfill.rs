@@ -55,7 +55,9 @@ pub fn backfill_table(
         return Err(e);
     }
 
-    if let Err(e) = backfill_missing_columns(db, table, pk_cols, non_pk_cols, is_commit_alter) {
+    if let Err(e) = backfill_missing_columns(db, table, pk_cols, non_pk_cols, is_commit_alter)
+        .and_then(|_| crate::bootstrap::fill_lookaside_cl(db, table))
+    {
         if !no_tx {
             db.exec_safe("ROLLBACK")?;
         }
@@ -87,15 +89,12 @@ fn create_clock_rows_from_stmt(
         table = crate::util::escape_ident(table),
         pk_where_conditions = crate::util::where_list(pk_cols, None)?
     ))?;
+    let packed_pks = crate::tableinfo::lookaside_has_column(db, table, "__crsql_packed_pks")?;
     let create_key = db.prepare_v2(&format!(
         "INSERT INTO \"{table}__crsql_pks\" ({pk_cols}) VALUES ({pk_values}) RETURNING __crsql_key",
         table = crate::util::escape_ident(table),
-        pk_cols = pk_cols
-            .iter()
-            .map(|f| format!("\"{}\"", crate::util::escape_ident(&f.name)))
-            .collect::<Vec<_>>()
-            .join(", "),
-        pk_values = pk_cols.iter().map(|_| "?").collect::<Vec<_>>().join(", "),
+        pk_cols = crate::tableinfo::lookaside_insert_list(pk_cols, packed_pks)?,
+        pk_values = crate::tableinfo::lookaside_binding_list(pk_cols.len(), packed_pks),
     ))?;
     // We do not grab nextdbversion on migration.
     // The idea is that other nodes will apply the same migration
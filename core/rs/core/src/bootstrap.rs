@@ -1,12 +1,12 @@
 use core::ffi::{c_char, c_int};
 
 use crate::{consts, tableinfo::TableInfo};
-use alloc::{ffi::CString, format};
+use alloc::{ffi::CString, format, string::String};
 use core::slice;
 use sqlite::{sqlite3, Connection, Destructor, ResultCode};
 use sqlite_nostd as sqlite;
 
-fn uuid() -> [u8; 16] {
+pub fn uuid() -> [u8; 16] {
     let mut blob: [u8; 16] = [0; 16];
     sqlite::randomness(&mut blob);
     blob[6] = (blob[6] & 0x0f) + 0x40;
@@ -213,11 +213,11 @@ pub fn create_clock_table(
         table_name = crate::util::escape_ident(table_name),
     ))?;
 
-    db.exec_safe(
-      &format!(
-        "CREATE INDEX IF NOT EXISTS \"{table_name}__crsql_clock_dbv_idx\" ON \"{table_name}__crsql_clock\" (\"db_version\")",
-        table_name = crate::util::escape_ident(table_name),
-      ))?;
+    create_clock_db_version_index(
+        db,
+        table_name,
+        crate::config::lookaside_option_enabled(db, crate::config::COVERING_CLOCK_INDEX)?,
+    )?;
     db.exec_safe(
       &format!(
         "CREATE TABLE IF NOT EXISTS \"{table_name}__crsql_pks\" (__crsql_key INTEGER PRIMARY KEY, {pk_list})",
@@ -231,5 +231,123 @@ pub fn create_clock_table(
         table_name = table_name,
         pk_list = pk_list
       )
+    )?;
+
+    if crate::config::lookaside_option_enabled(db, crate::config::PACKED_PKS)? {
+        create_packed_pks_column(db, table_info)?;
+    }
+    if crate::config::lookaside_option_enabled(db, crate::config::LOOKASIDE_CL)? {
+        create_lookaside_cl_column(db, table_info)?;
+    }
+
+    Ok(ResultCode::OK)
+}
+
+/**
+ * Adds `__crsql_packed_pks` to a lookaside table so the changes vtab can return
+ * packed primary keys without re-packing them for every change it emits.
+ * Existing keys are packed once here; new keys are packed as they are created.
+ */
+fn create_packed_pks_column(
+    db: *mut sqlite3,
+    table_info: &TableInfo,
+) -> Result<ResultCode, ResultCode> {
+    let table_name = crate::util::escape_ident(&table_info.tbl_name);
+    if !crate::tableinfo::lookaside_has_column(db, &table_info.tbl_name, "__crsql_packed_pks")? {
+        db.exec_safe(&format!(
+            "ALTER TABLE \"{table_name}__crsql_pks\" ADD COLUMN __crsql_packed_pks BLOB;
+            UPDATE \"{table_name}__crsql_pks\" SET __crsql_packed_pks = crsql_pack_columns({pk_list});",
+            pk_list = crate::util::as_identifier_list(&table_info.pks, None)?,
+        ))?;
+    }
+    db.exec_safe(&format!(
+        "CREATE UNIQUE INDEX IF NOT EXISTS \"{table_name}__crsql_pks_packed\" ON \"{table_name}__crsql_pks\" (__crsql_packed_pks)"
+    ))
+}
+
+/**
+ * Creates the index that clock tables are scanned by db_version with.
+ *
+ * The `COVERING_CLOCK_INDEX` option makes it hold every clock column
+ * `crsql_changes` reads, so a scan never visits the clock table's primary
+ * B-tree. This costs about another copy of the clock table on disk and on every
+ * clock write. Only one of the two indexes is kept as the covering one serves
+ * every lookup the plain one does.
+ */
+pub fn create_clock_db_version_index(
+    db: *mut sqlite3,
+    table_name: &str,
+    covering: bool,
+) -> Result<ResultCode, ResultCode> {
+    let table_name = crate::util::escape_ident(table_name);
+    if covering {
+        db.exec_safe(&format!(
+            "CREATE INDEX IF NOT EXISTS \"{table_name}__crsql_clock_dbv_cover_idx\" ON \"{table_name}__crsql_clock\" (db_version, seq, key, col_name, col_version, site_id);
+            DROP INDEX IF EXISTS \"{table_name}__crsql_clock_dbv_idx\";"
+        ))
+    } else {
+        db.exec_safe(&format!(
+            "CREATE INDEX IF NOT EXISTS \"{table_name}__crsql_clock_dbv_idx\" ON \"{table_name}__crsql_clock\" (\"db_version\");
+            DROP INDEX IF EXISTS \"{table_name}__crsql_clock_dbv_cover_idx\";"
+        ))
+    }
+}
+
+/**
+ * Adds `__crsql_cl` to a lookaside table. It holds the causal length the clock
+ * table would otherwise have to be probed for: the col_version of the '-1'
+ * sentinel, 1 if the row has clock entries but no sentinel and NULL if it has none.
+ *
+ * Every path that writes a row's sentinel, or the first clock entry of a row,
+ * keeps it up to date through `TableInfo::set_lookaside_cl`. Backfills fill it in
+ * bulk with `fill_lookaside_cl`.
+ */
+fn create_lookaside_cl_column(
+    db: *mut sqlite3,
+    table_info: &TableInfo,
+) -> Result<ResultCode, ResultCode> {
+    let table_name = crate::util::escape_ident(&table_info.tbl_name);
+    // Earlier builds maintained the column with triggers on the clock table.
+    db.exec_safe(&format!(
+        "DROP TRIGGER IF EXISTS \"{table_name}__crsql_cl_itrig\";
+        DROP TRIGGER IF EXISTS \"{table_name}__crsql_cl_utrig\";
+        DROP TRIGGER IF EXISTS \"{table_name}__crsql_cl_dtrig\";"
+    ))?;
+    if !crate::tableinfo::lookaside_has_column(db, &table_info.tbl_name, "__crsql_cl")? {
+        db.exec_safe(&format!(
+            "ALTER TABLE \"{table_name}__crsql_pks\" ADD COLUMN __crsql_cl INTEGER"
+        ))?;
+        fill_lookaside_cl(db, &table_info.tbl_name)?;
+    }
+    Ok(ResultCode::OK)
+}
+
+/**
+ * The causal length `__crsql_cl` holds for the row with lookaside key `key`, as an
+ * SQL expression.
+ */
+pub fn lookaside_cl_of(table_name: &str, key: &str) -> String {
+    format!(
+        "COALESCE(
+          (SELECT col_version FROM \"{table_name}__crsql_clock\" WHERE key = {key} AND col_name = '{sentinel}'),
+          (SELECT 1 FROM \"{table_name}__crsql_clock\" WHERE key = {key} LIMIT 1)
+        )",
+        table_name = crate::util::escape_ident(table_name),
+        sentinel = crate::c::INSERT_SENTINEL,
     )
 }
+
+/**
+ * Fills in `__crsql_cl` of the rows that have none, e.g. after a backfill created
+ * their clock entries. Does nothing if the lookaside table has no `__crsql_cl`.
+ */
+pub fn fill_lookaside_cl(db: *mut sqlite3, table_name: &str) -> Result<ResultCode, ResultCode> {
+    if !crate::tableinfo::lookaside_has_column(db, table_name, "__crsql_cl")? {
+        return Ok(ResultCode::OK);
+    }
+    db.exec_safe(&format!(
+        "UPDATE \"{table}__crsql_pks\" SET __crsql_cl = {cl} WHERE __crsql_cl IS NULL",
+        table = crate::util::escape_ident(table_name),
+        cl = lookaside_cl_of(table_name, "__crsql_key"),
+    ))
+}
@@ -1,6 +1,5 @@
 extern crate alloc;
 use core::ffi::{c_char, c_int};
-#[cfg(not(feature = "std"))]
 use num_derive::FromPrimitive;
 
 // Structs that still exist in C but will eventually be moved to Rust
@@ -23,6 +22,11 @@ pub enum CrsqlChangesColumn {
     SiteId = 6,
     Cl = 7,
     Seq = 8,
+    // hidden, the byte budget of a read. See `ClockMerge::set_byte_budget`.
+    MaxBytes = 9,
+    // hidden, read only a slice of the changes. See `changes_best_index`.
+    PartCount = 10,
+    PartId = 11,
 }
 
 #[derive(FromPrimitive, PartialEq, Debug)]
@@ -36,6 +40,8 @@ pub enum ClockUnionColumn {
     RowId = 6,
     Seq = 7,
     Cl = 8,
+    TblIdx = 9,
+    SiteOrdinal = 10,
 }
 
 #[derive(FromPrimitive, PartialEq, Debug)]
@@ -68,6 +74,10 @@ pub struct crsql_ExtData {
     pub pSelectSiteIdOrdinalStmt: *mut sqlite::stmt,
     pub pSelectClockTablesStmt: *mut sqlite::stmt,
     pub mergeEqualValues: ::core::ffi::c_int,
+    pub changesStmtCache: *mut ::core::ffi::c_void,
+    pub tableInfoIndex: *mut ::core::ffi::c_void,
+    pub siteIdDict: *mut ::core::ffi::c_void,
+    pub changesStats: *mut ::core::ffi::c_void,
 }
 
 #[repr(C)]
@@ -91,6 +101,18 @@ pub struct crsql_Changes_cursor {
     pub rowType: ::core::ffi::c_int,
     pub changesRowid: sqlite::int64,
     pub tblInfoIdx: ::core::ffi::c_int,
+    pub pClockMerge: *mut ::core::ffi::c_void,
+    pub omitVal: ::core::ffi::c_int,
+    pub rowValIdx: ::core::ffi::c_int,
+}
+
+#[repr(C)]
+#[allow(non_snake_case, non_camel_case_types)]
+#[derive(Debug, Copy, Clone)]
+pub struct crsql_ChangesRows_cursor {
+    pub base: sqlite::vtab_cursor,
+    pub pTab: *mut crsql_Changes_vtab,
+    pub pRows: *mut ::core::ffi::c_void,
 }
 
 extern "C" {
@@ -109,6 +131,19 @@ extern "C" {
     ) -> *mut crsql_ExtData;
     pub fn crsql_freeExtData(pExtData: *mut crsql_ExtData);
     pub fn crsql_finalize(pExtData: *mut crsql_ExtData);
+    pub fn crsql_changes_rhs_value(
+        pIdxInfo: *mut sqlite::index_info,
+        iCons: c_int,
+    ) -> *mut sqlite::value;
+    pub fn crsql_changes_vtab_in(pIdxInfo: *mut sqlite::index_info, iCons: c_int) -> c_int;
+    pub fn crsql_changes_vtab_in_first(
+        pList: *mut sqlite::value,
+        ppOut: *mut *mut sqlite::value,
+    ) -> c_int;
+    pub fn crsql_changes_vtab_in_next(
+        pList: *mut sqlite::value,
+        ppOut: *mut *mut sqlite::value,
+    ) -> c_int;
 }
 
 #[test]
@@ -166,7 +201,7 @@ fn bindgen_test_layout_crsql_Changes_cursor() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::core::mem::size_of::<crsql_Changes_cursor>(),
-        64usize,
+        80usize,
         concat!("Size of: ", stringify!(crsql_Changes_cursor))
     );
     assert_eq!(
@@ -254,6 +289,69 @@ fn bindgen_test_layout_crsql_Changes_cursor() {
             stringify!(tblInfoIdx)
         )
     );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).pClockMerge) as usize - ptr as usize },
+        64usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_Changes_cursor),
+            "::",
+            stringify!(pClockMerge)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).omitVal) as usize - ptr as usize },
+        72usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_Changes_cursor),
+            "::",
+            stringify!(omitVal)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).rowValIdx) as usize - ptr as usize },
+        76usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_Changes_cursor),
+            "::",
+            stringify!(rowValIdx)
+        )
+    );
+}
+
+#[test]
+#[allow(non_snake_case)]
+fn bindgen_test_layout_crsql_ChangesRows_cursor() {
+    const UNINIT: ::core::mem::MaybeUninit<crsql_ChangesRows_cursor> =
+        ::core::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::core::mem::size_of::<crsql_ChangesRows_cursor>(),
+        24usize,
+        concat!("Size of: ", stringify!(crsql_ChangesRows_cursor))
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).pTab) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ChangesRows_cursor),
+            "::",
+            stringify!(pTab)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).pRows) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ChangesRows_cursor),
+            "::",
+            stringify!(pRows)
+        )
+    );
 }
 
 #[test]
@@ -263,7 +361,7 @@ fn bindgen_test_layout_crsql_ExtData() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::core::mem::size_of::<crsql_ExtData>(),
-        136usize,
+        168usize,
         concat!("Size of: ", stringify!(crsql_ExtData))
     );
     assert_eq!(
@@ -463,4 +561,44 @@ fn bindgen_test_layout_crsql_ExtData() {
             stringify!(mergeEqualValues)
         )
     );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).changesStmtCache) as usize - ptr as usize },
+        136usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ExtData),
+            "::",
+            stringify!(changesStmtCache)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).tableInfoIndex) as usize - ptr as usize },
+        144usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ExtData),
+            "::",
+            stringify!(tableInfoIndex)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).siteIdDict) as usize - ptr as usize },
+        152usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ExtData),
+            "::",
+            stringify!(siteIdDict)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).changesStats) as usize - ptr as usize },
+        160usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ExtData),
+            "::",
+            stringify!(changesStats)
+        )
+    );
 }
@@ -0,0 +1,192 @@
+use std::ffi::c_void;
+use std::fs::File;
+use std::io::{BufWriter, Write};
+use std::os::unix::io::AsRawFd;
+use std::ptr::null_mut;
+
+use core::ffi::c_int;
+use sqlite::{ColumnType, Context, ResultCode, Value};
+use sqlite_nostd as sqlite;
+
+use crate::c::crsql_ExtData;
+use crate::changeset::{
+    export_changes, parse_codec, result_apply_changeset, ChangesetWriter, CODEC_NONE,
+};
+
+/**
+ * Changesets written to and read from files, to seed a new replica without
+ * streaming every change through `crsql_changes` on both sides.
+ *
+ * Imports map the file rather than read it. Values of an uncompressed changeset
+ * are bound straight from the mapped pages, see `pack_columns::bind_column_ref`.
+ *
+ * Only built with the `std` feature on Linux.
+ */
+
+const PROT_READ: c_int = 1;
+const MAP_PRIVATE: c_int = 2;
+const MADV_SEQUENTIAL: c_int = 2;
+
+extern "C" {
+    fn mmap(
+        addr: *mut c_void,
+        len: usize,
+        prot: c_int,
+        flags: c_int,
+        fd: c_int,
+        offset: i64,
+    ) -> *mut c_void;
+    fn munmap(addr: *mut c_void, len: usize) -> c_int;
+    fn madvise(addr: *mut c_void, len: usize, advice: c_int) -> c_int;
+}
+
+/**
+ * A read only, private mapping of a whole file. Unmapped on drop.
+ */
+struct Mapping {
+    addr: *mut c_void,
+    len: usize,
+}
+
+impl Mapping {
+    fn open(path: &str) -> Result<Mapping, ResultCode> {
+        let file = File::open(path).map_err(|_| ResultCode::CANTOPEN)?;
+        let len = file.metadata().map_err(|_| ResultCode::IOERR)?.len() as usize;
+        if len == 0 {
+            // mmap refuses empty mappings
+            return Ok(Mapping {
+                addr: null_mut(),
+                len,
+            });
+        }
+        let addr = unsafe { mmap(null_mut(), len, PROT_READ, MAP_PRIVATE, file.as_raw_fd(), 0) };
+        // MAP_FAILED
+        if addr as isize == -1 {
+            return Err(ResultCode::IOERR);
+        }
+        // Only a hint, the changeset is read front to back once.
+        unsafe { madvise(addr, len, MADV_SEQUENTIAL) };
+        // The mapping outlives the file descriptor.
+        Ok(Mapping { addr, len })
+    }
+
+    fn bytes(&self) -> &[u8] {
+        if self.len == 0 {
+            return &[];
+        }
+        unsafe { std::slice::from_raw_parts(self.addr as *const u8, self.len) }
+    }
+}
+
+impl Drop for Mapping {
+    fn drop(&mut self) {
+        if self.len != 0 {
+            unsafe { munmap(self.addr, self.len) };
+        }
+    }
+}
+
+/**
+ * `crsql_export_changes_file(path, since [, codec])`: writes the changeset
+ * `crsql_changeset(since, NULL, codec)` would return to `path`, a chunk at a time,
+ * and returns the number of bytes written. The file is replaced if it exists.
+ */
+pub extern "C" fn crsql_export_changes_file(
+    ctx: *mut sqlite::context,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+) {
+    let args = sqlite::args!(argc, argv);
+    if args.len() < 2 || args.len() > 3 || args[0].value_type() != ColumnType::Text {
+        ctx.result_error(
+            "crsql_export_changes_file takes a path, a db_version and, optionally, a codec",
+        );
+        return;
+    }
+    let path = args[0].text();
+    let since = match args[1].value_type() {
+        ColumnType::Null => -1,
+        _ => args[1].int64(),
+    };
+    let codec = match args.get(2) {
+        None => CODEC_NONE,
+        Some(codec) if codec.value_type() == ColumnType::Null => CODEC_NONE,
+        Some(codec) => match parse_codec(codec.text()) {
+            Some(codec) => codec,
+            None => {
+                ctx.result_error(
+                    "crsql_export_changes_file - unknown codec, expected 'lz' or 'none'",
+                );
+                return;
+            }
+        },
+    };
+
+    let mut out = match File::create(path) {
+        Ok(file) => BufWriter::new(file),
+        Err(_) => {
+            ctx.result_error("crsql_export_changes_file - could not create the file");
+            ctx.result_error_code(ResultCode::CANTOPEN);
+            return;
+        }
+    };
+    let db = ctx.db_handle();
+    let ext_data = ctx.user_data() as *mut crsql_ExtData;
+    let mut written: i64 = 0;
+    let mut sink = |bytes: &[u8]| {
+        written += bytes.len() as i64;
+        out.write_all(bytes).map_err(|_| ResultCode::IOERR)?;
+        Ok(ResultCode::OK)
+    };
+    let result = ChangesetWriter::new(codec, &mut sink).and_then(|mut writer| {
+        export_changes(db, ext_data, since, None, &mut writer)?;
+        writer.finish()
+    });
+    let result = result.and_then(|_| {
+        out.into_inner()
+            .map_err(|_| ResultCode::IOERR)?
+            .sync_all()
+            .map_err(|_| ResultCode::IOERR)?;
+        Ok(ResultCode::OK)
+    });
+    match result {
+        Ok(_) => ctx.result_int64(written),
+        Err(rc) => {
+            // Leave no partial changeset behind to be imported.
+            let _ = std::fs::remove_file(path);
+            ctx.result_error("crsql_export_changes_file failed to write changes");
+            ctx.result_error_code(rc);
+        }
+    }
+}
+
+/**
+ * `crsql_import_changes_file(path)`: merges the changeset in the file at `path`,
+ * as `crsql_apply_changeset` would, and returns the number of rows impacted.
+ *
+ * Unless a transaction is open, the merge is committed every MERGE_BATCH or so
+ * changes, see `changeset::apply_changeset`, so an import that fails part way may
+ * already have merged some of the file. Importing the file again completes it.
+ */
+pub extern "C" fn crsql_import_changes_file(
+    ctx: *mut sqlite::context,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+) {
+    let args = sqlite::args!(argc, argv);
+    if args.len() != 1 || args[0].value_type() != ColumnType::Text {
+        ctx.result_error("crsql_import_changes_file takes a path");
+        return;
+    }
+    let mapping = match Mapping::open(args[0].text()) {
+        Ok(mapping) => mapping,
+        Err(rc) => {
+            ctx.result_error("crsql_import_changes_file - could not map the file");
+            ctx.result_error_code(rc);
+            return;
+        }
+    };
+    // Values are bound with static destructors so every statement holding one is
+    // reset before the mapping is dropped.
+    result_apply_changeset(ctx, "crsql_import_changes_file", mapping.bytes(), true);
+}
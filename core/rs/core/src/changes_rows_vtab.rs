@@ -0,0 +1,529 @@
+extern crate alloc;
+use alloc::boxed::Box;
+use alloc::ffi::CString;
+use alloc::format;
+use alloc::string::String;
+use alloc::vec::Vec;
+use core::ffi::{c_char, c_int, c_void, CStr};
+use core::mem;
+use core::ptr::null_mut;
+
+use num_derive::FromPrimitive;
+use num_traits::FromPrimitive;
+use sqlite::{ColumnType, Connection, Context, ManagedStmt, Value};
+use sqlite_nostd as sqlite;
+use sqlite_nostd::ResultCode;
+
+use crate::c::{crsql_ChangesRows_cursor, crsql_Changes_vtab};
+use crate::changes_vtab_write::RowMerge;
+use crate::pack_columns::{bind_slot, pack_column, unpack_columns, ColumnValue};
+use crate::stmt_cache::{changes_stmt_cache, ChangesStmtKey};
+use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, TableInfo};
+
+#[derive(FromPrimitive, PartialEq, Debug)]
+enum ChangesRowsColumn {
+    Tbl = 0,
+    Pk = 1,
+    Cids = 2,
+    ColVersions = 3,
+    Vals = 4,
+    DbVrsn = 5,
+    SiteId = 6,
+    Cl = 7,
+    Seq = 8,
+}
+
+// Columns of the `crsql_changes` query rows are packed from.
+const CHANGE_ROWID: i32 = 0;
+const CHANGE_TBL: i32 = 1;
+const CHANGE_PK: i32 = 2;
+const CHANGE_CID: i32 = 3;
+const CHANGE_VAL: i32 = 4;
+const CHANGE_COL_VRSN: i32 = 5;
+const CHANGE_DB_VRSN: i32 = 6;
+const CHANGE_SITE_ID: i32 = 7;
+const CHANGE_CL: i32 = 8;
+const CHANGE_SEQ: i32 = 9;
+
+/**
+ * One row of `crsql_changes_rows`: consecutive changes to the same row that share
+ * a db_version, site id and causal length and have consecutive `seq`s.
+ * This is how the triggers record the columns written by a single statement.
+ */
+#[derive(Default)]
+struct PackedRow {
+    rowid: i64,
+    tbl: String,
+    pk: Vec<u8>,
+    db_version: i64,
+    site_id: Vec<u8>,
+    cl: i64,
+    seq: i64,
+    num_columns: u8,
+    // each starts with the column count, filled in once the row is complete
+    cids: Vec<u8>,
+    col_versions: Vec<u8>,
+    vals: Vec<u8>,
+}
+
+impl PackedRow {
+    fn start(&mut self, stmt: &ManagedStmt) -> Result<(), ResultCode> {
+        self.rowid = stmt.column_int64(CHANGE_ROWID);
+        self.tbl.clear();
+        self.tbl.push_str(stmt.column_text(CHANGE_TBL)?);
+        self.pk.clear();
+        self.pk.extend_from_slice(stmt.column_blob(CHANGE_PK)?);
+        self.db_version = stmt.column_int64(CHANGE_DB_VRSN);
+        self.site_id.clear();
+        self.site_id
+            .extend_from_slice(stmt.column_blob(CHANGE_SITE_ID)?);
+        self.cl = stmt.column_int64(CHANGE_CL);
+        self.seq = stmt.column_int64(CHANGE_SEQ);
+        self.num_columns = 0;
+        for buf in [&mut self.cids, &mut self.col_versions, &mut self.vals] {
+            buf.clear();
+            buf.push(0);
+        }
+        Ok(())
+    }
+
+    fn continues(&self, stmt: &ManagedStmt) -> Result<bool, ResultCode> {
+        Ok(self.num_columns < u8::MAX
+            && stmt.column_int64(CHANGE_SEQ) == self.seq + self.num_columns as i64
+            && stmt.column_int64(CHANGE_DB_VRSN) == self.db_version
+            && stmt.column_int64(CHANGE_CL) == self.cl
+            && stmt.column_blob(CHANGE_PK)? == &self.pk[..]
+            && stmt.column_text(CHANGE_TBL)? == self.tbl
+            && stmt.column_blob(CHANGE_SITE_ID)? == &self.site_id[..])
+    }
+
+    fn push(&mut self, stmt: &ManagedStmt) -> Result<(), ResultCode> {
+        pack_column(&mut self.cids, stmt.column_value(CHANGE_CID)?);
+        pack_column(&mut self.col_versions, stmt.column_value(CHANGE_COL_VRSN)?);
+        pack_column(&mut self.vals, stmt.column_value(CHANGE_VAL)?);
+        self.num_columns += 1;
+        self.cids[0] = self.num_columns;
+        self.col_versions[0] = self.num_columns;
+        self.vals[0] = self.num_columns;
+        Ok(())
+    }
+}
+
+/**
+ * Reads `crsql_changes` in `(db_version, seq)` order and packs its changes into rows.
+ */
+struct ChangesRows {
+    key: ChangesStmtKey,
+    stmt: ManagedStmt,
+    generation: u64,
+    // `stmt` is positioned on a change not yet packed
+    has_next: bool,
+    row: PackedRow,
+    eof: bool,
+}
+
+impl ChangesRows {
+    fn next(&mut self) -> Result<(), ResultCode> {
+        if !self.has_next {
+            self.eof = true;
+            return Ok(());
+        }
+        self.row.start(&self.stmt)?;
+        loop {
+            self.row.push(&self.stmt)?;
+            self.has_next = self.stmt.step()? == ResultCode::ROW;
+            if !self.has_next || !self.row.continues(&self.stmt)? {
+                return Ok(());
+            }
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_rows_crsr_finalize(crsr: *mut crsql_ChangesRows_cursor) -> c_int {
+    unsafe {
+        if (*crsr).pRows.is_null() {
+            return ResultCode::OK as c_int;
+        }
+        let rows = Box::from_raw((*crsr).pRows as *mut ChangesRows);
+        (*crsr).pRows = null_mut();
+        let cache = changes_stmt_cache((*(*crsr).pTab).pExtData);
+        match cache.put(rows.generation, rows.key, rows.stmt) {
+            Ok(rc) | Err(rc) => rc as c_int,
+        }
+    }
+}
+
+/**
+ * Constraints on columns every change packed into a row has in common are passed on
+ * to `crsql_changes`. `idx_str` is the resulting WHERE clause.
+ */
+#[no_mangle]
+pub extern "C" fn crsql_changes_rows_best_index(
+    _vtab: *mut sqlite::vtab,
+    index_info: *mut sqlite::index_info,
+) -> c_int {
+    let constraints = sqlite::args!((*index_info).nConstraint, (*index_info).aConstraint);
+    let constraint_usage =
+        sqlite::args_mut!((*index_info).nConstraint, (*index_info).aConstraintUsage);
+    let mut str = String::new();
+    let mut arg_v_index = 1;
+    let mut has_db_version = false;
+    for (i, constraint) in constraints.iter().enumerate() {
+        if constraint.usable == 0 {
+            continue;
+        }
+        let col = ChangesRowsColumn::from_i32(constraint.iColumn);
+        let col_name = match col {
+            Some(ChangesRowsColumn::Tbl) => "[table]",
+            Some(ChangesRowsColumn::Pk) => "pk",
+            Some(ChangesRowsColumn::DbVrsn) => "db_version",
+            Some(ChangesRowsColumn::SiteId) => "site_id",
+            Some(ChangesRowsColumn::Cl) => "cl",
+            _ => continue,
+        };
+        let op_string = match constraint.op as u32 {
+            sqlite::INDEX_CONSTRAINT_EQ => "=",
+            sqlite::INDEX_CONSTRAINT_GT => ">",
+            sqlite::INDEX_CONSTRAINT_LE => "<=",
+            sqlite::INDEX_CONSTRAINT_LT => "<",
+            sqlite::INDEX_CONSTRAINT_GE => ">=",
+            sqlite::INDEX_CONSTRAINT_NE => "!=",
+            sqlite::INDEX_CONSTRAINT_IS => "IS",
+            sqlite::INDEX_CONSTRAINT_ISNOT => "IS NOT",
+            sqlite::INDEX_CONSTRAINT_ISNULL => "IS NULL",
+            sqlite::INDEX_CONSTRAINT_ISNOTNULL => "IS NOT NULL",
+            _ => continue,
+        };
+        str.push_str(if str.is_empty() { " WHERE " } else { " AND " });
+        if constraint.op == sqlite::INDEX_CONSTRAINT_ISNULL as u8
+            || constraint.op == sqlite::INDEX_CONSTRAINT_ISNOTNULL as u8
+        {
+            str.push_str(&format!("{} {}", col_name, op_string));
+        } else {
+            str.push_str(&format!("{} {} ?", col_name, op_string));
+            constraint_usage[i].argvIndex = arg_v_index;
+            arg_v_index += 1;
+        }
+        constraint_usage[i].omit = 1;
+        if col == Some(ChangesRowsColumn::DbVrsn) {
+            has_db_version = true;
+        }
+    }
+
+    // Rows come out in `(db_version, seq)` order.
+    let order_bys = sqlite::args!((*index_info).nOrderBy, (*index_info).aOrderBy);
+    let order_by_consumed = order_bys.iter().enumerate().all(|(i, order_by)| {
+        order_by.desc == 0
+            && match (i, ChangesRowsColumn::from_i32(order_by.iColumn)) {
+                (0, Some(ChangesRowsColumn::DbVrsn)) | (1, Some(ChangesRowsColumn::Seq)) => true,
+                _ => false,
+            }
+    });
+
+    // manual null-term since we'll pass to C
+    str.push('\0');
+    unsafe {
+        // crsql_changes does the real planning, just prefer plans that bound
+        // db_version.
+        (*index_info).estimatedCost = if has_db_version { 1000.0 } else { 1000000.0 };
+        (*index_info).orderByConsumed = if order_by_consumed { 1 } else { 0 };
+        let (ptr, _, _) = str.into_raw_parts();
+        (*index_info).idxStr = ptr as *mut c_char;
+        (*index_info).needToFreeIdxStr = 1;
+    }
+    ResultCode::OK as c_int
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn crsql_changes_rows_filter(
+    cursor: *mut sqlite::vtab_cursor,
+    _idx_num: c_int,
+    idx_str: *const c_char,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+) -> c_int {
+    let args = sqlite::args!(argc, argv);
+    let idx_str = unsafe { CStr::from_ptr(idx_str).to_str() };
+    match idx_str {
+        Ok(idx_str) => {
+            match rows_filter(cursor.cast::<crsql_ChangesRows_cursor>(), idx_str, args) {
+                Ok(rc) | Err(rc) => rc as c_int,
+            }
+        }
+        Err(_) => ResultCode::FORMAT as c_int,
+    }
+}
+
+unsafe fn rows_filter(
+    cursor: *mut crsql_ChangesRows_cursor,
+    idx_str: &str,
+    args: &[*mut sqlite::value],
+) -> Result<ResultCode, ResultCode> {
+    crsql_changes_rows_crsr_finalize(cursor);
+    let tab = (*cursor).pTab;
+    let cache = changes_stmt_cache((*tab).pExtData);
+    let sql = format!(
+        "SELECT rowid, [table], pk, cid, val, col_version, db_version, site_id, cl, seq
+      FROM crsql_changes{} ORDER BY db_version, seq",
+        idx_str
+    );
+    let key = (sql, None);
+    let generation = cache.generation();
+    let stmt = match cache.take(&key) {
+        Some(stmt) => stmt,
+        None => (*tab).db.prepare_v3(&key.0, sqlite::PREPARE_PERSISTENT)?,
+    };
+    let rows = Box::into_raw(Box::new(ChangesRows {
+        key,
+        stmt,
+        generation,
+        has_next: false,
+        row: PackedRow::default(),
+        eof: false,
+    }));
+    // The cursor owns the statement from here on, even if binding fails.
+    (*cursor).pRows = rows as *mut c_void;
+    let rows = &mut *rows;
+    for (i, arg) in args.iter().enumerate() {
+        rows.stmt.bind_value(i as i32 + 1, *arg)?;
+    }
+    rows.has_next = rows.stmt.step()? == ResultCode::ROW;
+    rows.next()?;
+    Ok(ResultCode::OK)
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn crsql_changes_rows_next(cursor: *mut sqlite::vtab_cursor) -> c_int {
+    let cursor = cursor.cast::<crsql_ChangesRows_cursor>();
+    let rows = (*cursor).pRows as *mut ChangesRows;
+    if rows.is_null() {
+        return ResultCode::MISUSE as c_int;
+    }
+    match (*rows).next() {
+        Ok(()) => ResultCode::OK as c_int,
+        Err(rc) => rc as c_int,
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_rows_eof(cursor: *mut sqlite::vtab_cursor) -> c_int {
+    let cursor = cursor.cast::<crsql_ChangesRows_cursor>();
+    let rows = unsafe { ((*cursor).pRows as *mut ChangesRows).as_ref() };
+    match rows {
+        Some(rows) if !rows.eof => 0,
+        _ => 1,
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_rows_column(
+    cursor: *mut sqlite::vtab_cursor,
+    ctx: *mut sqlite::context,
+    i: c_int,
+) -> c_int {
+    let cursor = cursor.cast::<crsql_ChangesRows_cursor>();
+    let rows = match unsafe { ((*cursor).pRows as *mut ChangesRows).as_ref() } {
+        Some(rows) => rows,
+        None => return ResultCode::MISUSE as c_int,
+    };
+    let row = &rows.row;
+    match ChangesRowsColumn::from_i32(i) {
+        Some(ChangesRowsColumn::Tbl) => ctx.result_text_transient(&row.tbl),
+        Some(ChangesRowsColumn::Pk) => ctx.result_blob_shared(&row.pk),
+        Some(ChangesRowsColumn::Cids) => ctx.result_blob_shared(&row.cids),
+        Some(ChangesRowsColumn::ColVersions) => ctx.result_blob_shared(&row.col_versions),
+        Some(ChangesRowsColumn::Vals) => ctx.result_blob_shared(&row.vals),
+        Some(ChangesRowsColumn::DbVrsn) => ctx.result_int64(row.db_version),
+        Some(ChangesRowsColumn::SiteId) => ctx.result_blob_shared(&row.site_id),
+        Some(ChangesRowsColumn::Cl) => ctx.result_int64(row.cl),
+        Some(ChangesRowsColumn::Seq) => ctx.result_int64(row.seq),
+        None => return ResultCode::MISUSE as c_int,
+    }
+    ResultCode::OK as c_int
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_rows_rowid(
+    cursor: *mut sqlite::vtab_cursor,
+    rowid: *mut sqlite::int64,
+) -> c_int {
+    let cursor = cursor.cast::<crsql_ChangesRows_cursor>();
+    match unsafe { ((*cursor).pRows as *mut ChangesRows).as_ref() } {
+        Some(rows) => {
+            // the crsql_changes rowid of the row's first change
+            unsafe { *rowid = rows.row.rowid };
+            ResultCode::OK as c_int
+        }
+        None => ResultCode::MISUSE as c_int,
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_rows_update(
+    vtab: *mut sqlite::vtab,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+    row_id: *mut sqlite::int64,
+) -> c_int {
+    let args = sqlite::args!(argc, argv);
+    if args.len() > 1 && args[0].value_type() == ColumnType::Null {
+        let mut err_msg: *mut c_char = null_mut();
+        let rc = match unsafe { merge_row(vtab, args, row_id, &mut err_msg as *mut _) } {
+            Ok(rc) | Err(rc) => rc as c_int,
+        };
+        if rc != ResultCode::OK as c_int && !err_msg.is_null() {
+            unsafe {
+                (*vtab).zErrMsg = err_msg;
+            }
+        }
+        return rc;
+    } else {
+        if let Ok(err) = CString::new(
+            "Only INSERT and SELECT statements are allowed against the crsql_changes_rows table",
+        ) {
+            unsafe {
+                (*vtab).zErrMsg = err.into_raw();
+            }
+            return ResultCode::MISUSE as c_int;
+        } else {
+            return ResultCode::NOMEM as c_int;
+        }
+    }
+}
+
+/**
+ * Applies every column of a packed row. The row's key is looked up once and
+ * each column is then merged as an insert into `crsql_changes` would.
+ */
+unsafe fn merge_row(
+    vtab: *mut sqlite::vtab,
+    args: &[*mut sqlite::value],
+    rowid: *mut sqlite::int64,
+    errmsg: *mut *mut c_char,
+) -> Result<ResultCode, ResultCode> {
+    let tab = vtab.cast::<crsql_Changes_vtab>();
+    let db = (*tab).db;
+    let ext_data = (*tab).pExtData;
+
+    let rc = crsql_ensure_table_infos_are_up_to_date(db, ext_data, errmsg);
+    if rc != ResultCode::OK as i32 {
+        let err = CString::new("Failed to update CRR table information")?;
+        *errmsg = err.into_raw();
+        return Err(ResultCode::ERROR);
+    }
+
+    let arg = |col: ChangesRowsColumn| args[2 + col as usize];
+    let insert_tbl = arg(ChangesRowsColumn::Tbl);
+    if insert_tbl.bytes() > crate::consts::MAX_TBL_NAME_LEN {
+        let err = CString::new("crsql - table name exceeded max length")?;
+        *errmsg = err.into_raw();
+        return Err(ResultCode::ERROR);
+    }
+    let insert_site_id = arg(ChangesRowsColumn::SiteId);
+    if insert_site_id.bytes() > crate::consts::SITE_ID_LEN {
+        let err = CString::new("crsql - site id exceeded max length")?;
+        *errmsg = err.into_raw();
+        return Err(ResultCode::ERROR);
+    }
+    let insert_db_vrsn = arg(ChangesRowsColumn::DbVrsn).int64();
+    let insert_cl = arg(ChangesRowsColumn::Cl).int64();
+    let insert_seq = arg(ChangesRowsColumn::Seq).int64();
+
+    let cids = unpack_columns(arg(ChangesRowsColumn::Cids).blob())?;
+    let col_versions = unpack_columns(arg(ChangesRowsColumn::ColVersions).blob())?;
+    let vals = unpack_columns(arg(ChangesRowsColumn::Vals).blob())?;
+    if cids.len() != col_versions.len() || cids.len() != vals.len() {
+        let err = CString::new(
+            "crsql - cids, col_versions and vals must hold the same number of columns",
+        )?;
+        *errmsg = err.into_raw();
+        return Err(ResultCode::ERROR);
+    }
+
+    let insert_pks = arg(ChangesRowsColumn::Pk);
+    let tbl_infos =
+        mem::ManuallyDrop::new(Box::from_raw((*ext_data).tableInfos as *mut Vec<TableInfo>));
+    let mut row = RowMerge::new(
+        db,
+        ext_data,
+        &tbl_infos,
+        insert_tbl.text(),
+        insert_pks.blob(),
+        errmsg,
+    )?;
+
+    // The merge compares and binds values as sqlite values so each packed value
+    // is read back out of a `SELECT ?`.
+    let cache = changes_stmt_cache(ext_data);
+    let generation = cache.generation();
+    let key: ChangesStmtKey = (String::from("SELECT ?"), None);
+    let val_stmt = match cache.take(&key) {
+        Some(stmt) => stmt,
+        None => db.prepare_v3(&key.0, sqlite::PREPARE_PERSISTENT)?,
+    };
+    let mut ret = Ok(ResultCode::OK);
+    for (i, cid) in cids.iter().enumerate() {
+        ret = merge_column(
+            &mut row,
+            &val_stmt,
+            cid,
+            &col_versions[i],
+            &vals[i],
+            insert_db_vrsn,
+            insert_site_id.blob(),
+            insert_cl,
+            insert_seq + i as i64,
+            rowid,
+            errmsg,
+        );
+        if ret.is_err() {
+            break;
+        }
+    }
+    cache.put(generation, key, val_stmt)?;
+    ret
+}
+
+unsafe fn merge_column(
+    row: &mut RowMerge,
+    val_stmt: &ManagedStmt,
+    cid: &ColumnValue,
+    col_version: &ColumnValue,
+    val: &ColumnValue,
+    db_version: sqlite::int64,
+    site_id: &[u8],
+    cl: sqlite::int64,
+    seq: sqlite::int64,
+    rowid: *mut sqlite::int64,
+    errmsg: *mut *mut c_char,
+) -> Result<ResultCode, ResultCode> {
+    let (cid, col_version) = match (cid, col_version) {
+        (ColumnValue::Text(cid), ColumnValue::Integer(col_version)) => (cid, *col_version),
+        _ => {
+            let err = CString::new("crsql - cids must be text and col_versions integers")?;
+            *errmsg = err.into_raw();
+            return Err(ResultCode::ERROR);
+        }
+    };
+    if cid.len() as i32 > crate::consts::MAX_TBL_NAME_LEN {
+        let err = CString::new("crsql - column name exceeded max length")?;
+        *errmsg = err.into_raw();
+        return Err(ResultCode::ERROR);
+    }
+
+    val_stmt.reset()?;
+    bind_slot(1, val, val_stmt.stmt)?;
+    val_stmt.step()?;
+    row.merge_change(
+        cid,
+        val_stmt.column_value(0)?,
+        col_version,
+        db_version,
+        site_id,
+        cl,
+        seq,
+        rowid,
+        errmsg,
+    )
+}
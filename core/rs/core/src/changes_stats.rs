@@ -0,0 +1,500 @@
+extern crate alloc;
+use alloc::collections::BTreeMap;
+use alloc::format;
+use alloc::string::String;
+use alloc::vec::Vec;
+use core::ffi::{c_int, c_void};
+use core::mem::ManuallyDrop;
+
+use alloc::boxed::Box;
+use num_traits::FromPrimitive;
+use sqlite::{sqlite3, Connection, Destructor, ResultCode, Value};
+use sqlite_nostd as sqlite;
+
+use crate::c::{crsql_ExtData, crsql_changes_rhs_value, CrsqlChangesColumn};
+use crate::pk_range::PkOp;
+use crate::tableinfo::TableInfo;
+
+/**
+ * What `changes_best_index` knows about a clock table when estimating the cost of
+ * a `crsql_changes` query.
+ */
+#[derive(Clone, Copy)]
+pub struct ClockStats {
+    pub rows: f64,
+    // average number of clock rows written per db_version
+    pub rows_per_version: f64,
+    pub min_version: i64,
+    pub max_version: i64,
+}
+
+/**
+ * Per-connection cache of `ClockStats`.
+ *
+ * Gathering the stats takes a few index seeks per clock table, plus a lookup in
+ * `sqlite_stat1` when `ANALYZE` has been run. They are re-gathered when the set of
+ * crrs changes or when the db version has grown by more than an eighth since
+ * they were last gathered. Estimates only need to be the right order of magnitude.
+ */
+pub struct ChangesStats {
+    loaded: bool,
+    schema_version: c_int,
+    db_version: i64,
+    num_sites: f64,
+    tables: BTreeMap<String, ClockStats>,
+}
+
+impl ChangesStats {
+    fn is_stale(&self, ext_data: *mut crsql_ExtData) -> bool {
+        let (schema_version, db_version) = unsafe {
+            (
+                (*ext_data).pragmaSchemaVersionForTableInfos,
+                (*ext_data).dbVersion,
+            )
+        };
+        !self.loaded
+            || self.schema_version != schema_version
+            || db_version > self.db_version + self.db_version / 8
+    }
+
+    fn refresh(
+        &mut self,
+        db: *mut sqlite3,
+        ext_data: *mut crsql_ExtData,
+    ) -> Result<ResultCode, ResultCode> {
+        let tbl_infos = unsafe {
+            ManuallyDrop::new(Box::from_raw((*ext_data).tableInfos as *mut Vec<TableInfo>))
+        };
+        let has_stat1 = {
+            let stmt = db.prepare_v2(
+                "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'sqlite_stat1'",
+            )?;
+            stmt.step()? == ResultCode::ROW
+        };
+
+        let mut tables = BTreeMap::new();
+        for tbl_info in tbl_infos.iter() {
+            tables.insert(
+                tbl_info.tbl_name.clone(),
+                gather_clock_stats(db, tbl_info, has_stat1)?,
+            );
+        }
+
+        let num_sites = {
+            let stmt = db.prepare_v2("SELECT count(*) FROM crsql_site_id")?;
+            stmt.step()?;
+            stmt.column_int64(0)
+        };
+
+        self.tables = tables;
+        self.num_sites = num_sites.max(1) as f64;
+        unsafe {
+            self.schema_version = (*ext_data).pragmaSchemaVersionForTableInfos;
+            self.db_version = (*ext_data).dbVersion;
+        }
+        self.loaded = true;
+        Ok(ResultCode::OK)
+    }
+
+    /**
+     * Fills in `estimatedCost` and `estimatedRows` for the plan `changes_best_index`
+     * picked. Constraints the plan pushed down are those with an `argvIndex` or
+     * that are omitted.
+     */
+    pub fn estimate(&self, index_info: *mut sqlite::index_info, idx_num: c_int) {
+        let constraints = sqlite::args!((*index_info).nConstraint, (*index_info).aConstraint);
+        let constraint_usage =
+            sqlite::args!((*index_info).nConstraint, (*index_info).aConstraintUsage);
+
+        let mut selected: Option<Option<&ClockStats>> = None;
+        // the query is limited to `limit + offset` rows
+        let mut limit: Option<f64> = None;
+        let mut offset = 0.0;
+        let mut dbv_constraints = Vec::new();
+        let mut selectivity = 1.0;
+        // rowid constraints seek each clock table's primary key, pk predicates the pks index
+        let mut rowid_selectivity = 1.0;
+        for (i, constraint) in constraints.iter().enumerate() {
+            let usage = &constraint_usage[i];
+            if usage.argvIndex == 0 && usage.omit == 0 {
+                continue;
+            }
+            let rhs = unsafe { crsql_changes_rhs_value(index_info, i as c_int) };
+            match constraint.op as u32 {
+                sqlite::INDEX_CONSTRAINT_LIMIT | sqlite::INDEX_CONSTRAINT_OFFSET => {
+                    if !rhs.is_null() && rhs.value_type() == sqlite::ColumnType::Integer {
+                        let n = rhs.int64() as f64;
+                        if constraint.op as u32 == sqlite::INDEX_CONSTRAINT_OFFSET {
+                            offset = n.max(0.0);
+                        } else if n >= 0.0 {
+                            limit = Some(n);
+                        }
+                    }
+                    continue;
+                }
+                _ => {}
+            }
+            match CrsqlChangesColumn::from_i32(constraint.iColumn) {
+                Some(CrsqlChangesColumn::Tbl) => {
+                    // An unknown table name is estimated as an average table.
+                    selected = Some(
+                        if rhs.is_null() || rhs.value_type() != sqlite::ColumnType::Text {
+                            None
+                        } else {
+                            self.tables.get(rhs.text())
+                        },
+                    );
+                }
+                Some(CrsqlChangesColumn::DbVrsn) => {
+                    let rhs = if rhs.is_null() || rhs.value_type() != sqlite::ColumnType::Integer {
+                        None
+                    } else {
+                        Some(rhs.int64())
+                    };
+                    dbv_constraints.push((constraint.op as u32, rhs));
+                }
+                Some(CrsqlChangesColumn::SiteId) => {
+                    selectivity *= match constraint.op as u32 {
+                        sqlite::INDEX_CONSTRAINT_EQ | sqlite::INDEX_CONSTRAINT_IS => {
+                            1.0 / self.num_sites
+                        }
+                        sqlite::INDEX_CONSTRAINT_NE | sqlite::INDEX_CONSTRAINT_ISNOT => {
+                            1.0 - 1.0 / (self.num_sites + 1.0)
+                        }
+                        sqlite::INDEX_CONSTRAINT_ISNULL => 0.0,
+                        sqlite::INDEX_CONSTRAINT_ISNOTNULL => 1.0,
+                        _ => 0.25,
+                    }
+                }
+                // only ends the read early, see `ClockMerge::set_byte_budget`
+                Some(CrsqlChangesColumn::MaxBytes) => {}
+                // a slice of `1 / part_count` of every table
+                Some(CrsqlChangesColumn::PartCount) => {
+                    selectivity *= if !rhs.is_null()
+                        && rhs.value_type() == sqlite::ColumnType::Integer
+                        && rhs.int64() > 0
+                    {
+                        1.0 / rhs.int64() as f64
+                    } else {
+                        0.5
+                    }
+                }
+                Some(CrsqlChangesColumn::PartId) => {}
+                // pk predicates seek each table's pks index, see `pk_range`
+                Some(CrsqlChangesColumn::Pk) => {
+                    rowid_selectivity *= match PkOp::from_constraint_op(constraint.op) {
+                        Some(PkOp::Prefix) => 0.1,
+                        Some(_) => 0.25,
+                        None => default_selectivity(constraint.op as u32),
+                    }
+                }
+                Some(_) => selectivity *= default_selectivity(constraint.op as u32),
+                None if constraint.iColumn == -1 => {
+                    rowid_selectivity *= match constraint.op as u32 {
+                        // a single row of a single table
+                        sqlite::INDEX_CONSTRAINT_EQ => 0.0,
+                        op => default_selectivity(op),
+                    }
+                }
+                None => {}
+            }
+        }
+
+        let table_stats: Vec<ClockStats> = match selected {
+            Some(Some(stats)) => alloc::vec![*stats],
+            Some(None) => average_table(&self.tables).into_iter().collect(),
+            None => self.tables.values().copied().collect(),
+        };
+
+        // Each clock table is read through its own statement. A db_version
+        // constraint seeks the db_version index and a rowid constraint the primary
+        // key. Anything else is a full scan.
+        let mut cost = 0.0;
+        let mut rows = 0.0;
+        for stats in table_stats.iter() {
+            let seek = log2(stats.rows);
+            let visited = if dbv_constraints.is_empty() {
+                stats.rows
+            } else {
+                stats.rows * version_selectivity(stats, &dbv_constraints)
+            } * rowid_selectivity;
+            // every clock row visited is joined to its lookaside row
+            cost += seek + visited * (1.0 + seek);
+            rows += visited * selectivity;
+        }
+        if let Some(limit) = limit.map(|limit| limit + offset) {
+            // Merged statements stop being read once enough rows were returned.
+            if idx_num & 16 == 16 && rows > limit {
+                cost *= limit / rows;
+            }
+            rows = rows.min(limit);
+        }
+        if idx_num & 32 == 0 {
+            // `val` is looked up in the base table for each row returned.
+            cost += rows * log2(rows);
+        }
+        if idx_num & 16 == 0 {
+            // the union is sorted rather than merged
+            cost += rows * log2(rows);
+        }
+
+        unsafe {
+            (*index_info).estimatedCost = cost.max(1.0);
+            (*index_info).estimatedRows = (rows as i64).max(1);
+        }
+    }
+}
+
+fn gather_clock_stats(
+    db: *mut sqlite3,
+    tbl_info: &TableInfo,
+    has_stat1: bool,
+) -> Result<ClockStats, ResultCode> {
+    let tbl_name = crate::util::escape_ident(&tbl_info.tbl_name);
+    // Subqueries so each min/max is answered with a single index seek.
+    let stmt = db.prepare_v2(&format!(
+        "SELECT
+          (SELECT min(db_version) FROM \"{tbl_name}__crsql_clock\"),
+          (SELECT max(db_version) FROM \"{tbl_name}__crsql_clock\"),
+          (SELECT max(__crsql_key) FROM \"{tbl_name}__crsql_pks\")",
+    ))?;
+    stmt.step()?;
+    let min_version = stmt.column_int64(0);
+    let max_version = stmt.column_int64(1);
+    let max_key = stmt.column_int64(2);
+    let num_versions = (max_version - min_version + 1).max(1) as f64;
+
+    if has_stat1 {
+        // `N D` where N is the number of rows and D the average number of rows
+        // with the same db_version.
+        // Either index leads with db_version, see `create_clock_db_version_index`.
+        let stat1 =
+            db.prepare_v2("SELECT stat FROM sqlite_stat1 WHERE tbl = ? AND idx IN (?, ?) LIMIT 1")?;
+        stat1.bind_text(
+            1,
+            &format!("{}__crsql_clock", tbl_info.tbl_name),
+            Destructor::TRANSIENT,
+        )?;
+        stat1.bind_text(
+            2,
+            &format!("{}__crsql_clock_dbv_idx", tbl_info.tbl_name),
+            Destructor::TRANSIENT,
+        )?;
+        stat1.bind_text(
+            3,
+            &format!("{}__crsql_clock_dbv_cover_idx", tbl_info.tbl_name),
+            Destructor::TRANSIENT,
+        )?;
+        if stat1.step()? == ResultCode::ROW {
+            let mut stat = stat1.column_text(0)?.split(' ');
+            let rows = stat.next().and_then(|n| n.parse::<f64>().ok());
+            let per_version = stat.next().and_then(|n| n.parse::<f64>().ok());
+            if let (Some(rows), Some(per_version)) = (rows, per_version) {
+                return Ok(ClockStats {
+                    rows,
+                    rows_per_version: per_version.max(1.0),
+                    min_version,
+                    max_version,
+                });
+            }
+        }
+    }
+
+    // Without `sqlite_stat1` assume every column of every row that was ever
+    // given a key has a clock entry.
+    let rows = (max_key.max(0) as f64) * (tbl_info.non_pks.len().max(1) as f64);
+    Ok(ClockStats {
+        rows,
+        rows_per_version: (rows / num_versions).max(1.0),
+        min_version,
+        max_version,
+    })
+}
+
+fn average_table(tables: &BTreeMap<String, ClockStats>) -> Option<ClockStats> {
+    if tables.is_empty() {
+        return None;
+    }
+    let n = tables.len() as f64;
+    let mut avg = ClockStats {
+        rows: 0.0,
+        rows_per_version: 0.0,
+        min_version: i64::MAX,
+        max_version: 0,
+    };
+    for stats in tables.values() {
+        avg.rows += stats.rows / n;
+        avg.rows_per_version += stats.rows_per_version / n;
+        avg.min_version = avg.min_version.min(stats.min_version);
+        avg.max_version = avg.max_version.max(stats.max_version);
+    }
+    Some(avg)
+}
+
+// The fraction of a clock table's rows that satisfy all the db_version constraints.
+// Bounds known at planning time are intersected into one range which is compared
+// against the table's version range, assuming versions are spread evenly across it.
+fn version_selectivity(stats: &ClockStats, constraints: &Vec<(u32, Option<i64>)>) -> f64 {
+    if stats.rows <= 0.0 {
+        return 0.0;
+    }
+    let range = (stats.max_version - stats.min_version + 1).max(1) as f64;
+    let (mut lo, mut hi) = (stats.min_version, stats.max_version);
+    let mut bounded = false;
+    let mut selectivity = 1.0f64;
+    for (op, rhs) in constraints {
+        match (*op, rhs) {
+            (sqlite::INDEX_CONSTRAINT_GT, Some(v)) => lo = lo.max(v.saturating_add(1)),
+            (sqlite::INDEX_CONSTRAINT_GE, Some(v)) => lo = lo.max(*v),
+            (sqlite::INDEX_CONSTRAINT_LT, Some(v)) => hi = hi.min(v.saturating_sub(1)),
+            (sqlite::INDEX_CONSTRAINT_LE, Some(v)) => hi = hi.min(*v),
+            (sqlite::INDEX_CONSTRAINT_EQ, _) => {
+                selectivity *= (stats.rows_per_version / stats.rows).clamp(0.0, 1.0);
+                continue;
+            }
+            (op, _) => {
+                selectivity *= default_selectivity(op);
+                continue;
+            }
+        }
+        bounded = true;
+    }
+    if bounded {
+        let in_range = if hi < lo {
+            0.0
+        } else {
+            (hi as f64 - lo as f64 + 1.0) / range
+        };
+        selectivity *= in_range.clamp(0.0, 1.0);
+    }
+    selectivity
+}
+
+// Same guesses SQLite makes for constraints it knows nothing about.
+fn default_selectivity(op: u32) -> f64 {
+    match op {
+        sqlite::INDEX_CONSTRAINT_EQ | sqlite::INDEX_CONSTRAINT_IS => 0.1,
+        sqlite::INDEX_CONSTRAINT_GT
+        | sqlite::INDEX_CONSTRAINT_GE
+        | sqlite::INDEX_CONSTRAINT_LT
+        | sqlite::INDEX_CONSTRAINT_LE => 0.25,
+        _ => 0.5,
+    }
+}
+
+fn log2(n: f64) -> f64 {
+    // no_std has no float log. Counting bits is close enough for a cost.
+    let mut n = n.max(1.0) as u64;
+    let mut log = 1.0;
+    while n > 1 {
+        n >>= 1;
+        log += 1.0;
+    }
+    log
+}
+
+pub fn changes_stats<'a>(ext_data: *mut crsql_ExtData) -> &'a mut ChangesStats {
+    unsafe { &mut *((*ext_data).changesStats as *mut ChangesStats) }
+}
+
+/**
+ * The stats for `changes_best_index`, re-gathering them first if they are stale.
+ * Table infos and the db version must be up to date.
+ */
+pub fn fresh_changes_stats<'a>(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+) -> Result<&'a ChangesStats, ResultCode> {
+    let stats = changes_stats(ext_data);
+    if stats.is_stale(ext_data) {
+        stats.refresh(db, ext_data)?;
+    }
+    Ok(stats)
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_init_changes_stats(ext_data: *mut crsql_ExtData) {
+    let stats = ChangesStats {
+        loaded: false,
+        schema_version: -1,
+        db_version: -1,
+        num_sites: 1.0,
+        tables: BTreeMap::new(),
+    };
+    unsafe { (*ext_data).changesStats = Box::into_raw(Box::new(stats)) as *mut c_void }
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_drop_changes_stats(ext_data: *mut crsql_ExtData) {
+    unsafe {
+        if !(*ext_data).changesStats.is_null() {
+            drop(Box::from_raw((*ext_data).changesStats as *mut ChangesStats));
+            (*ext_data).changesStats = core::ptr::null_mut();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use alloc::vec;
+
+    fn stats(rows: f64, min_version: i64, max_version: i64) -> ClockStats {
+        ClockStats {
+            rows,
+            rows_per_version: rows / (max_version - min_version + 1) as f64,
+            min_version,
+            max_version,
+        }
+    }
+
+    #[test]
+    fn version_selectivity_uses_known_bounds() {
+        let s = stats(1000.0, 1, 100);
+        let gt = |v| vec![(sqlite::INDEX_CONSTRAINT_GT, Some(v))];
+        assert_eq!(version_selectivity(&s, &gt(0)), 1.0);
+        assert_eq!(version_selectivity(&s, &gt(90)), 0.1);
+        assert_eq!(version_selectivity(&s, &gt(100)), 0.0);
+        assert_eq!(version_selectivity(&s, &gt(1000)), 0.0);
+        assert_eq!(
+            version_selectivity(&s, &vec![(sqlite::INDEX_CONSTRAINT_EQ, None)]),
+            0.01
+        );
+        assert_eq!(
+            version_selectivity(&s, &vec![(sqlite::INDEX_CONSTRAINT_GT, None)]),
+            0.25
+        );
+        assert_eq!(
+            version_selectivity(
+                &s,
+                &vec![
+                    (sqlite::INDEX_CONSTRAINT_GT, Some(50)),
+                    (sqlite::INDEX_CONSTRAINT_LE, Some(60))
+                ]
+            ),
+            0.1
+        );
+        assert_eq!(
+            version_selectivity(
+                &s,
+                &vec![
+                    (sqlite::INDEX_CONSTRAINT_GE, Some(60)),
+                    (sqlite::INDEX_CONSTRAINT_LT, Some(50))
+                ]
+            ),
+            0.0
+        );
+    }
+
+    #[test]
+    fn average_table_of_nothing() {
+        assert!(average_table(&BTreeMap::new()).is_none());
+    }
+
+    #[test]
+    fn log2_counts_bits() {
+        assert_eq!(log2(0.0), 1.0);
+        assert_eq!(log2(1.0), 1.0);
+        assert_eq!(log2(1024.0), 11.0);
+    }
+}
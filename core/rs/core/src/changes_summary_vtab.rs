@@ -0,0 +1,380 @@
+extern crate alloc;
+
+use core::ffi::{c_char, c_int, c_void};
+use core::mem::ManuallyDrop;
+use core::slice;
+
+use alloc::boxed::Box;
+use alloc::format;
+use alloc::string::String;
+use alloc::vec::Vec;
+use num_traits::FromPrimitive;
+use sqlite::{ColumnType, Connection, Context, ResultCode, Value};
+use sqlite_nostd as sqlite;
+
+use crate::c::crsql_ExtData;
+use crate::site_id_dict::get_site_ordinal;
+use crate::stmt_cache::{changes_stmt_cache, ChangesStmtKey};
+use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, TableInfo};
+
+enum Columns {
+    Table = 0,
+    Count = 1,
+    MaxDbVersion = 2,
+    Since = 3,
+    ExcludeSite = 4,
+}
+
+#[repr(C)]
+struct SummaryVtab {
+    base: sqlite::vtab,
+    db: *mut sqlite::sqlite3,
+    ext_data: *mut crsql_ExtData,
+}
+
+/**
+ * One row of output: a table with changes after `since`.
+ */
+struct TableSummary {
+    table: String,
+    count: i64,
+    max_db_version: i64,
+}
+
+#[repr(C)]
+struct Cursor {
+    base: sqlite::vtab_cursor,
+    crsr: usize,
+    rows: Vec<TableSummary>,
+    since: Option<i64>,
+    exclude_site: Option<Vec<u8>>,
+}
+
+extern "C" fn connect(
+    db: *mut sqlite::sqlite3,
+    aux: *mut c_void,
+    _argc: c_int,
+    _argv: *const *const c_char,
+    vtab: *mut *mut sqlite::vtab,
+    _err: *mut *mut c_char,
+) -> c_int {
+    if let Err(rc) = sqlite::declare_vtab(
+        db,
+        "CREATE TABLE x([table] TEXT, [count] INTEGER, [max_db_version] INTEGER, [since] INTEGER HIDDEN, [exclude_site] BLOB HIDDEN);",
+    ) {
+        return rc as c_int;
+    }
+
+    unsafe {
+        *vtab = Box::into_raw(Box::new(SummaryVtab {
+            base: sqlite::vtab {
+                nRef: 0,
+                pModule: core::ptr::null(),
+                zErrMsg: core::ptr::null_mut(),
+                #[cfg(feature = "libsql")]
+                pLibsqlModule: core::ptr::null_mut(),
+            },
+            db,
+            ext_data: aux as *mut crsql_ExtData,
+        }))
+        .cast::<sqlite::vtab>();
+    }
+    ResultCode::OK as c_int
+}
+
+extern "C" fn disconnect(vtab: *mut sqlite::vtab) -> c_int {
+    unsafe {
+        drop(Box::from_raw(vtab.cast::<SummaryVtab>()));
+    }
+    ResultCode::OK as c_int
+}
+
+/**
+ * `since` and `exclude_site` are the arguments of the table-valued function.
+ * idx_num 1 marks `since` as passed and 2 `exclude_site`, in that order.
+ */
+extern "C" fn best_index(_vtab: *mut sqlite::vtab, index_info: *mut sqlite::index_info) -> c_int {
+    let constraints = unsafe {
+        slice::from_raw_parts(
+            (*index_info).aConstraint,
+            (*index_info).nConstraint as usize,
+        )
+    };
+    let constraint_usage = unsafe {
+        slice::from_raw_parts_mut(
+            (*index_info).aConstraintUsage,
+            (*index_info).nConstraint as usize,
+        )
+    };
+
+    let mut args = [None, None];
+    for (i, constraint) in constraints.iter().enumerate() {
+        let arg = if constraint.iColumn == Columns::Since as i32 {
+            0
+        } else if constraint.iColumn == Columns::ExcludeSite as i32 {
+            1
+        } else {
+            continue;
+        };
+        if constraint.op != sqlite::INDEX_CONSTRAINT_EQ as u8 {
+            continue;
+        }
+        if constraint.usable == 0 {
+            // an argument that can't be used yet, let SQLite try another plan
+            return ResultCode::CONSTRAINT as c_int;
+        }
+        args[arg] = Some(i);
+    }
+
+    let mut idx_num = 0;
+    let mut argv_index = 0;
+    for (arg, constraint) in args.iter().enumerate() {
+        if let Some(i) = constraint {
+            argv_index += 1;
+            idx_num |= 1 << arg;
+            constraint_usage[*i].argvIndex = argv_index;
+            constraint_usage[*i].omit = 1;
+        }
+    }
+    unsafe {
+        (*index_info).idxNum = idx_num;
+        // one aggregate per clock table
+        (*index_info).estimatedCost = 100.0;
+        (*index_info).estimatedRows = 10;
+    }
+
+    ResultCode::OK as c_int
+}
+
+extern "C" fn open(_vtab: *mut sqlite::vtab, cursor: *mut *mut sqlite::vtab_cursor) -> c_int {
+    unsafe {
+        let boxed = Box::new(Cursor {
+            base: sqlite::vtab_cursor {
+                pVtab: core::ptr::null_mut(),
+            },
+            crsr: 0,
+            rows: Vec::new(),
+            since: None,
+            exclude_site: None,
+        });
+        *cursor = Box::into_raw(boxed).cast::<sqlite::vtab_cursor>();
+    }
+
+    ResultCode::OK as c_int
+}
+
+extern "C" fn close(cursor: *mut sqlite::vtab_cursor) -> c_int {
+    unsafe {
+        drop(Box::from_raw(cursor.cast::<Cursor>()));
+    }
+    ResultCode::OK as c_int
+}
+
+extern "C" fn filter(
+    cursor: *mut sqlite::vtab_cursor,
+    idx_num: c_int,
+    _idx_str: *const c_char,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+) -> c_int {
+    let args = sqlite::args!(argc, argv);
+    let crsr = cursor.cast::<Cursor>();
+    let tab = unsafe { (*cursor).pVtab.cast::<SummaryVtab>() };
+    let mut args = args.iter();
+    unsafe {
+        (*crsr).crsr = 0;
+        (*crsr).rows.clear();
+        (*crsr).since = None;
+        (*crsr).exclude_site = None;
+        if idx_num & 1 == 1 {
+            if let Some(since) = args.next() {
+                if since.value_type() != ColumnType::Null {
+                    (*crsr).since = Some(since.int64());
+                }
+            }
+        }
+        if idx_num & 2 == 2 {
+            if let Some(site) = args.next() {
+                if site.value_type() == ColumnType::Blob {
+                    (*crsr).exclude_site = Some(site.blob().to_vec());
+                }
+            }
+        }
+    }
+
+    match summarize(crsr, tab) {
+        Ok(rc) => rc as c_int,
+        Err(rc) => rc as c_int,
+    }
+}
+
+/**
+ * Counts the changes of each clock table straight from its `db_version` index.
+ * Tables whose high-water mark is at or below `since` are not read at all.
+ */
+fn summarize(crsr: *mut Cursor, tab: *mut SummaryVtab) -> Result<ResultCode, ResultCode> {
+    let (db, ext_data) = unsafe { ((*tab).db, (*tab).ext_data) };
+    let c_rc = crsql_ensure_table_infos_are_up_to_date(db, ext_data, unsafe {
+        &mut (*tab).base.zErrMsg as *mut _
+    });
+    if c_rc != 0 {
+        return Err(ResultCode::from_i32(c_rc).unwrap_or(ResultCode::ERROR));
+    }
+    crate::db_version::fill_db_version_if_needed(db, ext_data).or(Err(ResultCode::ERROR))?;
+
+    let since = unsafe { (*crsr).since }.unwrap_or(i64::MIN);
+    // A site this db has never seen wrote none of its changes, so nothing is excluded.
+    let exclude_ordinal = match unsafe { &(*crsr).exclude_site } {
+        Some(site_id) => get_site_ordinal(db, ext_data, site_id)?,
+        None => None,
+    };
+
+    let tbl_infos =
+        unsafe { ManuallyDrop::new(Box::from_raw((*ext_data).tableInfos as *mut Vec<TableInfo>)) };
+    let cache = changes_stmt_cache(ext_data);
+    let generation = cache.generation();
+    for tbl_info in tbl_infos.iter() {
+        if tbl_info.max_db_version(db, ext_data)? <= since {
+            continue;
+        }
+
+        let key: ChangesStmtKey = (
+            format!(
+                "SELECT count(*), max(db_version) FROM \"{table_name}__crsql_clock\" WHERE db_version > ?{site}",
+                table_name = crate::util::escape_ident(&tbl_info.tbl_name),
+                site = if exclude_ordinal.is_some() {
+                    " AND site_id IS NOT ?"
+                } else {
+                    ""
+                },
+            ),
+            None,
+        );
+        let stmt = match cache.take(&key) {
+            Some(stmt) => stmt,
+            None => db.prepare_v3(&key.0, sqlite::PREPARE_PERSISTENT)?,
+        };
+        let result = summarize_table(&stmt, since, exclude_ordinal);
+        cache.put(generation, key, stmt)?;
+        let (count, max_db_version) = result?;
+        if count > 0 {
+            unsafe {
+                (*crsr).rows.push(TableSummary {
+                    table: tbl_info.tbl_name.clone(),
+                    count,
+                    max_db_version,
+                });
+            }
+        }
+    }
+
+    Ok(ResultCode::OK)
+}
+
+fn summarize_table(
+    stmt: &sqlite::ManagedStmt,
+    since: i64,
+    exclude_ordinal: Option<i64>,
+) -> Result<(i64, i64), ResultCode> {
+    stmt.bind_int64(1, since)?;
+    if let Some(ordinal) = exclude_ordinal {
+        stmt.bind_int64(2, ordinal)?;
+    }
+    if stmt.step()? != ResultCode::ROW {
+        return Ok((0, 0));
+    }
+    Ok((stmt.column_int64(0), stmt.column_int64(1)))
+}
+
+extern "C" fn next(cursor: *mut sqlite::vtab_cursor) -> c_int {
+    let crsr = cursor.cast::<Cursor>();
+    unsafe {
+        (*crsr).crsr += 1;
+    }
+    ResultCode::OK as c_int
+}
+
+extern "C" fn eof(cursor: *mut sqlite::vtab_cursor) -> c_int {
+    let crsr = cursor.cast::<Cursor>();
+    unsafe { ((*crsr).crsr >= (*crsr).rows.len()) as c_int }
+}
+
+extern "C" fn column(
+    cursor: *mut sqlite::vtab_cursor,
+    ctx: *mut sqlite::context,
+    col_num: c_int,
+) -> c_int {
+    let crsr = unsafe { &*cursor.cast::<Cursor>() };
+    let row = &crsr.rows[crsr.crsr];
+    match col_num {
+        x if x == Columns::Table as c_int => ctx.result_text_transient(&row.table),
+        x if x == Columns::Count as c_int => ctx.result_int64(row.count),
+        x if x == Columns::MaxDbVersion as c_int => ctx.result_int64(row.max_db_version),
+        x if x == Columns::Since as c_int => match crsr.since {
+            Some(since) => ctx.result_int64(since),
+            None => ctx.result_null(),
+        },
+        x if x == Columns::ExcludeSite as c_int => match &crsr.exclude_site {
+            Some(site_id) => ctx.result_blob_shared(site_id),
+            None => ctx.result_null(),
+        },
+        _ => return ResultCode::MISUSE as c_int,
+    }
+    ResultCode::OK as c_int
+}
+
+extern "C" fn rowid(cursor: *mut sqlite::vtab_cursor, row_id: *mut sqlite::int64) -> c_int {
+    let crsr = cursor.cast::<Cursor>();
+    unsafe { *row_id = (*crsr).crsr as i64 }
+    ResultCode::OK as c_int
+}
+
+static MODULE: sqlite_nostd::module = sqlite_nostd::module {
+    iVersion: 0,
+    xCreate: None,
+    xConnect: Some(connect),
+    xBestIndex: Some(best_index),
+    xDisconnect: Some(disconnect),
+    xDestroy: None,
+    xOpen: Some(open),
+    xClose: Some(close),
+    xFilter: Some(filter),
+    xNext: Some(next),
+    xEof: Some(eof),
+    xColumn: Some(column),
+    xRowid: Some(rowid),
+    xUpdate: None,
+    xBegin: None,
+    xSync: None,
+    xCommit: None,
+    xRollback: None,
+    xFindFunction: None,
+    xRename: None,
+    xSavepoint: None,
+    xRelease: None,
+    xRollbackTo: None,
+    xShadowName: None,
+    xIntegrity: None,
+};
+
+/**
+ * CREATE TABLE [x] ([table], count, max_db_version, since HIDDEN, exclude_site HIDDEN);
+ * SELECT [table], count, max_db_version FROM crsql_changes_summary(since, exclude_site);
+ *
+ * The number of changes `crsql_changes WHERE db_version > since AND site_id IS NOT
+ * exclude_site` would return for each table and the highest db_version among them,
+ * without reading the tables themselves. Tables without such changes are left out.
+ */
+pub fn create_module(
+    db: *mut sqlite::sqlite3,
+    ext_data: *mut crsql_ExtData,
+) -> Result<ResultCode, ResultCode> {
+    db.create_module_v2(
+        "crsql_changes_summary",
+        &MODULE,
+        Some(ext_data as *mut c_void),
+        None,
+    )?;
+
+    Ok(ResultCode::OK)
+}
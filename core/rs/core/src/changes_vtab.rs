@@ -1,45 +1,51 @@
 extern crate alloc;
 use crate::alloc::string::ToString;
+use crate::changes_stats::fresh_changes_stats;
 use crate::changes_vtab_write::crsql_merge_insert;
-use crate::stmt_cache::reset_cached_stmt;
-use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, TableInfo};
+use crate::db_version::fill_db_version_if_needed;
+use crate::stmt_cache::{changes_stmt_cache, ChangesStmtKey};
+use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, find_table_info_index, TableInfo};
 use alloc::boxed::Box;
 use alloc::format;
 use alloc::string::String;
+use alloc::vec;
 use alloc::vec::Vec;
-use core::ffi::{c_char, c_int, CStr};
-use core::mem::{self, forget};
+use core::ffi::{c_char, c_int, c_void, CStr};
+use core::mem;
 use core::ptr::null_mut;
 
 use alloc::ffi::CString;
-#[cfg(not(feature = "std"))]
 use num_traits::FromPrimitive;
-use sqlite::{ColumnType, Connection, Context, Stmt, Value};
+use sqlite::{ColumnType, Connection, Context, ManagedStmt, Stmt, Value};
 use sqlite_nostd as sqlite;
 use sqlite_nostd::ResultCode;
 
 use crate::c::{
-    crsql_Changes_cursor, crsql_Changes_vtab, ChangeRowType, ClockUnionColumn, CrsqlChangesColumn,
+    crsql_Changes_cursor, crsql_Changes_vtab, crsql_ExtData, crsql_changes_vtab_in,
+    crsql_changes_vtab_in_first, crsql_changes_vtab_in_next, ChangeRowType, ClockUnionColumn,
+    CrsqlChangesColumn,
 };
-use crate::changes_vtab_read::changes_union_query;
-use crate::pack_columns::bind_package_to_stmt;
-use crate::pack_columns::unpack_columns;
+use crate::changes_vtab_read::{changes_union_query, ClockMerge};
+use crate::pk_range::{PkFilter, PkOp, PK_OPS};
+use crate::site_id_dict::{get_site_id, get_site_ordinal, site_id_dict};
 
-fn changes_crsr_finalize(crsr: *mut crsql_Changes_cursor) -> c_int {
+#[no_mangle]
+pub extern "C" fn crsql_changes_crsr_finalize(crsr: *mut crsql_Changes_cursor) -> c_int {
     // Assign pointers to null after freeing
     // since we can get into this twice for the same cursor object.
     unsafe {
         let mut rc = 0;
-        rc += match (*crsr).pChangesStmt.finalize() {
-            Ok(rc) => rc as c_int,
-            Err(rc) => rc as c_int,
-        };
         (*crsr).pChangesStmt = null_mut();
-        let reset_rc = reset_cached_stmt((*crsr).pRowStmt);
-        match reset_rc {
-            Ok(r) | Err(r) => rc += r as c_int,
-        }
         (*crsr).pRowStmt = null_mut();
+        if !(*crsr).pClockMerge.is_null() {
+            // pChangesStmt and pRowStmt are owned by the merge which hands its
+            // statements back to the cache.
+            let merge = Box::from_raw((*crsr).pClockMerge as *mut ClockMerge);
+            (*crsr).pClockMerge = null_mut();
+            match merge.release(changes_stmt_cache((*(*crsr).pTab).pExtData)) {
+                Ok(r) | Err(r) => rc += r as c_int,
+            }
+        }
         (*crsr).dbVersion = crate::consts::MIN_POSSIBLE_DB_VERSION;
 
         return rc;
@@ -59,7 +65,7 @@ pub unsafe extern "C" fn crsql_changes_best_index(
 }
 
 fn changes_best_index(
-    _vtab: *mut sqlite::vtab,
+    vtab: *mut sqlite::vtab,
     index_info: *mut sqlite::index_info,
 ) -> Result<ResultCode, ResultCode> {
     let mut idx_num: i32 = 0;
@@ -70,8 +76,169 @@ fn changes_best_index(
     let constraint_usage =
         sqlite::args_mut!((*index_info).nConstraint, (*index_info).aConstraintUsage);
     let mut arg_v_index = 1;
+
+    // A `table = ?` constraint is not applied to the union query.
+    // Instead it is handed to `changes_filter` as the first argument so only the
+    // matching tables are included in the union. See `changes_filter`.
+    // `table IN (...)` is handed over the same way, as a single list, and sets 512.
+    for (i, constraint) in constraints.iter().enumerate() {
+        if constraint.usable != 0
+            && constraint.iColumn == CrsqlChangesColumn::Tbl as i32
+            && constraint.op == sqlite::INDEX_CONSTRAINT_EQ as u8
+        {
+            constraint_usage[i].argvIndex = arg_v_index;
+            constraint_usage[i].omit = 1;
+            arg_v_index += 1;
+            idx_num |= 8;
+            if unsafe { crsql_changes_vtab_in(index_info, i as c_int) } != 0 {
+                idx_num |= 512;
+            }
+            break;
+        }
+    }
+
+    // `site_id` is stored as an ordinal into `crsql_site_id`. Constraints that
+    // only compare for (in)equality are applied to the ordinal and changes_filter
+    // translates their arguments, so no join against `crsql_site_id` is needed.
+    // Their arguments directly follow the table argument and are counted in
+    // `idx_num >> 16`. Anything else on `site_id` sets 64, joining in the site ids.
+    let mut num_site_args = 0;
+    let mut site_constraints = vec![];
+    for (i, constraint) in constraints.iter().enumerate() {
+        if !constraint_is_usable(constraint)
+            || constraint.iColumn != CrsqlChangesColumn::SiteId as i32
+        {
+            continue;
+        }
+        let op_string = match constraint.op as u32 {
+            sqlite::INDEX_CONSTRAINT_EQ
+            | sqlite::INDEX_CONSTRAINT_IS
+            | sqlite::INDEX_CONSTRAINT_NE
+            | sqlite::INDEX_CONSTRAINT_ISNOT
+            | sqlite::INDEX_CONSTRAINT_ISNULL
+            | sqlite::INDEX_CONSTRAINT_ISNOTNULL => get_operator_string(constraint.op),
+            _ => None,
+        };
+        if let Some(op_string) = op_string {
+            if first_constraint {
+                str.push_str("WHERE ");
+                first_constraint = false
+            } else {
+                str.push_str(" AND ");
+            }
+            if constraint.op == sqlite::INDEX_CONSTRAINT_ISNOTNULL as u8
+                || constraint.op == sqlite::INDEX_CONSTRAINT_ISNULL as u8
+            {
+                str.push_str(&format!("site_ord {}", op_string));
+                constraint_usage[i].argvIndex = 0;
+            } else if constraint.op == sqlite::INDEX_CONSTRAINT_EQ as u8
+                && unsafe { crsql_changes_vtab_in(index_info, i as c_int) } != 0
+            {
+                str.push_str("site_ord IN (?)");
+                constraint_usage[i].argvIndex = arg_v_index;
+                arg_v_index += 1;
+                num_site_args += 1;
+            } else {
+                str.push_str(&format!("site_ord {} ?", op_string));
+                constraint_usage[i].argvIndex = arg_v_index;
+                arg_v_index += 1;
+                num_site_args += 1;
+            }
+            constraint_usage[i].omit = 1;
+            site_constraints.push(i);
+            idx_num |= 4;
+        } else {
+            idx_num |= 64;
+        }
+    }
+    idx_num |= num_site_args << 16;
+
+    // A lower bound on `db_version` lets changes_filter leave out the clock tables
+    // that have not changed since. Its argument follows the site id arguments.
+    // 128 marks a `>` bound, 256 a `>=` bound.
+    let mut handled_constraints = site_constraints;
+    for (i, constraint) in constraints.iter().enumerate() {
+        if !constraint_is_usable(constraint)
+            || constraint.iColumn != CrsqlChangesColumn::DbVrsn as i32
+        {
+            continue;
+        }
+        let (op_string, bit) = match constraint.op as u32 {
+            sqlite::INDEX_CONSTRAINT_GT => (">", 128),
+            sqlite::INDEX_CONSTRAINT_GE => (">=", 256),
+            _ => continue,
+        };
+        if first_constraint {
+            str.push_str("WHERE ");
+            first_constraint = false
+        } else {
+            str.push_str(" AND ");
+        }
+        str.push_str(&format!("db_vrsn {} ?", op_string));
+        constraint_usage[i].argvIndex = arg_v_index;
+        constraint_usage[i].omit = 1;
+        arg_v_index += 1;
+        handled_constraints.push(i);
+        idx_num |= 2 | bit;
+        break;
+    }
+
+    // crsql_changes_rowid is `tbl_idx * ROWID_SLAB_SIZE + key`. Solving for `key`
+    // turns a rowid constraint into a seek on each clock table's primary key.
+    for (i, constraint) in constraints.iter().enumerate() {
+        if constraint.usable == 0 || constraint.iColumn != -1 {
+            continue;
+        }
+        let op_string = match constraint.op as u32 {
+            sqlite::INDEX_CONSTRAINT_EQ
+            | sqlite::INDEX_CONSTRAINT_GT
+            | sqlite::INDEX_CONSTRAINT_GE
+            | sqlite::INDEX_CONSTRAINT_LT
+            | sqlite::INDEX_CONSTRAINT_LE => get_operator_string(constraint.op),
+            _ => None,
+        };
+        if let Some(op_string) = op_string {
+            if first_constraint {
+                str.push_str("WHERE ");
+                first_constraint = false
+            } else {
+                str.push_str(" AND ");
+            }
+            str.push_str(&format!(
+                "key {} (? - tbl_idx * {})",
+                op_string,
+                crate::consts::ROWID_SLAB_SIZE
+            ));
+            constraint_usage[i].argvIndex = arg_v_index;
+            constraint_usage[i].omit = 1;
+            arg_v_index += 1;
+            handled_constraints.push(i);
+        }
+    }
+
+    // Pk predicates, see `pk_range`. Besides being applied to `pks` they are pushed
+    // down to each table's `__crsql_pks` by changes_filter.
+    for (i, constraint) in constraints.iter().enumerate() {
+        if constraint.usable == 0 || constraint.iColumn != CrsqlChangesColumn::Pk as i32 {
+            continue;
+        }
+        if let Some(op) = PkOp::from_constraint_op(constraint.op) {
+            if first_constraint {
+                str.push_str("WHERE ");
+                first_constraint = false
+            } else {
+                str.push_str(" AND ");
+            }
+            str.push_str(&format!("{}(pks, ?)", op.function_name()));
+            constraint_usage[i].argvIndex = arg_v_index;
+            constraint_usage[i].omit = 1;
+            arg_v_index += 1;
+            handled_constraints.push(i);
+        }
+    }
+
     for (i, constraint) in constraints.iter().enumerate() {
-        if !constraint_is_usable(constraint) {
+        if !constraint_is_usable(constraint) || handled_constraints.contains(&i) {
             continue;
         }
         let col = CrsqlChangesColumn::from_i32(constraint.iColumn);
@@ -90,6 +257,15 @@ fn changes_best_index(
                     str.push_str(&format!("{} {}", col_name, op_string));
                     constraint_usage[i].argvIndex = 0;
                     constraint_usage[i].omit = 1;
+                } else if col == Some(CrsqlChangesColumn::Cid)
+                    && constraint.op == sqlite::INDEX_CONSTRAINT_EQ as u8
+                    && unsafe { crsql_changes_vtab_in(index_info, i as c_int) } != 0
+                {
+                    // expanded to one `?` per value by changes_filter
+                    str.push_str(&format!("{} IN (?)", col_name));
+                    constraint_usage[i].argvIndex = arg_v_index;
+                    constraint_usage[i].omit = 1;
+                    arg_v_index += 1;
                 } else {
                     str.push_str(&format!("{} {} ?", col_name, op_string));
                     constraint_usage[i].argvIndex = arg_v_index;
@@ -107,73 +283,144 @@ fn changes_best_index(
         }
     }
 
-    let mut desc = 0;
+    // `part_count = ? AND part_id = ?` reads only the changes of rows whose key falls
+    // in partition `part_id` of `part_count` so that several readers can split a read
+    // without overlap. Both must be given. Their arguments follow the others but the
+    // byte budget, LIMIT and OFFSET and are bound to named parameters. Sets 8192.
+    let partition_constraint = |column: CrsqlChangesColumn| {
+        let column = column as i32;
+        constraints.iter().position(|constraint| {
+            constraint.usable != 0
+                && constraint.iColumn == column
+                && constraint.op == sqlite::INDEX_CONSTRAINT_EQ as u8
+        })
+    };
+    if let (Some(count), Some(id)) = (
+        partition_constraint(CrsqlChangesColumn::PartCount),
+        partition_constraint(CrsqlChangesColumn::PartId),
+    ) {
+        // the last constraint, so `first_constraint` is not updated
+        str.push_str(if first_constraint { "WHERE " } else { " AND " });
+        str.push_str("key % :part_count = :part_id");
+        for i in [count, id] {
+            constraint_usage[i].argvIndex = arg_v_index;
+            constraint_usage[i].omit = 1;
+            arg_v_index += 1;
+        }
+        idx_num |= 8192;
+    }
+
+    // `val` is the only column that requires a lookup against the base table.
+    // Metadata-only scans can skip that lookup entirely.
+    if unsafe { (*index_info).colUsed } & (1 << CrsqlChangesColumn::Cval as u64) == 0 {
+        idx_num |= 32;
+    }
+
     let order_bys = sqlite::args!((*index_info).nOrderBy, (*index_info).aOrderBy);
     let mut order_by_consumed = true;
-    if order_bys.len() > 0 {
-        str.push_str(" ORDER BY ");
-    } else {
-        // The user didn't provide an ordering? Tack on a default one that will
-        // retrieve changes in-order
+    // No ordering or an ascending `db_version[, seq]` ordering can be served by
+    // merging per-table statements rather than sorting the union of all of them.
+    let merge_order = order_bys.iter().enumerate().all(|(i, order_by)| {
+        order_by.desc == 0
+            && match (i, CrsqlChangesColumn::from_i32(order_by.iColumn)) {
+                (0, Some(CrsqlChangesColumn::DbVrsn)) | (1, Some(CrsqlChangesColumn::Seq)) => true,
+                _ => false,
+            }
+    });
+    if merge_order {
+        // The user didn't provide an ordering or asked for the in-order one.
+        // Each per-table statement is ordered this way and merged in changes_next.
+        idx_num |= 16;
         str.push_str(" ORDER BY db_vrsn, seq ASC");
-    }
-    first_constraint = true;
-    for order_by in order_bys {
-        desc = order_by.desc;
-        let col = CrsqlChangesColumn::from_i32(order_by.iColumn);
-        if let Some(col_name) = get_clock_table_col_name(&col) {
-            if first_constraint {
-                first_constraint = false;
+    } else {
+        first_constraint = true;
+        for order_by in order_bys {
+            let col = CrsqlChangesColumn::from_i32(order_by.iColumn);
+            if let Some(col_name) = get_clock_table_col_name(&col) {
+                if first_constraint {
+                    str.push_str(" ORDER BY ");
+                    first_constraint = false;
+                } else {
+                    str.push_str(", ");
+                }
+                if col == Some(CrsqlChangesColumn::SiteId) {
+                    idx_num |= 64;
+                }
+                str.push_str(&col_name);
+                if order_by.desc != 0 {
+                    str.push_str(" DESC");
+                } else {
+                    str.push_str(" ASC");
+                }
             } else {
-                str.push_str(", ");
+                // TODO: test we're consuming
+                order_by_consumed = false;
             }
-            str.push_str(&col_name);
-        } else {
-            // TODO: test we're consuming
-            order_by_consumed = false;
         }
     }
 
-    if order_bys.len() > 0 {
-        if desc != 0 {
-            str.push_str(" DESC");
-        } else {
-            str.push_str(" ASC");
+    // `max_bytes = ?` sets a byte budget for the read. It is not part of the query
+    // and its argument follows all others but LIMIT and OFFSET. Sets 4096.
+    for (i, constraint) in constraints.iter().enumerate() {
+        if constraint.usable != 0
+            && constraint.iColumn == CrsqlChangesColumn::MaxBytes as i32
+            && constraint.op == sqlite::INDEX_CONSTRAINT_EQ as u8
+        {
+            constraint_usage[i].argvIndex = arg_v_index;
+            constraint_usage[i].omit = 1;
+            arg_v_index += 1;
+            idx_num |= 4096;
+            break;
         }
     }
 
-    // manual null-term since we'll pass to C
-    str.push('\0');
-
-    // TODO: update your order by py test to explain query plans to ensure correct indices are selected
-    // both constraints are present. Also to check that order by is consumed.
-    if idx_num & 6 == 6 {
-        unsafe {
-            (*index_info).estimatedCost = 1.0;
-            (*index_info).estimatedRows = 1;
-        }
-    }
-    // only the version constraint is present
-    else if idx_num & 2 == 2 {
-        unsafe {
-            (*index_info).estimatedCost = 10.0;
-            (*index_info).estimatedRows = 10;
+    // A LIMIT can be applied by the query itself when SQLite has nothing left to
+    // filter or sort afterwards. SQLite still skips OFFSET rows on its own so the
+    // query is limited to `limit + offset` rows. Their arguments come last.
+    // 1024 marks a LIMIT, 2048 an OFFSET.
+    if order_by_consumed
+        && constraints
+            .iter()
+            .enumerate()
+            .all(|(i, constraint)| is_limit_or_offset(constraint) || constraint_usage[i].omit != 0)
+    {
+        for (op, bit) in [
+            (sqlite::INDEX_CONSTRAINT_LIMIT, 1024),
+            (sqlite::INDEX_CONSTRAINT_OFFSET, 2048),
+        ] {
+            if bit == 2048 && idx_num & 1024 == 0 {
+                break;
+            }
+            if let Some(i) = constraints
+                .iter()
+                .position(|constraint| constraint.usable != 0 && constraint.op as u32 == op)
+            {
+                constraint_usage[i].argvIndex = arg_v_index;
+                arg_v_index += 1;
+                idx_num |= bit;
+            }
         }
-    }
-    // only the requestor constraint is present
-    else if idx_num & 4 == 4 {
-        unsafe {
-            (*index_info).estimatedCost = 2147483647.0;
-            (*index_info).estimatedRows = 2147483647;
+        if idx_num & 1024 == 1024 {
+            // a named parameter so it is not mistaken for a constraint's `?`
+            str.push_str(" LIMIT :limit");
         }
     }
-    // no constraints are present
-    else {
-        unsafe {
-            (*index_info).estimatedCost = 2147483647.0;
-            (*index_info).estimatedRows = 2147483647;
-        }
+
+    // manual null-term since we'll pass to C
+    str.push('\0');
+
+    // Estimates come from per-table stats cached on the connection so the planner
+    // can tell a selective `db_version > ?` from a full scan when ordering joins.
+    let tab = vtab.cast::<crsql_Changes_vtab>();
+    let (db, ext_data) = unsafe { ((*tab).db, (*tab).pExtData) };
+    let c_rc = crsql_ensure_table_infos_are_up_to_date(db, ext_data, unsafe {
+        &mut (*vtab).zErrMsg as *mut _
+    });
+    if c_rc != 0 {
+        return Err(ResultCode::from_i32(c_rc).unwrap_or(ResultCode::ERROR));
     }
+    fill_db_version_if_needed(db, ext_data).or(Err(ResultCode::ERROR))?;
+    fresh_changes_stats(db, ext_data)?.estimate(index_info, idx_num);
 
     unsafe {
         (*index_info).idxNum = idx_num;
@@ -195,7 +442,12 @@ fn constraint_is_usable(constraint: &sqlite::index_constraint) -> bool {
     }
     if let Some(col) = CrsqlChangesColumn::from_i32(constraint.iColumn) {
         match col {
-            CrsqlChangesColumn::Tbl | CrsqlChangesColumn::Pk | CrsqlChangesColumn::Cval => false,
+            CrsqlChangesColumn::Tbl
+            | CrsqlChangesColumn::Pk
+            | CrsqlChangesColumn::Cval
+            | CrsqlChangesColumn::MaxBytes
+            | CrsqlChangesColumn::PartCount
+            | CrsqlChangesColumn::PartId => false,
             _ => true,
         }
     } else {
@@ -203,6 +455,13 @@ fn constraint_is_usable(constraint: &sqlite::index_constraint) -> bool {
     }
 }
 
+fn is_limit_or_offset(constraint: &sqlite::index_constraint) -> bool {
+    match constraint.op as u32 {
+        sqlite::INDEX_CONSTRAINT_LIMIT | sqlite::INDEX_CONSTRAINT_OFFSET => true,
+        _ => false,
+    }
+}
+
 // Note: this is really the col name post-select from the clock table.
 fn get_clock_table_col_name(col: &Option<CrsqlChangesColumn>) -> Option<String> {
     match col {
@@ -215,6 +474,9 @@ fn get_clock_table_col_name(col: &Option<CrsqlChangesColumn>) -> Option<String>
         Some(CrsqlChangesColumn::SiteId) => Some("site_id".to_string()),
         Some(CrsqlChangesColumn::Seq) => Some("seq".to_string()),
         Some(CrsqlChangesColumn::Cl) => Some("cl".to_string()),
+        Some(CrsqlChangesColumn::MaxBytes) => None,
+        Some(CrsqlChangesColumn::PartCount) => None,
+        Some(CrsqlChangesColumn::PartId) => None,
         None => None,
     }
 }
@@ -244,7 +506,7 @@ fn get_operator_string(op: u8) -> Option<String> {
 #[no_mangle]
 pub unsafe extern "C" fn crsql_changes_filter(
     cursor: *mut sqlite::vtab_cursor,
-    _idx_num: c_int,
+    idx_num: c_int,
     idx_str: *const c_char,
     argc: c_int,
     argv: *mut *mut sqlite::value,
@@ -253,7 +515,7 @@ pub unsafe extern "C" fn crsql_changes_filter(
     let cursor = cursor.cast::<crsql_Changes_cursor>();
     let idx_str = unsafe { CStr::from_ptr(idx_str).to_str() };
     match idx_str {
-        Ok(idx_str) => match changes_filter(cursor, idx_str, args) {
+        Ok(idx_str) => match changes_filter(cursor, idx_num, idx_str, args) {
             Err(rc) | Ok(rc) => rc as c_int,
         },
         Err(_) => ResultCode::FORMAT as c_int,
@@ -262,16 +524,17 @@ pub unsafe extern "C" fn crsql_changes_filter(
 
 unsafe fn changes_filter(
     cursor: *mut crsql_Changes_cursor,
+    idx_num: c_int,
     idx_str: &str,
     args: &[*mut sqlite::value],
 ) -> Result<ResultCode, ResultCode> {
     let tab = (*cursor).pTab;
     let db = (*tab).db;
+    (*cursor).omitVal = if idx_num & 32 == 32 { 1 } else { 0 };
     // This should never happen. pChangesStmt should be finalized
     // before filter is ever invoked.
-    if !(*cursor).pChangesStmt.is_null() {
-        (*cursor).pChangesStmt.finalize()?;
-        (*cursor).pChangesStmt = null_mut();
+    if !(*cursor).pChangesStmt.is_null() || !(*cursor).pClockMerge.is_null() {
+        crsql_changes_crsr_finalize(cursor);
     }
 
     let c_rc = crsql_ensure_table_infos_are_up_to_date(
@@ -295,18 +558,272 @@ unsafe fn changes_filter(
         return Ok(ResultCode::OK);
     }
 
-    let sql = changes_union_query(&tbl_infos, idx_str)?;
+    // best_index passes the `table = ?` constraint, if any, as the first argument.
+    // Only the matching table is queried rather than every clock table.
+    // For `table IN (...)` the argument is a list of table names.
+    let (selected_tbl_infos, args) = if idx_num & 8 == 8 {
+        let tbl_args = if idx_num & 512 == 512 {
+            in_list_values(args[0])?
+        } else {
+            vec![args[0]]
+        };
+        let mut selected = vec![];
+        for tbl_arg in tbl_args {
+            if tbl_arg.value_type() == ColumnType::Null {
+                continue;
+            }
+            if let Some(i) = find_table_info_index((*tab).pExtData, &tbl_infos, tbl_arg.text()) {
+                selected.push(i);
+            }
+        }
+        selected.sort_unstable();
+        selected.dedup();
+        let selected = selected.into_iter().map(|i| (i, &tbl_infos[i])).collect();
+        (selected, &args[1..])
+    } else {
+        (tbl_infos.iter().enumerate().collect::<Vec<_>>(), args)
+    };
+    if selected_tbl_infos.len() == 0 {
+        return Ok(ResultCode::OK);
+    }
+    let join_site_ids = idx_num & 64 == 64;
+    let num_site_args = (idx_num >> 16) as usize;
+
+    // Clock tables whose latest change is at or below the `db_version` lower bound
+    // have nothing to return and are left out of the query.
+    let selected_tbl_infos =
+        if idx_num & (128 | 256) != 0 && args[num_site_args].value_type() == ColumnType::Integer {
+            let since = args[num_site_args].int64();
+            let inclusive = idx_num & 256 == 256;
+            crate::db_version::fill_db_version_if_needed(db, (*tab).pExtData)
+                .or(Err(ResultCode::ERROR))?;
+            let mut changed = Vec::with_capacity(selected_tbl_infos.len());
+            for (i, tbl_info) in selected_tbl_infos {
+                let max_db_version = tbl_info.max_db_version(db, (*tab).pExtData)?;
+                if max_db_version > since || (inclusive && max_db_version == since) {
+                    changed.push((i, tbl_info));
+                }
+            }
+            changed
+        } else {
+            selected_tbl_infos
+        };
+    if selected_tbl_infos.len() == 0 {
+        return Ok(ResultCode::OK);
+    }
+
+    // The LIMIT and OFFSET arguments, if any, are last. The byte budget precedes them.
+    let (args, offset) = if idx_num & 2048 == 2048 {
+        (&args[..args.len() - 1], args[args.len() - 1].int64().max(0))
+    } else {
+        (args, 0)
+    };
+    let (args, limit) = if idx_num & 1024 == 1024 {
+        let limit = args[args.len() - 1].int64();
+        (
+            &args[..args.len() - 1],
+            if limit < 0 {
+                -1
+            } else {
+                limit.saturating_add(offset)
+            },
+        )
+    } else {
+        (args, -1)
+    };
+    let (args, max_bytes) = if idx_num & 4096 == 4096 {
+        let max_bytes = args[args.len() - 1];
+        (
+            &args[..args.len() - 1],
+            if max_bytes.value_type() == ColumnType::Null || max_bytes.int64() < 0 {
+                None
+            } else {
+                Some(max_bytes.int64())
+            },
+        )
+    } else {
+        (args, None)
+    };
+
+    let (args, partition) = if idx_num & 8192 == 8192 {
+        (
+            &args[..args.len() - 2],
+            Some((args[args.len() - 2], args[args.len() - 1])),
+        )
+    } else {
+        (args, None)
+    };
+
+    // IN lists are bound one value per placeholder so each list length gets its
+    // own statement.
+    let (idx_str, arg_values, pk_filters) = expand_in_lists(idx_str, args)?;
+    let idx_str = idx_str.as_str();
+    // The queries differ by the number of cells in each pk predicate's bound.
+    let key_str = if pk_filters.is_empty() {
+        idx_str.to_string()
+    } else {
+        let cells: Vec<String> = pk_filters
+            .iter()
+            .map(|f| f.cells.map_or("-".to_string(), |c| c.to_string()))
+            .collect();
+        format!("{}\0{}", idx_str, cells.join(","))
+    };
+
+    // Statements are looked up by the tables they read from and idx_str.
+    // Anything not yet cached is prepared and will be cached once the cursor is done.
+    let cache = changes_stmt_cache((*tab).pExtData);
+    let checkouts: Vec<(ChangesStmtKey, Vec<(usize, &TableInfo)>)> = if idx_num & 16 == 16 {
+        // One statement per table, merged in changes_next.
+        selected_tbl_infos
+            .into_iter()
+            .map(|(i, tbl_info)| {
+                (
+                    (key_str.clone(), Some(tbl_info.tbl_name.clone())),
+                    vec![(i, tbl_info)],
+                )
+            })
+            .collect()
+    } else if idx_num & 8 == 0 && selected_tbl_infos.len() == tbl_infos.len() {
+        vec![((key_str, None), selected_tbl_infos)]
+    } else {
+        // a union of only the requested tables or of those that changed
+        let names: Vec<&str> = selected_tbl_infos
+            .iter()
+            .map(|(_, tbl_info)| tbl_info.tbl_name.as_str())
+            .collect();
+        vec![((key_str, Some(names.join("\0"))), selected_tbl_infos)]
+    };
 
-    let stmt = db.prepare_v2(&sql)?;
-    for (i, arg) in args.iter().enumerate() {
-        stmt.bind_value(i as i32 + 1, *arg)?;
+    let mut stmts = Vec::with_capacity(checkouts.len());
+    for (key, tables) in checkouts {
+        let stmt = match cache.take(&key) {
+            Some(stmt) => stmt,
+            None => {
+                let sql = changes_union_query(&tables, idx_str, join_site_ids, &pk_filters)?;
+                db.prepare_v3(&sql, sqlite::PREPARE_PERSISTENT)?
+            }
+        };
+        let mut param = 1;
+        for (i, values) in arg_values.iter().enumerate() {
+            for value in values {
+                if i < num_site_args {
+                    bind_site_ordinal(db, (*tab).pExtData, &stmt, param, *value)?;
+                } else {
+                    stmt.bind_value(param, *value)?;
+                }
+                param += 1;
+            }
+        }
+        if let Some((count, id)) = partition {
+            stmt.bind_value(param, count)?;
+            stmt.bind_value(param + 1, id)?;
+            param += 2;
+        }
+        if idx_num & 1024 == 1024 {
+            stmt.bind_int64(param, limit)?;
+        }
+        stmts.push((key, stmt));
+    }
+    let mut merge = ClockMerge::new(stmts, cache.generation())?;
+    if let Some(max_bytes) = max_bytes {
+        merge.set_byte_budget(max_bytes);
     }
-    (*cursor).pChangesStmt = stmt.stmt;
-    // forget the stmt. it will be managed by the vtab
-    forget(stmt);
+    if let Some((count, id)) = partition {
+        merge.set_partition(count.int64(), id.int64());
+    }
+    (*cursor).pClockMerge = Box::into_raw(Box::new(merge)) as *mut c_void;
     changes_next(cursor, (*cursor).pTab.cast::<sqlite::vtab>())
 }
 
+/**
+ * best_index writes `IN (?)` for IN constraints it asked to receive as a single list.
+ * Expands each of those to one placeholder per value in the list and returns the
+ * values to bind, grouped by the argument they came from.
+ * An empty list becomes `IN ()` which matches nothing.
+ *
+ * Placeholders are numbered so the clock table queries can refer to the bounds of
+ * pk predicates, which are returned as well.
+ */
+fn expand_in_lists(
+    idx_str: &str,
+    args: &[*mut sqlite::value],
+) -> Result<(String, Vec<Vec<*mut sqlite::value>>, Vec<PkFilter>), ResultCode> {
+    let mut expanded = String::with_capacity(idx_str.len());
+    let mut values = Vec::with_capacity(args.len());
+    let mut pk_filters = vec![];
+    let mut param = 1;
+    for (i, part) in idx_str.split('?').enumerate() {
+        if i > 0 {
+            let arg = *args.get(i - 1).ok_or(ResultCode::ERROR)?;
+            if expanded.ends_with("IN (") {
+                let list = in_list_values(arg)?;
+                let placeholders: Vec<String> = (param..param + list.len())
+                    .map(|p| format!("?{}", p))
+                    .collect();
+                expanded.push_str(&placeholders.join(", "));
+                param += list.len();
+                values.push(list);
+            } else {
+                if let Some(op) = PK_OPS
+                    .iter()
+                    .find(|op| expanded.ends_with(&format!("{}(pks, ", op.function_name())))
+                {
+                    pk_filters.push(PkFilter {
+                        op: *op,
+                        param,
+                        cells: if arg.value_type() == ColumnType::Blob && arg.bytes() > 0 {
+                            Some(arg.blob()[0] as usize)
+                        } else {
+                            None
+                        },
+                    });
+                }
+                expanded.push_str(&format!("?{}", param));
+                param += 1;
+                values.push(vec![arg]);
+            }
+        }
+        expanded.push_str(part);
+    }
+    Ok((expanded, values, pk_filters))
+}
+
+fn in_list_values(list: *mut sqlite::value) -> Result<Vec<*mut sqlite::value>, ResultCode> {
+    let mut values = vec![];
+    let mut value = null_mut();
+    let mut rc = unsafe { crsql_changes_vtab_in_first(list, &mut value) };
+    while rc == ResultCode::OK as c_int && !value.is_null() {
+        values.push(value);
+        rc = unsafe { crsql_changes_vtab_in_next(list, &mut value) };
+    }
+    if rc != ResultCode::OK as c_int {
+        return Err(ResultCode::from_i32(rc).unwrap_or(ResultCode::ERROR));
+    }
+    Ok(values)
+}
+
+/**
+ * Binds the ordinal standing in for the site id `arg` compared against `site_ord`.
+ * A site id this db has never seen gets an ordinal no row can have so `=` / `IS`
+ * match nothing and `!=` / `IS NOT` match everything, as they would for the site id.
+ */
+fn bind_site_ordinal(
+    db: *mut sqlite::sqlite3,
+    ext_data: *mut crsql_ExtData,
+    stmt: &ManagedStmt,
+    i: i32,
+    arg: *mut sqlite::value,
+) -> Result<ResultCode, ResultCode> {
+    match arg.value_type() {
+        ColumnType::Null => stmt.bind_null(i),
+        ColumnType::Blob => match get_site_ordinal(db, ext_data, arg.blob())? {
+            Some(ordinal) => stmt.bind_int64(i, ordinal),
+            None => stmt.bind_int64(i, -1),
+        },
+        _ => stmt.bind_int64(i, -1),
+    }
+}
+
 /**
  * Advances our Changes_cursor to its next row of output.
  * TODO: this'll get more idiomatic as we move dependencies to Rust
@@ -318,7 +835,7 @@ pub unsafe extern "C" fn crsql_changes_next(cursor: *mut sqlite::vtab_cursor) ->
     match changes_next(cursor, vtab) {
         Ok(rc) => rc as c_int,
         Err(rc) => {
-            changes_crsr_finalize(cursor);
+            crsql_changes_crsr_finalize(cursor);
             rc as c_int
         }
     }
@@ -329,23 +846,61 @@ unsafe fn changes_next(
     cursor: *mut crsql_Changes_cursor,
     vtab: *mut sqlite::vtab,
 ) -> Result<ResultCode, ResultCode> {
+    let rc = next_change(cursor, vtab)?;
     if (*cursor).pChangesStmt.is_null() {
-        let err = CString::new("pChangesStmt is null in changes_next")?;
-        (*vtab).zErrMsg = err.into_raw();
-        return Err(ResultCode::ABORT);
+        return Ok(rc);
     }
 
-    if !(*cursor).pRowStmt.is_null() {
-        let rc = reset_cached_stmt((*cursor).pRowStmt);
-        (*cursor).pRowStmt = null_mut();
-        if rc.is_err() {
-            return rc;
+    let merge = &mut *((*cursor).pClockMerge as *mut ClockMerge);
+    if !merge.charge((*cursor).dbVersion, change_bytes(cursor)) {
+        // over the byte budget, end at this db_version boundary
+        let c_rc = crsql_changes_crsr_finalize(cursor);
+        if c_rc != 0 {
+            return Err(ResultCode::ERROR);
+        }
+    }
+    Ok(rc)
+}
+
+/**
+ * Size of the current change's pk and value as counted against the byte budget.
+ * The value only counts if it was selected.
+ */
+unsafe fn change_bytes(cursor: *mut crsql_Changes_cursor) -> i64 {
+    fn value_bytes(stmt: *mut sqlite::stmt, i: i32) -> i64 {
+        match stmt.column_type(i) {
+            ColumnType::Null => 0,
+            ColumnType::Integer | ColumnType::Float => 8,
+            _ => stmt.column_bytes(i) as i64,
         }
     }
+    let mut bytes = value_bytes((*cursor).pChangesStmt, ClockUnionColumn::Pks as i32);
+    if (*cursor).rowType == ChangeRowType::Update as c_int && !(*cursor).pRowStmt.is_null() {
+        bytes += value_bytes((*cursor).pRowStmt, (*cursor).rowValIdx);
+    }
+    bytes
+}
+
+unsafe fn next_change(
+    cursor: *mut crsql_Changes_cursor,
+    vtab: *mut sqlite::vtab,
+) -> Result<ResultCode, ResultCode> {
+    if (*cursor).pClockMerge.is_null() {
+        let err = CString::new("pClockMerge is null in changes_next")?;
+        (*vtab).zErrMsg = err.into_raw();
+        return Err(ResultCode::ABORT);
+    }
 
-    let rc = (*cursor).pChangesStmt.step()?;
+    let merge = &mut *((*cursor).pClockMerge as *mut ClockMerge);
+    let rc = match merge.next()? {
+        Some(stmt) => {
+            (*cursor).pChangesStmt = stmt;
+            ResultCode::ROW
+        }
+        None => ResultCode::DONE,
+    };
     if rc == ResultCode::DONE {
-        let c_rc = changes_crsr_finalize(cursor);
+        let c_rc = crsql_changes_crsr_finalize(cursor);
         if c_rc == 0 {
             return Ok(ResultCode::OK);
         } else {
@@ -374,18 +929,22 @@ unsafe fn changes_next(
     let tbl_infos = mem::ManuallyDrop::new(Box::from_raw(
         (*(*(*cursor).pTab).pExtData).tableInfos as *mut Vec<TableInfo>,
     ));
-    // TODO: will this work given `insert_tbl` is null termed?
-    let tbl_info_index = tbl_infos.iter().position(|x| x.tbl_name == tbl);
+    // The union query carries each table's position in tbl_infos.
+    // The statement cache is dropped whenever tbl_infos are re-pulled so it is always current.
+    let tbl_info_index = (*cursor)
+        .pChangesStmt
+        .column_int64(ClockUnionColumn::TblIdx as i32) as usize;
 
-    if tbl_info_index.is_none() {
+    if tbl_info_index >= tbl_infos.len() || tbl_infos[tbl_info_index].tbl_name != tbl {
         let err = CString::new(format!("could not find schema for table {}", tbl))?;
         (*vtab).zErrMsg = err.into_raw();
         return Err(ResultCode::ERROR);
     }
-    // TODO: technically safe since we checked `is_none` but this should be more idiomatic
-    let tbl_info_index = tbl_info_index.unwrap();
 
     let tbl_info = &tbl_infos[tbl_info_index];
+
+    // pRowStmt is only valid for the change it was looked up for.
+    (*cursor).pRowStmt = null_mut();
     (*cursor).changesRowid = changes_rowid;
     (*cursor).tblInfoIdx = tbl_info_index as i32;
 
@@ -405,25 +964,32 @@ unsafe fn changes_next(
         (*cursor).rowType = ChangeRowType::Update as c_int;
     }
 
-    let row_stmt_ref = tbl_info.get_row_patch_data_stmt((*(*cursor).pTab).db, cid)?;
-    let row_stmt = row_stmt_ref.as_ref().ok_or(ResultCode::ERROR)?;
-
-    let packed_pks = pks.blob();
-    let unpacked_pks = unpack_columns(packed_pks)?;
-    bind_package_to_stmt(row_stmt.stmt, &unpacked_pks, 0)?;
+    if (*cursor).omitVal == 1 {
+        return Ok(ResultCode::OK);
+    }
 
-    match row_stmt.step() {
-        Ok(ResultCode::DONE) => {
-            reset_cached_stmt(row_stmt.stmt)?;
-        }
-        Ok(_) => {}
-        Err(rc) => {
-            reset_cached_stmt(row_stmt.stmt)?;
-            return Err(rc);
+    let col = match tbl_info.non_pks.iter().position(|x| x.name == cid) {
+        Some(col) => col,
+        None => {
+            let err = CString::new(format!("could not find column {} in table {}", cid, tbl))?;
+            (*vtab).zErrMsg = err.into_raw();
+            return Err(ResultCode::ERROR);
         }
-    }
+    };
 
-    (*cursor).pRowStmt = row_stmt.stmt;
+    // The merge buffers the row so consecutive changes to it are served from one lookup.
+    if let Some((row_stmt, idx)) = merge.row_value(
+        (*(*cursor).pTab).db,
+        changes_stmt_cache((*(*cursor).pTab).pExtData),
+        tbl_info_index,
+        tbl_info,
+        changes_rowid,
+        pks.blob(),
+        col,
+    )? {
+        (*cursor).pRowStmt = row_stmt;
+        (*cursor).rowValIdx = idx;
+    }
     Ok(ResultCode::OK)
 }
 
@@ -465,10 +1031,10 @@ fn column_impl(
             ctx.result_value(changes_stmt.column_value(ClockUnionColumn::Pks as i32));
         }
         Some(CrsqlChangesColumn::Cval) => unsafe {
-            if (*cursor).pRowStmt.is_null() {
+            if (*cursor).pRowStmt.is_null() || (*cursor).rowType != ChangeRowType::Update as c_int {
                 ctx.result_null();
             } else {
-                ctx.result_value((*cursor).pRowStmt.column_value(0));
+                ctx.result_value((*cursor).pRowStmt.column_value((*cursor).rowValIdx));
             }
         },
         Some(CrsqlChangesColumn::Cid) => unsafe {
@@ -477,11 +1043,7 @@ fn column_impl(
                 Some(ChangeRowType::PkOnly) => ctx.result_text_static(crate::c::INSERT_SENTINEL),
                 Some(ChangeRowType::Delete) => ctx.result_text_static(crate::c::DELETE_SENTINEL),
                 Some(ChangeRowType::Update) => {
-                    if (*cursor).pRowStmt.is_null() {
-                        ctx.result_text_static(crate::c::DELETE_SENTINEL);
-                    } else {
-                        ctx.result_value(changes_stmt.column_value(ClockUnionColumn::Cid as i32));
-                    }
+                    ctx.result_value(changes_stmt.column_value(ClockUnionColumn::Cid as i32));
                 }
                 None => return Err(ResultCode::ABORT),
             }
@@ -493,9 +1055,17 @@ fn column_impl(
             ctx.result_value(changes_stmt.column_value(ClockUnionColumn::DbVrsn as i32));
         }
         Some(CrsqlChangesColumn::SiteId) => {
-            // todo: short circuit null? if col type null bind null rather than value?
-            // sholdn't matter..
-            ctx.result_value(changes_stmt.column_value(ClockUnionColumn::SiteId as i32));
+            let col = ClockUnionColumn::SiteOrdinal as i32;
+            if changes_stmt.column_type(col) == ColumnType::Null {
+                ctx.result_null();
+            } else {
+                let ext_data = unsafe { (*(*cursor).pTab).pExtData };
+                let db = unsafe { (*(*cursor).pTab).db };
+                match get_site_id(db, ext_data, changes_stmt.column_int64(col))? {
+                    Some(site_id) => ctx.result_blob_shared(site_id),
+                    None => ctx.result_null(),
+                }
+            }
         }
         Some(CrsqlChangesColumn::Seq) => {
             ctx.result_value(changes_stmt.column_value(ClockUnionColumn::Seq as i32));
@@ -503,6 +1073,23 @@ fn column_impl(
         Some(CrsqlChangesColumn::Cl) => {
             ctx.result_value(changes_stmt.column_value(ClockUnionColumn::Cl as i32))
         }
+        Some(CrsqlChangesColumn::MaxBytes) => {
+            let merge = unsafe { (*cursor).pClockMerge as *mut ClockMerge };
+            match unsafe { merge.as_ref() }.and_then(|merge| merge.byte_budget()) {
+                Some(max_bytes) => ctx.result_int64(max_bytes),
+                None => ctx.result_null(),
+            }
+        }
+        Some(CrsqlChangesColumn::PartCount) | Some(CrsqlChangesColumn::PartId) => {
+            let merge = unsafe { (*cursor).pClockMerge as *mut ClockMerge };
+            match unsafe { merge.as_ref() }.and_then(|merge| merge.partition()) {
+                Some((count, _)) if column == Some(CrsqlChangesColumn::PartCount) => {
+                    ctx.result_int64(count)
+                }
+                Some((_, id)) => ctx.result_int64(id),
+                None => ctx.result_null(),
+            }
+        }
         None => return Err(ResultCode::MISUSE),
     }
 
@@ -572,3 +1159,24 @@ pub extern "C" fn crsql_changes_commit(vtab: *mut sqlite::vtab) -> c_int {
     }
     ResultCode::OK as c_int
 }
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_savepoint(vtab: *mut sqlite::vtab, savepoint: c_int) -> c_int {
+    let tab = vtab.cast::<crsql_Changes_vtab>();
+    site_id_dict(unsafe { (*tab).pExtData }).savepoint(savepoint);
+    ResultCode::OK as c_int
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_release(vtab: *mut sqlite::vtab, savepoint: c_int) -> c_int {
+    let tab = vtab.cast::<crsql_Changes_vtab>();
+    site_id_dict(unsafe { (*tab).pExtData }).release(savepoint);
+    ResultCode::OK as c_int
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_rollback_to(vtab: *mut sqlite::vtab, savepoint: c_int) -> c_int {
+    let tab = vtab.cast::<crsql_Changes_vtab>();
+    site_id_dict(unsafe { (*tab).pExtData }).rollback_to(savepoint);
+    ResultCode::OK as c_int
+}
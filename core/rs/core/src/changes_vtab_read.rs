@@ -1,14 +1,25 @@
 extern crate alloc;
+use crate::c::ClockUnionColumn;
+use crate::pack_columns::{bind_package_to_stmt, unpack_columns};
+use crate::pk_range::{pk_filter_condition, PkFilter};
+use crate::stmt_cache::{reset_cached_stmt, ChangesStmtCache, ChangesStmtKey};
 use crate::tableinfo::TableInfo;
+use alloc::collections::{BTreeMap, BinaryHeap};
 use alloc::format;
-use alloc::string::String;
+use alloc::string::{String, ToString};
 use alloc::vec;
 use alloc::vec::Vec;
-use sqlite::ResultCode;
+use core::cmp::Reverse;
+use sqlite::{Connection, ManagedStmt, ResultCode, Stmt};
 
 use sqlite_nostd as sqlite;
 
-fn crsql_changes_query_for_table(table_info: &TableInfo) -> Result<String, ResultCode> {
+fn crsql_changes_query_for_table(
+    tbl_idx: usize,
+    table_info: &TableInfo,
+    join_site_ids: bool,
+    pk_filters: &[PkFilter],
+) -> Result<String, ResultCode> {
     if table_info.pks.len() == 0 {
         // no primary keys? We can't get changes for a table w/o primary keys...
         // this should be an impossible case.
@@ -16,52 +27,373 @@ fn crsql_changes_query_for_table(table_info: &TableInfo) -> Result<String, Resul
     }
 
     let pk_list = crate::util::as_identifier_list(&table_info.pks, Some("pk_tbl."))?;
-    // TODO: we can remove the self join if we put causal length in the primary key table
+    // Keys created by a build without packed pk support are left NULL, hence the fallback.
+    let pks = if table_info.has_packed_pks {
+        format!("COALESCE(pk_tbl.__crsql_packed_pks, crsql_pack_columns({pk_list}))")
+    } else {
+        format!("crsql_pack_columns({pk_list})")
+    };
 
     // We LEFT JOIN and COALESCE the causal length
     // since we incorporated an optimization to not store causal length records
     // until they're required. I.e., do not store them until a delete
     // is actually issued. This cuts data weight quite a bit for
     // rows that never get removed.
+    // Lookaside tables that keep the causal length let us skip the self join.
+    let (cl, cl_join) = if table_info.has_lookaside_cl {
+        ("COALESCE(pk_tbl.__crsql_cl, 1)".to_string(), String::new())
+    } else {
+        (
+            "COALESCE(t2.col_version, 1)".to_string(),
+            format!(
+                "
+      LEFT JOIN \"{table_name_ident}__crsql_clock\" AS t2 ON
+      t1.key = t2.key AND t2.col_name = '{sentinel}'",
+                table_name_ident = crate::util::escape_ident(&table_info.tbl_name),
+                sentinel = crate::c::INSERT_SENTINEL,
+            ),
+        )
+    };
+    // Pk predicates are pushed down to the pks table so its index picks the rows.
+    let pk_conditions: Vec<String> = pk_filters
+        .iter()
+        .filter_map(|filter| pk_filter_condition(table_info, filter))
+        .collect();
+    let pk_where = if pk_conditions.is_empty() {
+        String::new()
+    } else {
+        format!("\n      WHERE {}", pk_conditions.join(" AND "))
+    };
     Ok(format!(
         "SELECT
           '{table_name_val}' as tbl,
-          crsql_pack_columns({pk_list}) as pks,
+          {pks} as pks,
           t1.col_name as cid,
           t1.col_version as col_vrsn,
           t1.db_version as db_vrsn,
-          site_tbl.site_id as site_id,
+          {site_id} as site_id,
           t1.key,
           t1.seq as seq,
-          COALESCE(t2.col_version, 1) as cl
+          {cl} as cl,
+          {tbl_idx} as tbl_idx,
+          t1.site_id as site_ord
       FROM \"{table_name_ident}__crsql_clock\" AS t1
-      JOIN \"{table_name_ident}__crsql_pks\" AS pk_tbl ON t1.key = pk_tbl.__crsql_key
-      LEFT JOIN crsql_site_id AS site_tbl ON t1.site_id = site_tbl.ordinal
-      LEFT JOIN \"{table_name_ident}__crsql_clock\" AS t2 ON
-      t1.key = t2.key AND t2.col_name = '{sentinel}'",
+      JOIN \"{table_name_ident}__crsql_pks\" AS pk_tbl ON t1.key = pk_tbl.__crsql_key{site_join}{cl_join}{pk_where}",
         table_name_val = crate::util::escape_ident_as_value(&table_info.tbl_name),
-        pk_list = pk_list,
+        pks = pks,
         table_name_ident = crate::util::escape_ident(&table_info.tbl_name),
-        sentinel = crate::c::INSERT_SENTINEL
+        cl = cl,
+        cl_join = cl_join,
+        pk_where = pk_where,
+        tbl_idx = tbl_idx,
+        site_id = if join_site_ids {
+            "site_tbl.site_id"
+        } else {
+            "NULL"
+        },
+        site_join = if join_site_ids {
+            "\n      LEFT JOIN crsql_site_id AS site_tbl ON t1.site_id = site_tbl.ordinal"
+        } else {
+            ""
+        },
     ))
 }
 
+/**
+ * `table_infos` pairs each table with its position in `crsql_ExtData.tableInfos`.
+ * That position is returned as `tbl_idx` so the cursor can find the table info for a
+ * row without a name lookup.
+ *
+ * Site ids are returned as `site_ord` ordinals which the cursor resolves through the
+ * connection's `SiteIdDict`. `site_id` itself is only joined in when `idx_str` filters
+ * or orders by it in a way that can't be expressed on the ordinal.
+ *
+ * `pk_filters` are the pk predicates of `idx_str`, see `pk_range`.
+ */
 pub fn changes_union_query(
-    table_infos: &Vec<TableInfo>,
+    table_infos: &[(usize, &TableInfo)],
     idx_str: &str,
+    join_site_ids: bool,
+    pk_filters: &[PkFilter],
 ) -> Result<String, ResultCode> {
     let mut sub_queries = vec![];
 
-    for table_info in table_infos {
-        let query_part = crsql_changes_query_for_table(&table_info)?;
+    for (tbl_idx, table_info) in table_infos {
+        let query_part =
+            crsql_changes_query_for_table(*tbl_idx, table_info, join_site_ids, pk_filters)?;
         sub_queries.push(query_part);
     }
 
     // Manually null-terminate the string so we don't have to copy it to create a CString.
     // We can just extract the raw bytes of the Rust string.
     return Ok(format!(
-      "SELECT tbl, pks, cid, col_vrsn, db_vrsn, site_id, key, seq, cl FROM ({unions}) {idx_str}\0",
+      "SELECT tbl, pks, cid, col_vrsn, db_vrsn, site_id, key, seq, cl, tbl_idx, site_ord FROM ({unions}) {idx_str}\0",
       unions = sub_queries.join(" UNION ALL "),
       idx_str = idx_str,
     ));
 }
+
+/**
+ * Streams changes out of one statement per clock table in `(db_version, seq)` order.
+ *
+ * Each statement is itself ordered by `db_vrsn, seq` (served by the
+ * db_version index) so we only need to hold the current row of
+ * each statement in a min-heap to merge them. This avoids SQLite materializing
+ * and sorting the entire union before returning the first row.
+ *
+ * A single statement, such as a union query with a caller provided ordering,
+ * is simply streamed through.
+ *
+ * The statements are checked out of the connection's `ChangesStmtCache` and
+ * must be handed back with `release`.
+ */
+pub struct ClockMerge {
+    stmts: Vec<(ChangesStmtKey, ManagedStmt)>,
+    generation: u64,
+    heap: BinaryHeap<Reverse<(i64, i64, usize)>>,
+    current: Option<usize>,
+    max_bytes: Option<i64>,
+    bytes: i64,
+    partition: Option<(i64, i64)>,
+    db_version: Option<i64>,
+    row: RowBuffer,
+}
+
+impl ClockMerge {
+    pub fn new(
+        stmts: Vec<(ChangesStmtKey, ManagedStmt)>,
+        generation: u64,
+    ) -> Result<ClockMerge, ResultCode> {
+        let mut ret = ClockMerge {
+            heap: BinaryHeap::with_capacity(stmts.len()),
+            stmts,
+            generation,
+            current: None,
+            max_bytes: None,
+            bytes: 0,
+            partition: None,
+            db_version: None,
+            row: RowBuffer {
+                stmt: None,
+                row: None,
+                cols: vec![],
+                used: vec![],
+                predicted: BTreeMap::new(),
+            },
+        };
+        for i in 0..ret.stmts.len() {
+            ret.advance(i)?;
+        }
+        Ok(ret)
+    }
+
+    fn advance(&mut self, i: usize) -> Result<(), ResultCode> {
+        let stmt = self.stmts[i].1.stmt;
+        if stmt.step()? == ResultCode::ROW {
+            self.heap.push(Reverse((
+                stmt.column_int64(ClockUnionColumn::DbVrsn as i32),
+                stmt.column_int64(ClockUnionColumn::Seq as i32),
+                i,
+            )));
+        }
+        Ok(())
+    }
+
+    /**
+     * Moves to the next change in `(db_version, seq)` order and returns the
+     * statement that is positioned on it. `None` once all statements are exhausted.
+     */
+    pub fn next(&mut self) -> Result<Option<*mut sqlite::stmt>, ResultCode> {
+        if let Some(i) = self.current.take() {
+            self.advance(i)?;
+        }
+        match self.heap.pop() {
+            Some(Reverse((_, _, i))) => {
+                self.current = Some(i);
+                Ok(Some(self.stmts[i].1.stmt))
+            }
+            None => Ok(None),
+        }
+    }
+
+    /**
+     * Ends the stream at the first `db_version` boundary where the changes streamed
+     * so far plus the next one would exceed `max_bytes`. Changes of one db_version
+     * are never split and the first db_version is streamed whole however large.
+     */
+    pub fn set_byte_budget(&mut self, max_bytes: i64) {
+        self.max_bytes = Some(max_bytes);
+    }
+
+    pub fn byte_budget(&self) -> Option<i64> {
+        self.max_bytes
+    }
+
+    /**
+     * Records the `part_count` and `part_id` the statements were limited to so the
+     * hidden columns can return them.
+     */
+    pub fn set_partition(&mut self, count: i64, id: i64) {
+        self.partition = Some((count, id));
+    }
+
+    pub fn partition(&self) -> Option<(i64, i64)> {
+        self.partition
+    }
+
+    /**
+     * Charges the change at `db_version`, of `bytes` bytes, against the byte budget.
+     * Returns false if the stream should end before that change instead.
+     */
+    pub fn charge(&mut self, db_version: i64, bytes: i64) -> bool {
+        if let Some(max_bytes) = self.max_bytes {
+            if self.db_version.map_or(false, |v| v != db_version)
+                && self.bytes.saturating_add(bytes) > max_bytes
+            {
+                return false;
+            }
+        }
+        self.bytes = self.bytes.saturating_add(bytes);
+        self.db_version = Some(db_version);
+        true
+    }
+
+    /**
+     * Looks up the value of column `col`, a position in `non_pks`, of the row with
+     * the packed primary key `pks` that the current change is to. Returns the statement
+     * holding the value and the index of the value in its result, or `None` if the
+     * row no longer exists.
+     *
+     * The statement stays valid until the next lookup or `release`.
+     */
+    pub fn row_value(
+        &mut self,
+        db: *mut sqlite::sqlite3,
+        cache: &mut ChangesStmtCache,
+        tbl_idx: usize,
+        tbl_info: &TableInfo,
+        rowid: i64,
+        pks: &[u8],
+        col: usize,
+    ) -> Result<Option<(*mut sqlite::stmt, i32)>, ResultCode> {
+        self.row.value(
+            db,
+            cache,
+            self.generation,
+            tbl_idx,
+            tbl_info,
+            rowid,
+            pks,
+            col,
+        )
+    }
+
+    /**
+     * Resets the statements and returns them to the cache for the next query.
+     */
+    pub fn release(self, cache: &mut ChangesStmtCache) -> Result<ResultCode, ResultCode> {
+        let mut ret = Ok(ResultCode::OK);
+        let row_stmt = self.row.stmt;
+        for (key, stmt) in self.stmts.into_iter().chain(row_stmt) {
+            if let Err(rc) = cache.put(self.generation, key, stmt) {
+                ret = Err(rc);
+            }
+        }
+        ret
+    }
+}
+
+/**
+ * Buffers the base table row the current run of changes is to, so consecutive
+ * changes to the same row are served from one lookup.
+ *
+ * Only the columns the run needs are selected, so a change to a small column does
+ * not read the row's large values as well. Which columns a run needs is not known
+ * until it has been read. The buffer selects the columns the last run on the same
+ * table needed plus the current change's column. If a later change in the run needs
+ * another column, the row is selected again with that column added.
+ */
+struct RowBuffer {
+    stmt: Option<(ChangesStmtKey, ManagedStmt)>,
+    // (tbl_idx, changes rowid, found) of the row selected
+    row: Option<(usize, i64, bool)>,
+    // positions in `non_pks` of the columns `stmt` selects
+    cols: Vec<usize>,
+    // columns the current run has asked for
+    used: Vec<usize>,
+    // per table, the columns the last run on it asked for
+    predicted: BTreeMap<usize, Vec<usize>>,
+}
+
+impl RowBuffer {
+    fn value(
+        &mut self,
+        db: *mut sqlite::sqlite3,
+        cache: &mut ChangesStmtCache,
+        generation: u64,
+        tbl_idx: usize,
+        tbl_info: &TableInfo,
+        rowid: i64,
+        pks: &[u8],
+        col: usize,
+    ) -> Result<Option<(*mut sqlite::stmt, i32)>, ResultCode> {
+        match self.row {
+            Some((i, r, found)) if i == tbl_idx && r == rowid => {
+                if !self.used.contains(&col) {
+                    self.used.push(col);
+                }
+                if !found {
+                    return Ok(None);
+                }
+                if let (Some(idx), Some((_, stmt))) =
+                    (self.cols.iter().position(|c| *c == col), &self.stmt)
+                {
+                    return Ok(Some((stmt.stmt, idx as i32)));
+                }
+                self.cols.push(col);
+            }
+            _ => {
+                if let Some((i, _, _)) = self.row.take() {
+                    self.predicted.insert(i, core::mem::take(&mut self.used));
+                }
+                self.cols = match self.predicted.get(&tbl_idx) {
+                    Some(cols) => cols.clone(),
+                    None => vec![],
+                };
+                if !self.cols.contains(&col) {
+                    self.cols.push(col);
+                }
+                self.used.push(col);
+            }
+        }
+        // sorted so that runs needing the same columns share a statement
+        self.cols.sort_unstable();
+
+        let key: ChangesStmtKey = (tbl_info.row_data_query(&self.cols)?, None);
+        let stmt = match self.stmt.take() {
+            Some((k, stmt)) if k == key => {
+                reset_cached_stmt(stmt.stmt)?;
+                stmt
+            }
+            prev => {
+                if let Some((k, stmt)) = prev {
+                    cache.put(generation, k, stmt)?;
+                }
+                match cache.take(&key) {
+                    Some(stmt) => stmt,
+                    None => db.prepare_v3(&key.0, sqlite::PREPARE_PERSISTENT)?,
+                }
+            }
+        };
+        let stmt = &self.stmt.insert((key, stmt)).1;
+        let unpacked_pks = unpack_columns(pks)?;
+        bind_package_to_stmt(stmt.stmt, &unpacked_pks, 0)?;
+        let found = stmt.step()? == ResultCode::ROW;
+        self.row = Some((tbl_idx, rowid, found));
+        if !found {
+            return Ok(None);
+        }
+        let idx = self.cols.iter().position(|c| *c == col);
+        Ok(idx.map(|idx| (stmt.stmt, idx as i32)))
+    }
+}
@@ -13,8 +13,9 @@ use crate::c::{crsql_Changes_vtab, CrsqlChangesColumn};
 use crate::compare_values::crsql_compare_sqlite_values;
 use crate::pack_columns::bind_package_to_stmt;
 use crate::pack_columns::{unpack_columns, ColumnValue};
+use crate::site_id_dict::{get_or_create_site_ordinal, get_site_id};
 use crate::stmt_cache::reset_cached_stmt;
-use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, TableInfo};
+use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, find_table_info_index, TableInfo};
 use crate::util::slab_rowid;
 
 /**
@@ -111,11 +112,18 @@ fn did_cid_win(
 
                 match col_site_id_stmt.step() {
                     Ok(ResultCode::ROW) => {
-                        let local_site_id = col_site_id_stmt.column_blob(0)?;
-                        ret = insert_site_id.cmp(local_site_id) as c_int;
-
-                        // reset the stmt after, we're accessing a slice in-memory
+                        let ordinal = col_site_id_stmt.column_int64(0);
                         reset_cached_stmt(col_site_id_stmt.stmt)?;
+                        if let Some(local_site_id) = get_site_id(db, ext_data, ordinal)? {
+                            ret = insert_site_id.cmp(local_site_id) as c_int;
+                        } else {
+                            let err = CString::new(format!(
+                                "could not find site_id for previous change, cr-sqlite clock table might be corrupt for tbl {}",
+                                insert_tbl
+                            ))?;
+                            unsafe { *errmsg = err.into_raw() };
+                            return Err(ResultCode::ERROR);
+                        }
                     }
                     Ok(ResultCode::DONE) => {
                         reset_cached_stmt(col_site_id_stmt.stmt)?;
@@ -166,45 +174,11 @@ fn set_winner_clock(
     // get the returned ordinal
     // use that in place of insert_site_id in the metadata table(s)
 
-    // on changes read, join to gather the proper site id.
-    let ordinal = unsafe {
-        if insert_site_id.is_empty() {
-            None
-        } else {
-            (*ext_data).pSelectSiteIdOrdinalStmt.bind_blob(
-                1,
-                insert_site_id,
-                sqlite::Destructor::STATIC,
-            )?;
-            let rc = (*ext_data).pSelectSiteIdOrdinalStmt.step()?;
-            if rc == ResultCode::ROW {
-                let ordinal = (*ext_data).pSelectSiteIdOrdinalStmt.column_int64(0);
-                (*ext_data).pSelectSiteIdOrdinalStmt.clear_bindings()?;
-                (*ext_data).pSelectSiteIdOrdinalStmt.reset()?;
-
-                Some(ordinal)
-            } else {
-                (*ext_data).pSelectSiteIdOrdinalStmt.clear_bindings()?;
-                (*ext_data).pSelectSiteIdOrdinalStmt.reset()?;
-                // site id had no ordinal yet.
-                // set one and return the ordinal.
-                (*ext_data).pSetSiteIdOrdinalStmt.bind_blob(
-                    1,
-                    insert_site_id,
-                    sqlite::Destructor::STATIC,
-                )?;
-                let rc = (*ext_data).pSetSiteIdOrdinalStmt.step()?;
-                if rc == ResultCode::DONE {
-                    (*ext_data).pSetSiteIdOrdinalStmt.clear_bindings()?;
-                    (*ext_data).pSetSiteIdOrdinalStmt.reset()?;
-                    return Err(ResultCode::ABORT);
-                }
-                let ordinal = (*ext_data).pSetSiteIdOrdinalStmt.column_int64(0);
-                (*ext_data).pSetSiteIdOrdinalStmt.clear_bindings()?;
-                (*ext_data).pSetSiteIdOrdinalStmt.reset()?;
-                Some(ordinal)
-            }
-        }
+    // on changes read, the cursor maps the ordinal back to the site id.
+    let ordinal = if insert_site_id.is_empty() {
+        None
+    } else {
+        Some(get_or_create_site_ordinal(db, ext_data, insert_site_id)?)
     };
 
     let set_stmt_ref = tbl_info.get_set_winner_clock_stmt(db)?;
@@ -234,6 +208,8 @@ fn set_winner_clock(
         Ok(ResultCode::ROW) => {
             let rowid = set_stmt.column_int64(0);
             reset_cached_stmt(set_stmt.stmt)?;
+            // the clock was written at `crsql_next_db_version(insert_db_vrsn)`
+            tbl_info.advance_max_db_version(unsafe { (*ext_data).pendingDbVersion });
             Ok(rowid)
         }
         _ => {
@@ -288,8 +264,9 @@ fn merge_sentinel_only_insert(
     }
 
     if let Ok(_) = rc {
+        // only column clocks are zeroed, the causal length is moved by the sentinel
         zero_clocks_on_resurrect(db, tbl_info, key, remote_db_vsn)?;
-        return set_winner_clock(
+        let ret = set_winner_clock(
             db,
             ext_data,
             tbl_info,
@@ -299,7 +276,9 @@ fn merge_sentinel_only_insert(
             remote_db_vsn,
             remote_site_id,
             remote_seq,
-        );
+        )?;
+        tbl_info.set_lookaside_cl(db, key)?;
+        return Ok(ret);
     }
 
     Ok(-1)
@@ -371,6 +350,7 @@ unsafe fn merge_delete(
         remote_site_id,
         remote_seq,
     )?;
+    tbl_info.set_lookaside_cl(db, key)?;
 
     // Drop clocks _after_ setting the winner clock so we don't lose track of the max db_version!!
     // This must never come before `set_winner_clock`
@@ -412,11 +392,6 @@ fn get_local_cl(
         reset_cached_stmt(local_cl_stmt.stmt)?;
         return Err(rc);
     }
-    let rc = local_cl_stmt.bind_int64(2, key);
-    if let Err(rc) = rc {
-        reset_cached_stmt(local_cl_stmt.stmt)?;
-        return Err(rc);
-    }
 
     let step_result = local_cl_stmt.step();
     match step_result {
@@ -488,94 +463,317 @@ unsafe fn merge_insert(
     let tbl_infos = mem::ManuallyDrop::new(Box::from_raw(
         (*(*tab).pExtData).tableInfos as *mut Vec<TableInfo>,
     ));
-    // TODO: will this work given `insert_tbl` is null termed?
-    let tbl_info_index = tbl_infos.iter().position(|x| x.tbl_name == insert_tbl);
-
-    if tbl_info_index.is_none() {
-        let err = CString::new(format!(
-            "crsql - could not find the schema information for table {}",
-            insert_tbl
-        ))?;
-        *errmsg = err.into_raw();
-        return Err(ResultCode::ERROR);
-    }
-    // TODO: technically safe since we checked `is_none` but this should be more idiomatic
-    let tbl_info_index = tbl_info_index.unwrap();
-
-    let tbl_info = &tbl_infos[tbl_info_index];
-    let unpacked_pks = unpack_columns(insert_pks.blob())?;
+    let mut row = RowMerge::new(
+        db,
+        (*tab).pExtData,
+        &tbl_infos,
+        insert_tbl,
+        insert_pks.blob(),
+        errmsg,
+    )?;
+    row.merge_change(
+        insert_col,
+        insert_val,
+        insert_col_vrsn,
+        insert_db_vrsn,
+        insert_site_id,
+        insert_cl,
+        insert_seq,
+        rowid,
+        errmsg,
+    )
+}
 
-    // Get or create key as the first thing we do.
-    // We'll need the key for all later operations.
-    let key = tbl_info.get_or_create_key(db, &unpacked_pks)?;
+/**
+ * Merges changes to a single row.
+ *
+ * The row's key is looked up (or created) once and shared by all of its changes
+ * so `crsql_changes_rows` and `crsql_apply_changeset` can apply every column of a
+ * row in one go. So is its causal length, as long as the changes leave it be.
+ */
+pub struct RowMerge<'a> {
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    tbl_info_index: usize,
+    tbl_info: &'a TableInfo,
+    insert_tbl: &'a str,
+    insert_pks: &'a [u8],
+    key: sqlite::int64,
+    unpacked_pks: Option<Vec<ColumnValue>>,
+    // The row's causal length, if no change merged since it was read could have moved it.
+    local_cl: Option<sqlite::int64>,
+}
 
-    let local_cl = get_local_cl(db, &tbl_info, key)?;
+impl<'a> RowMerge<'a> {
+    pub unsafe fn new(
+        db: *mut sqlite3,
+        ext_data: *mut crsql_ExtData,
+        tbl_infos: &'a Vec<TableInfo>,
+        insert_tbl: &'a str,
+        insert_pks: &'a [u8],
+        errmsg: *mut *mut c_char,
+    ) -> Result<RowMerge<'a>, ResultCode> {
+        let tbl_info_index = find_table_info_index(ext_data, tbl_infos, insert_tbl);
+
+        if tbl_info_index.is_none() {
+            let err = CString::new(format!(
+                "crsql - could not find the schema information for table {}",
+                insert_tbl
+            ))?;
+            *errmsg = err.into_raw();
+            return Err(ResultCode::ERROR);
+        }
+        // TODO: technically safe since we checked `is_none` but this should be more idiomatic
+        let tbl_info_index = tbl_info_index.unwrap();
+
+        let tbl_info = &tbl_infos[tbl_info_index];
+
+        // Get or create key as the first thing we do.
+        // We'll need the key for all later operations.
+        // Lookaside tables that store packed pks let us find the key by the incoming
+        // blob so we only unpack it once we know we have to write something.
+        // A miss falls back to the pk columns as the key may predate packing.
+        let packed_key = if tbl_info.has_packed_pks {
+            tbl_info.get_key_via_packed_pks(db, insert_pks)?
+        } else {
+            None
+        };
+        let (key, unpacked_pks) = match packed_key {
+            Some(key) => (key, None),
+            None => {
+                let unpacked_pks = unpack_columns(insert_pks)?;
+                let key = tbl_info.get_or_create_key(db, &unpacked_pks)?;
+                (key, Some(unpacked_pks))
+            }
+        };
 
-    // We can ignore all updates from older causal lengths.
-    // They won't win at anything.
-    if insert_cl < local_cl {
-        return Ok(ResultCode::OK);
+        Ok(RowMerge {
+            db,
+            ext_data,
+            tbl_info_index,
+            tbl_info,
+            insert_tbl,
+            insert_pks,
+            key,
+            unpacked_pks,
+            local_cl: None,
+        })
     }
 
-    let is_delete = insert_cl % 2 == 0;
-    // Resurrect or update to latest cl.
-    // The current node might have missed the delete preceeding this causal length
-    // in out-of-order delivery setups but we still call it a resurrect as special
-    // handling needs to happen in the "alive -> missed_delete -> alive" case.
-    let needs_resurrect = insert_cl > local_cl && insert_cl % 2 == 1;
-    let row_exists_locally = local_cl != 0;
-    let is_sentinel_only = crate::c::INSERT_SENTINEL == insert_col;
-
-    if is_delete {
-        // We got a delete event but we've already processed a delete at that version.
-        // Just bail.
-        if insert_cl == local_cl {
+    /**
+     * Merges the change to column `insert_col` of the row, setting `rowid` to the
+     * crsql_changes rowid of the clock entry written, if any.
+     */
+    pub unsafe fn merge_change(
+        &mut self,
+        insert_col: &str,
+        insert_val: *mut sqlite::value,
+        insert_col_vrsn: sqlite::int64,
+        insert_db_vrsn: sqlite::int64,
+        insert_site_id: &[u8],
+        insert_cl: sqlite::int64,
+        insert_seq: sqlite::int64,
+        rowid: *mut sqlite::int64,
+        errmsg: *mut *mut c_char,
+    ) -> Result<ResultCode, ResultCode> {
+        let db = self.db;
+        let ext_data = self.ext_data;
+        let tbl_info = self.tbl_info;
+        let tbl_info_index = self.tbl_info_index;
+        let key = self.key;
+
+        // The causal length is read again only once an earlier change to the row may
+        // have moved it, i.e. wrote a sentinel or created the row.
+        let local_cl = match self.local_cl.take() {
+            Some(local_cl) => local_cl,
+            None => get_local_cl(db, &tbl_info, key)?,
+        };
+        self.local_cl = Some(local_cl);
+
+        // We can ignore all updates from older causal lengths.
+        // They won't win at anything.
+        if insert_cl < local_cl {
             return Ok(ResultCode::OK);
         }
-        // else, it is a delete and the cl is > than ours. Drop the row.
-        let merge_result = merge_delete(
-            db,
-            (*tab).pExtData,
-            &tbl_info,
-            &unpacked_pks,
-            key,
-            insert_col_vrsn,
-            insert_db_vrsn,
-            insert_site_id,
-            insert_seq,
-        );
-        match merge_result {
-            Err(rc) => {
-                return Err(rc);
+
+        if self.unpacked_pks.is_none() {
+            self.unpacked_pks = Some(unpack_columns(self.insert_pks)?);
+        }
+        let unpacked_pks = self.unpacked_pks.as_ref().ok_or(ResultCode::ERROR)?;
+
+        let is_delete = insert_cl % 2 == 0;
+        // Resurrect or update to latest cl.
+        // The current node might have missed the delete preceeding this causal length
+        // in out-of-order delivery setups but we still call it a resurrect as special
+        // handling needs to happen in the "alive -> missed_delete -> alive" case.
+        let needs_resurrect = insert_cl > local_cl && insert_cl % 2 == 1;
+        let row_exists_locally = local_cl != 0;
+        let is_sentinel_only = crate::c::INSERT_SENTINEL == insert_col;
+
+        if is_delete {
+            // We got a delete event but we've already processed a delete at that version.
+            // Just bail.
+            if insert_cl == local_cl {
+                return Ok(ResultCode::OK);
             }
-            Ok(inner_rowid) => {
-                (*(*tab).pExtData).rowsImpacted += 1;
-                *rowid = slab_rowid(tbl_info_index as i32, inner_rowid);
+            // else, it is a delete and the cl is > than ours. Drop the row.
+            self.local_cl = None;
+            let merge_result = merge_delete(
+                db,
+                ext_data,
+                &tbl_info,
+                unpacked_pks,
+                key,
+                insert_col_vrsn,
+                insert_db_vrsn,
+                insert_site_id,
+                insert_seq,
+            );
+            match merge_result {
+                Err(rc) => {
+                    return Err(rc);
+                }
+                Ok(inner_rowid) => {
+                    (*ext_data).rowsImpacted += 1;
+                    *rowid = slab_rowid(tbl_info_index as i32, inner_rowid);
+                    return Ok(ResultCode::OK);
+                }
+            }
+        }
+
+        /*
+        || crsql_columnExists(
+                // TODO: only safe because we _know_ this is actually a cstr
+                insert_col.as_ptr() as *const c_char,
+                (*tbl_info).nonPks,
+                (*tbl_info).nonPksLen,
+            ) == 0
+         */
+        if is_sentinel_only {
+            // If it is a sentinel but the local_cl already matches, nothing to do
+            // as the local sentinel already has the same data!
+            if insert_cl == local_cl {
                 return Ok(ResultCode::OK);
             }
+            self.local_cl = None;
+            let merge_result = merge_sentinel_only_insert(
+                db,
+                ext_data,
+                &tbl_info,
+                unpacked_pks,
+                key,
+                insert_col_vrsn,
+                insert_db_vrsn,
+                insert_site_id,
+                insert_seq,
+            );
+            match merge_result {
+                Err(rc) => {
+                    return Err(rc);
+                }
+                Ok(inner_rowid) => {
+                    // a success & rowid of -1 means the merge was a no-op
+                    if inner_rowid != -1 {
+                        (*ext_data).rowsImpacted += 1;
+                        *rowid = slab_rowid(tbl_info_index as i32, inner_rowid);
+                        return Ok(ResultCode::OK);
+                    } else {
+                        return Ok(ResultCode::OK);
+                    }
+                }
+            }
         }
-    }
 
-    /*
-    || crsql_columnExists(
-            // TODO: only safe because we _know_ this is actually a cstr
-            insert_col.as_ptr() as *const c_char,
-            (*tbl_info).nonPks,
-            (*tbl_info).nonPksLen,
-        ) == 0
-     */
-    if is_sentinel_only {
-        // If it is a sentinel but the local_cl already matches, nothing to do
-        // as the local sentinel already has the same data!
-        if insert_cl == local_cl {
+        // we got a causal length which would resurrect the row.
+        // In an in-order delivery situation then `sentinel_only` would have already resurrected the row
+        // In out-of-order delivery, we need to resurrect the row as soon as we get a value
+        // which should resurrect the row. I.e., don't wait on the sentinel value to resurrect the row!
+        // If the row does not exist locally and the insert_cl is > 1 then we need to create a sentinel to record the insert cl.
+        // Not doing so will cause us to assume a cl of 1.
+        if needs_resurrect && (row_exists_locally || (!row_exists_locally && insert_cl > 1)) {
+            self.local_cl = None;
+            // this should work -- same as `merge_sentinel_only_insert` except we're not done once we do it
+            // and the version to set to is the cl not col_vrsn of current insert
+            merge_sentinel_only_insert(
+                db,
+                ext_data,
+                &tbl_info,
+                unpacked_pks,
+                key,
+                insert_cl,
+                insert_db_vrsn,
+                insert_site_id,
+                insert_seq,
+            )?;
+            (*ext_data).rowsImpacted += 1;
+        }
+
+        // we can short-circuit via needs_resurrect
+        // given the greater cl automatically means a win.
+        // or if we realize that the row does not exist locally at all.
+        let does_cid_win = needs_resurrect
+            || !row_exists_locally
+            || did_cid_win(
+                db,
+                ext_data,
+                self.insert_tbl,
+                &tbl_info,
+                unpacked_pks,
+                key,
+                insert_val,
+                insert_site_id,
+                insert_col,
+                insert_col_vrsn,
+                errmsg,
+            )?;
+
+        if !does_cid_win {
+            // doesCidWin == 0? compared against our clocks, nothing wins. OK and
+            // Done.
             return Ok(ResultCode::OK);
         }
-        let merge_result = merge_sentinel_only_insert(
+        if !row_exists_locally {
+            self.local_cl = None;
+        }
+
+        // TODO: this is all almost identical between all three merge cases!
+        let merge_stmt_ref = tbl_info.get_merge_insert_stmt(db, insert_col)?;
+        let merge_stmt = merge_stmt_ref.as_ref().ok_or(ResultCode::ERROR)?;
+
+        let bind_result = bind_package_to_stmt(merge_stmt.stmt, unpacked_pks, 0)
+            .and_then(|_| merge_stmt.bind_value(unpacked_pks.len() as i32 + 1, insert_val))
+            .and_then(|_| merge_stmt.bind_value(unpacked_pks.len() as i32 + 2, insert_val));
+        if let Err(rc) = bind_result {
+            reset_cached_stmt(merge_stmt.stmt)?;
+            return Err(rc);
+        }
+
+        let rc = (*ext_data)
+            .pSetSyncBitStmt
+            .step()
+            .and_then(|_| (*ext_data).pSetSyncBitStmt.reset())
+            .and_then(|_| merge_stmt.step());
+
+        reset_cached_stmt(merge_stmt.stmt)?;
+
+        let sync_rc = (*ext_data)
+            .pClearSyncBitStmt
+            .step()
+            .and_then(|_| (*ext_data).pClearSyncBitStmt.reset());
+
+        if let Err(rc) = rc {
+            return Err(rc);
+        }
+        if let Err(sync_rc) = sync_rc {
+            return Err(sync_rc);
+        }
+
+        let merge_result = set_winner_clock(
             db,
-            (*tab).pExtData,
+            ext_data,
             &tbl_info,
-            &unpacked_pks,
             key,
+            insert_col,
             insert_col_vrsn,
             insert_db_vrsn,
             insert_site_id,
@@ -586,117 +784,14 @@ unsafe fn merge_insert(
                 return Err(rc);
             }
             Ok(inner_rowid) => {
-                // a success & rowid of -1 means the merge was a no-op
-                if inner_rowid != -1 {
-                    (*(*tab).pExtData).rowsImpacted += 1;
-                    *rowid = slab_rowid(tbl_info_index as i32, inner_rowid);
-                    return Ok(ResultCode::OK);
-                } else {
-                    return Ok(ResultCode::OK);
+                if !row_exists_locally {
+                    // the first clock entry of the row
+                    tbl_info.set_lookaside_cl(db, key)?;
                 }
+                (*ext_data).rowsImpacted += 1;
+                *rowid = slab_rowid(tbl_info_index as i32, inner_rowid);
+                return Ok(ResultCode::OK);
             }
         }
     }
-
-    // we got a causal length which would resurrect the row.
-    // In an in-order delivery situation then `sentinel_only` would have already resurrected the row
-    // In out-of-order delivery, we need to resurrect the row as soon as we get a value
-    // which should resurrect the row. I.e., don't wait on the sentinel value to resurrect the row!
-    // If the row does not exist locally and the insert_cl is > 1 then we need to create a sentinel to record the insert cl.
-    // Not doing so will cause us to assume a cl of 1.
-    if needs_resurrect && (row_exists_locally || (!row_exists_locally && insert_cl > 1)) {
-        // this should work -- same as `merge_sentinel_only_insert` except we're not done once we do it
-        // and the version to set to is the cl not col_vrsn of current insert
-        merge_sentinel_only_insert(
-            db,
-            (*tab).pExtData,
-            &tbl_info,
-            &unpacked_pks,
-            key,
-            insert_cl,
-            insert_db_vrsn,
-            insert_site_id,
-            insert_seq,
-        )?;
-        (*(*tab).pExtData).rowsImpacted += 1;
-    }
-
-    // we can short-circuit via needs_resurrect
-    // given the greater cl automatically means a win.
-    // or if we realize that the row does not exist locally at all.
-    let does_cid_win = needs_resurrect
-        || !row_exists_locally
-        || did_cid_win(
-            db,
-            (*tab).pExtData,
-            insert_tbl,
-            &tbl_info,
-            &unpacked_pks,
-            key,
-            insert_val,
-            insert_site_id,
-            insert_col,
-            insert_col_vrsn,
-            errmsg,
-        )?;
-
-    if !does_cid_win {
-        // doesCidWin == 0? compared against our clocks, nothing wins. OK and
-        // Done.
-        return Ok(ResultCode::OK);
-    }
-
-    // TODO: this is all almost identical between all three merge cases!
-    let merge_stmt_ref = tbl_info.get_merge_insert_stmt(db, insert_col)?;
-    let merge_stmt = merge_stmt_ref.as_ref().ok_or(ResultCode::ERROR)?;
-
-    let bind_result = bind_package_to_stmt(merge_stmt.stmt, &unpacked_pks, 0)
-        .and_then(|_| merge_stmt.bind_value(unpacked_pks.len() as i32 + 1, insert_val))
-        .and_then(|_| merge_stmt.bind_value(unpacked_pks.len() as i32 + 2, insert_val));
-    if let Err(rc) = bind_result {
-        reset_cached_stmt(merge_stmt.stmt)?;
-        return Err(rc);
-    }
-
-    let rc = (*(*tab).pExtData)
-        .pSetSyncBitStmt
-        .step()
-        .and_then(|_| (*(*tab).pExtData).pSetSyncBitStmt.reset())
-        .and_then(|_| merge_stmt.step());
-
-    reset_cached_stmt(merge_stmt.stmt)?;
-
-    let sync_rc = (*(*tab).pExtData)
-        .pClearSyncBitStmt
-        .step()
-        .and_then(|_| (*(*tab).pExtData).pClearSyncBitStmt.reset());
-
-    if let Err(rc) = rc {
-        return Err(rc);
-    }
-    if let Err(sync_rc) = sync_rc {
-        return Err(sync_rc);
-    }
-
-    let merge_result = set_winner_clock(
-        db,
-        (*tab).pExtData,
-        &tbl_info,
-        key,
-        insert_col,
-        insert_col_vrsn,
-        insert_db_vrsn,
-        insert_site_id,
-        insert_seq,
-    );
-    match merge_result {
-        Err(rc) => {
-            return Err(rc);
-        }
-        Ok(inner_rowid) => {
-            (*(*tab).pExtData).rowsImpacted += 1;
-            *rowid = slab_rowid(tbl_info_index as i32, inner_rowid);
-            return Ok(ResultCode::OK);
-        }
-    }
 }
@@ -0,0 +1,1421 @@
+extern crate alloc;
+
+use alloc::boxed::Box;
+use alloc::collections::BTreeMap;
+use alloc::ffi::CString;
+use alloc::format;
+use alloc::string::String;
+use alloc::vec;
+use alloc::vec::Vec;
+use core::ffi::{c_char, c_int};
+use core::mem::ManuallyDrop;
+use core::ptr::null_mut;
+
+use bytes::BufMut;
+use num_traits::FromPrimitive;
+use sqlite::{ColumnType, Connection, Context, ManagedStmt, ResultCode, Stmt, Value};
+use sqlite_nostd as sqlite;
+
+use crate::c::{crsql_ExtData, ClockUnionColumn};
+use crate::changes_vtab_read::{changes_union_query, ClockMerge};
+use crate::changes_vtab_write::RowMerge;
+use crate::lz::{self, BlockCompressor};
+use crate::pack_columns::{
+    bind_column_ref, bind_package_to_stmt, pack_column, unpack_column, unpack_columns, ColumnRef,
+};
+use crate::site_id_dict::{get_site_id, get_site_ordinal, site_id_dict};
+use crate::stmt_cache::{changes_stmt_cache, reset_cached_stmt, ChangesStmtKey};
+use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, find_table_info_index, TableInfo};
+
+/**
+ * A changeset is a run of changes, as `crsql_changes` would return them, in one
+ * self-describing blob:
+ *
+ * [magic:"CRCS", version:u8, codec:u8, ...records]
+ *
+ * Each record starts with a tag byte. Table names, column names and site ids are
+ * sent once, in a record that appends them to their dictionary, and changes refer
+ * to them by their position in it:
+ *
+ * TAG_TABLE, TAG_COLUMN, TAG_SITE: [len:varint, ...bytes]
+ * TAG_RESET: empties the dictionaries and forgets the previous change
+ * TAG_CHANGE | same flags: [
+ *   tbl:varint, pk_len:varint, ...pk  (unless SAME_ROW)
+ *   cid:varint,
+ *   col_version:zigzag,
+ *   db_version:zigzag delta to the previous change's  (unless SAME_DB_VERSION)
+ *   seq:zigzag, a delta to the previous change's if SAME_DB_VERSION,
+ *   site:varint  (unless SAME_SITE)
+ *   cl:zigzag  (unless SAME_CL)
+ *   val  (one column as `pack_columns` packs it)
+ * ]
+ *
+ * Varints are LEB128 and signed values are zigzag encoded first. The pk is in the
+ * `pack_columns` encoding, as `crsql_changes` returns it.
+ *
+ * With CODEC_LZ the records are cut into chunks, see `ChangesetEncoder`, and each
+ * chunk is compressed on its own:
+ *
+ * [magic:"CRCS", version:u8, codec:u8, ...[raw_len:varint, len_and_kind:varint, ...bytes]]
+ *
+ * `len_and_kind` is the number of bytes shifted left by one. Its low bit is set if
+ * they are an `lz` block and clear if the chunk did not compress and is stored as is.
+ */
+pub const CHANGESET_MAGIC: &[u8; 4] = b"CRCS";
+pub const CHANGESET_VERSION: u8 = 1;
+pub const CODEC_NONE: u8 = 0;
+pub const CODEC_LZ: u8 = 1;
+
+// Chunks are cut at the first change that takes them past this many bytes.
+const CHUNK_BYTES: usize = 64 * 1024;
+// The most changes decoded and merged at once when applying a changeset.
+const MERGE_BATCH: usize = 64 * 1024;
+
+pub const TAG_TABLE: u8 = 1;
+pub const TAG_COLUMN: u8 = 2;
+pub const TAG_SITE: u8 = 3;
+pub const TAG_RESET: u8 = 4;
+pub const TAG_CHANGE: u8 = 0x10;
+
+pub const SAME_ROW: u8 = 1;
+pub const SAME_DB_VERSION: u8 = 2;
+pub const SAME_SITE: u8 = 4;
+pub const SAME_CL: u8 = 8;
+
+pub fn changeset_header(codec: u8) -> [u8; 6] {
+    let m = CHANGESET_MAGIC;
+    [m[0], m[1], m[2], m[3], CHANGESET_VERSION, codec]
+}
+
+pub fn put_varint(buf: &mut Vec<u8>, mut v: u64) {
+    while v >= 0x80 {
+        buf.put_u8((v as u8) | 0x80);
+        v >>= 7;
+    }
+    buf.put_u8(v as u8);
+}
+
+pub fn put_zigzag(buf: &mut Vec<u8>, v: i64) {
+    put_varint(buf, ((v << 1) ^ (v >> 63)) as u64);
+}
+
+/**
+ * Reads a varint off the front of `buf`. None if `buf` ends within it or it does
+ * not fit in 64 bits.
+ */
+pub fn get_varint(buf: &mut &[u8]) -> Option<u64> {
+    let mut ret = 0u64;
+    let mut shift = 0;
+    loop {
+        let (&byte, rest) = buf.split_first()?;
+        *buf = rest;
+        if shift == 63 && byte > 1 {
+            return None;
+        }
+        ret |= ((byte & 0x7f) as u64) << shift;
+        if byte & 0x80 == 0 {
+            return Some(ret);
+        }
+        shift += 7;
+    }
+}
+
+pub fn get_zigzag(buf: &mut &[u8]) -> Option<i64> {
+    let v = get_varint(buf)?;
+    Some((v >> 1) as i64 ^ -((v & 1) as i64))
+}
+
+/**
+ * Encodes changes into changeset records.
+ *
+ * Records are buffered until `take_chunk`. The records of a chunk only refer to
+ * dictionary entries and the previous change of the same chunk so chunks can be
+ * written out, or compressed, one at a time. Chunks after the first start with
+ * TAG_RESET so their concatenation is a valid run of records.
+ */
+pub struct ChangesetEncoder {
+    buf: Vec<u8>,
+    tables: BTreeMap<String, u64>,
+    columns: BTreeMap<String, u64>,
+    sites: BTreeMap<Vec<u8>, u64>,
+    chunks: u64,
+    has_prev: bool,
+    prev_tbl: u64,
+    prev_pk: Vec<u8>,
+    prev_db_version: i64,
+    prev_seq: i64,
+    prev_site: u64,
+    prev_cl: i64,
+}
+
+impl ChangesetEncoder {
+    pub fn new() -> ChangesetEncoder {
+        ChangesetEncoder {
+            buf: vec![],
+            tables: BTreeMap::new(),
+            columns: BTreeMap::new(),
+            sites: BTreeMap::new(),
+            chunks: 0,
+            has_prev: false,
+            prev_tbl: 0,
+            prev_pk: vec![],
+            prev_db_version: 0,
+            prev_seq: 0,
+            prev_site: 0,
+            prev_cl: 0,
+        }
+    }
+
+    /**
+     * The number of bytes buffered since the last `take_chunk`.
+     */
+    pub fn len(&self) -> usize {
+        self.buf.len()
+    }
+
+    pub fn take_chunk(&mut self) -> Vec<u8> {
+        if !self.buf.is_empty() {
+            self.chunks += 1;
+        }
+        self.tables.clear();
+        self.columns.clear();
+        self.sites.clear();
+        self.has_prev = false;
+        self.prev_db_version = 0;
+        core::mem::take(&mut self.buf)
+    }
+
+    fn define(buf: &mut Vec<u8>, tag: u8, entry: &[u8]) {
+        buf.put_u8(tag);
+        put_varint(buf, entry.len() as u64);
+        buf.put_slice(entry);
+    }
+
+    /**
+     * Appends a change. `val` is None for the NULL value of sentinel changes.
+     */
+    pub fn push(
+        &mut self,
+        tbl: &str,
+        pk: &[u8],
+        cid: &str,
+        val: Option<*mut sqlite::value>,
+        col_version: i64,
+        db_version: i64,
+        site_id: &[u8],
+        cl: i64,
+        seq: i64,
+    ) {
+        if self.buf.is_empty() && self.chunks > 0 {
+            self.buf.put_u8(TAG_RESET);
+        }
+        let tbl_idx = match self.tables.get(tbl) {
+            Some(i) => *i,
+            None => {
+                let i = self.tables.len() as u64;
+                Self::define(&mut self.buf, TAG_TABLE, tbl.as_bytes());
+                self.tables.insert(String::from(tbl), i);
+                i
+            }
+        };
+        let cid_idx = match self.columns.get(cid) {
+            Some(i) => *i,
+            None => {
+                let i = self.columns.len() as u64;
+                Self::define(&mut self.buf, TAG_COLUMN, cid.as_bytes());
+                self.columns.insert(String::from(cid), i);
+                i
+            }
+        };
+        let site_idx = match self.sites.get(site_id) {
+            Some(i) => *i,
+            None => {
+                let i = self.sites.len() as u64;
+                Self::define(&mut self.buf, TAG_SITE, site_id);
+                self.sites.insert(site_id.to_vec(), i);
+                i
+            }
+        };
+
+        let mut flags = 0;
+        if self.has_prev {
+            if self.prev_tbl == tbl_idx && self.prev_pk == pk {
+                flags |= SAME_ROW;
+            }
+            if self.prev_db_version == db_version {
+                flags |= SAME_DB_VERSION;
+            }
+            if self.prev_site == site_idx {
+                flags |= SAME_SITE;
+            }
+            if self.prev_cl == cl {
+                flags |= SAME_CL;
+            }
+        }
+
+        self.buf.put_u8(TAG_CHANGE | flags);
+        if flags & SAME_ROW == 0 {
+            put_varint(&mut self.buf, tbl_idx);
+            put_varint(&mut self.buf, pk.len() as u64);
+            self.buf.put_slice(pk);
+            self.prev_tbl = tbl_idx;
+            self.prev_pk.clear();
+            self.prev_pk.extend_from_slice(pk);
+        }
+        put_varint(&mut self.buf, cid_idx);
+        put_zigzag(&mut self.buf, col_version);
+        if flags & SAME_DB_VERSION == 0 {
+            put_zigzag(&mut self.buf, db_version.wrapping_sub(self.prev_db_version));
+            put_zigzag(&mut self.buf, seq);
+        } else {
+            put_zigzag(&mut self.buf, seq.wrapping_sub(self.prev_seq));
+        }
+        if flags & SAME_SITE == 0 {
+            put_varint(&mut self.buf, site_idx);
+        }
+        if flags & SAME_CL == 0 {
+            put_zigzag(&mut self.buf, cl);
+        }
+        match val {
+            Some(val) => pack_column(&mut self.buf, val),
+            None => self.buf.put_u8(ColumnType::Null as u8),
+        }
+
+        self.has_prev = true;
+        self.prev_db_version = db_version;
+        self.prev_seq = seq;
+        self.prev_site = site_idx;
+        self.prev_cl = cl;
+    }
+}
+
+/**
+ * Writes a changeset to `sink`, header first and then a chunk at a time, so the
+ * changeset is never held in memory as a whole unless the sink does so.
+ */
+pub struct ChangesetWriter<'a> {
+    encoder: ChangesetEncoder,
+    compressor: Option<BlockCompressor>,
+    frame: Vec<u8>,
+    sink: &'a mut dyn FnMut(&[u8]) -> Result<ResultCode, ResultCode>,
+}
+
+impl<'a> ChangesetWriter<'a> {
+    pub fn new(
+        codec: u8,
+        sink: &'a mut dyn FnMut(&[u8]) -> Result<ResultCode, ResultCode>,
+    ) -> Result<ChangesetWriter<'a>, ResultCode> {
+        let compressor = match codec {
+            CODEC_NONE => None,
+            CODEC_LZ => Some(BlockCompressor::new()),
+            _ => return Err(ResultCode::MISUSE),
+        };
+        sink(&changeset_header(codec))?;
+        Ok(ChangesetWriter {
+            encoder: ChangesetEncoder::new(),
+            compressor,
+            frame: vec![],
+            sink,
+        })
+    }
+
+    /**
+     * Appends a change as `ChangesetEncoder::push` does and hands the chunk to the
+     * sink once it is full.
+     */
+    pub fn push(
+        &mut self,
+        tbl: &str,
+        pk: &[u8],
+        cid: &str,
+        val: Option<*mut sqlite::value>,
+        col_version: i64,
+        db_version: i64,
+        site_id: &[u8],
+        cl: i64,
+        seq: i64,
+    ) -> Result<ResultCode, ResultCode> {
+        self.encoder
+            .push(tbl, pk, cid, val, col_version, db_version, site_id, cl, seq);
+        if self.encoder.len() >= CHUNK_BYTES {
+            return self.flush();
+        }
+        Ok(ResultCode::OK)
+    }
+
+    fn flush(&mut self) -> Result<ResultCode, ResultCode> {
+        let chunk = self.encoder.take_chunk();
+        if chunk.is_empty() {
+            return Ok(ResultCode::OK);
+        }
+        let compressor = match &mut self.compressor {
+            Some(compressor) => compressor,
+            None => return (self.sink)(&chunk),
+        };
+        let mut block = vec![];
+        compressor.compress(&chunk, &mut block);
+        self.frame.clear();
+        put_varint(&mut self.frame, chunk.len() as u64);
+        if block.len() < chunk.len() {
+            put_varint(&mut self.frame, (block.len() as u64) << 1 | 1);
+            self.frame.extend_from_slice(&block);
+        } else {
+            put_varint(&mut self.frame, (chunk.len() as u64) << 1);
+            self.frame.extend_from_slice(&chunk);
+        }
+        (self.sink)(&self.frame)
+    }
+
+    /**
+     * Hands the last chunk to the sink.
+     */
+    pub fn finish(mut self) -> Result<ResultCode, ResultCode> {
+        self.flush()
+    }
+}
+
+/**
+ * Reads the chunks of records out of the body of a changeset, decompressing them
+ * as needed. The body of a CODEC_NONE changeset is a single chunk.
+ */
+pub struct ChunkReader<'a> {
+    codec: u8,
+    body: &'a [u8],
+    buf: Vec<u8>,
+}
+
+impl<'a> ChunkReader<'a> {
+    pub fn new(codec: u8, body: &'a [u8]) -> ChunkReader<'a> {
+        ChunkReader {
+            codec,
+            body,
+            buf: vec![],
+        }
+    }
+
+    /**
+     * The next chunk or None once the body is read. Errors with FORMAT if the body
+     * is malformed or of an unknown codec.
+     */
+    pub fn next(&mut self) -> Result<Option<&[u8]>, ResultCode> {
+        if self.body.is_empty() {
+            return Ok(None);
+        }
+        match self.codec {
+            CODEC_NONE => Ok(Some(core::mem::take(&mut self.body))),
+            CODEC_LZ => {
+                let raw_len = get_varint(&mut self.body).ok_or(ResultCode::FORMAT)? as usize;
+                let len_and_kind = get_varint(&mut self.body).ok_or(ResultCode::FORMAT)?;
+                let len = (len_and_kind >> 1) as usize;
+                if self.body.len() < len {
+                    return Err(ResultCode::FORMAT);
+                }
+                let (bytes, rest) = self.body.split_at(len);
+                self.body = rest;
+                if len_and_kind & 1 == 0 {
+                    if len != raw_len {
+                        return Err(ResultCode::FORMAT);
+                    }
+                    return Ok(Some(bytes));
+                }
+                self.buf.clear();
+                lz::decompress(bytes, raw_len, &mut self.buf)?;
+                Ok(Some(&self.buf))
+            }
+            _ => Err(ResultCode::FORMAT),
+        }
+    }
+}
+
+/**
+ * Splits a changeset into its codec and body.
+ */
+pub fn parse_changeset_header(changeset: &[u8]) -> Result<(u8, &[u8]), ResultCode> {
+    if changeset.len() < 6
+        || &changeset[..4] != CHANGESET_MAGIC
+        || changeset[4] != CHANGESET_VERSION
+    {
+        return Err(ResultCode::FORMAT);
+    }
+    Ok((changeset[5], &changeset[6..]))
+}
+
+/**
+ * A change read out of a changeset. Everything but the numbers points into it.
+ */
+pub struct DecodedChange<'a> {
+    pub tbl: &'a str,
+    pub pk: &'a [u8],
+    pub cid: &'a str,
+    pub val: ColumnRef<'a>,
+    pub col_version: i64,
+    pub db_version: i64,
+    pub site_id: &'a [u8],
+    pub cl: i64,
+    pub seq: i64,
+}
+
+/**
+ * Decodes changeset records, as `ChangesetEncoder` writes them, one change at a time.
+ */
+pub struct ChangesetDecoder<'a> {
+    buf: &'a [u8],
+    tables: Vec<&'a str>,
+    columns: Vec<&'a str>,
+    sites: Vec<&'a [u8]>,
+    has_prev: bool,
+    tbl: &'a str,
+    pk: &'a [u8],
+    db_version: i64,
+    seq: i64,
+    site_id: &'a [u8],
+    cl: i64,
+}
+
+impl<'a> ChangesetDecoder<'a> {
+    pub fn new(records: &'a [u8]) -> ChangesetDecoder<'a> {
+        ChangesetDecoder {
+            buf: records,
+            tables: vec![],
+            columns: vec![],
+            sites: vec![],
+            has_prev: false,
+            tbl: "",
+            pk: &[],
+            db_version: 0,
+            seq: 0,
+            site_id: &[],
+            cl: 0,
+        }
+    }
+
+    fn bytes(&mut self) -> Result<&'a [u8], ResultCode> {
+        let len = get_varint(&mut self.buf).ok_or(ResultCode::FORMAT)? as usize;
+        if self.buf.len() < len {
+            return Err(ResultCode::FORMAT);
+        }
+        let (bytes, rest) = self.buf.split_at(len);
+        self.buf = rest;
+        Ok(bytes)
+    }
+
+    fn str(&mut self) -> Result<&'a str, ResultCode> {
+        core::str::from_utf8(self.bytes()?).or(Err(ResultCode::FORMAT))
+    }
+
+    fn index<T: Copy>(buf: &mut &'a [u8], dict: &[T]) -> Result<T, ResultCode> {
+        let i = get_varint(buf).ok_or(ResultCode::FORMAT)? as usize;
+        dict.get(i).copied().ok_or(ResultCode::FORMAT)
+    }
+
+    /**
+     * The next change or None at the end of the records. Errors with FORMAT on
+     * anything malformed.
+     */
+    pub fn next(&mut self) -> Result<Option<DecodedChange<'a>>, ResultCode> {
+        loop {
+            let (&tag, rest) = match self.buf.split_first() {
+                Some(split) => split,
+                None => return Ok(None),
+            };
+            self.buf = rest;
+            match tag {
+                TAG_TABLE => {
+                    let tbl = self.str()?;
+                    self.tables.push(tbl);
+                }
+                TAG_COLUMN => {
+                    let cid = self.str()?;
+                    self.columns.push(cid);
+                }
+                TAG_SITE => {
+                    let site_id = self.bytes()?;
+                    self.sites.push(site_id);
+                }
+                TAG_RESET => {
+                    self.tables.clear();
+                    self.columns.clear();
+                    self.sites.clear();
+                    self.has_prev = false;
+                    self.db_version = 0;
+                }
+                _ if tag & 0xf0 == TAG_CHANGE => return self.change(tag & 0x0f).map(Some),
+                _ => return Err(ResultCode::FORMAT),
+            }
+        }
+    }
+
+    fn change(&mut self, flags: u8) -> Result<DecodedChange<'a>, ResultCode> {
+        if flags != 0 && !self.has_prev {
+            return Err(ResultCode::FORMAT);
+        }
+        if flags & SAME_ROW == 0 {
+            self.tbl = Self::index(&mut self.buf, &self.tables)?;
+            self.pk = self.bytes()?;
+        }
+        let cid = Self::index(&mut self.buf, &self.columns)?;
+        let col_version = get_zigzag(&mut self.buf).ok_or(ResultCode::FORMAT)?;
+        if flags & SAME_DB_VERSION == 0 {
+            let delta = get_zigzag(&mut self.buf).ok_or(ResultCode::FORMAT)?;
+            self.db_version = self.db_version.wrapping_add(delta);
+            self.seq = get_zigzag(&mut self.buf).ok_or(ResultCode::FORMAT)?;
+        } else {
+            let delta = get_zigzag(&mut self.buf).ok_or(ResultCode::FORMAT)?;
+            self.seq = self.seq.wrapping_add(delta);
+        }
+        if flags & SAME_SITE == 0 {
+            self.site_id = Self::index(&mut self.buf, &self.sites)?;
+        }
+        if flags & SAME_CL == 0 {
+            self.cl = get_zigzag(&mut self.buf).ok_or(ResultCode::FORMAT)?;
+        }
+        let val = unpack_column(&mut self.buf).or(Err(ResultCode::FORMAT))?;
+        self.has_prev = true;
+        Ok(DecodedChange {
+            tbl: self.tbl,
+            pk: self.pk,
+            cid,
+            val,
+            col_version,
+            db_version: self.db_version,
+            site_id: self.site_id,
+            cl: self.cl,
+            seq: self.seq,
+        })
+    }
+}
+
+// Per clock table, changes after `?1` not written by the site of ordinal `?2`.
+const CHANGESET_IDX_STR: &str =
+    " WHERE db_vrsn > ?1 AND site_ord IS NOT ?2 ORDER BY db_vrsn, seq ASC";
+
+/**
+ * Looks up the values of changed columns. Consecutive changes to the same row are
+ * served from one lookup. Statements are checked out of the `ChangesStmtCache` so
+ * they are never shared with a `crsql_changes` cursor that may be open.
+ */
+struct RowValues {
+    stmts: BTreeMap<usize, (ChangesStmtKey, ManagedStmt)>,
+    // (tbl_idx, key, found) of the row last looked up
+    current: Option<(usize, i64, bool)>,
+}
+
+impl RowValues {
+    fn value(
+        &mut self,
+        db: *mut sqlite::sqlite3,
+        ext_data: *mut crsql_ExtData,
+        tbl_idx: usize,
+        tbl_info: &TableInfo,
+        key: i64,
+        pks: &[u8],
+        col: usize,
+    ) -> Result<Option<*mut sqlite::value>, ResultCode> {
+        let found = match self.current {
+            Some((i, k, found)) if i == tbl_idx && k == key => found,
+            _ => {
+                if let Some((i, _, _)) = self.current.take() {
+                    reset_cached_stmt(self.stmts[&i].1.stmt)?;
+                }
+                if !self.stmts.contains_key(&tbl_idx) {
+                    let cols: Vec<usize> = (0..tbl_info.non_pks.len()).collect();
+                    let key: ChangesStmtKey = (tbl_info.row_data_query(&cols)?, None);
+                    let stmt = match changes_stmt_cache(ext_data).take(&key) {
+                        Some(stmt) => stmt,
+                        None => db.prepare_v3(&key.0, sqlite::PREPARE_PERSISTENT)?,
+                    };
+                    self.stmts.insert(tbl_idx, (key, stmt));
+                }
+                let stmt = &self.stmts[&tbl_idx].1;
+                let unpacked_pks = unpack_columns(pks)?;
+                bind_package_to_stmt(stmt.stmt, &unpacked_pks, 0)?;
+                let found = stmt.step()? == ResultCode::ROW;
+                self.current = Some((tbl_idx, key, found));
+                found
+            }
+        };
+        if !found {
+            return Ok(None);
+        }
+        Ok(Some(self.stmts[&tbl_idx].1.column_value(col as i32)?))
+    }
+
+    fn release(
+        self,
+        ext_data: *mut crsql_ExtData,
+        generation: u64,
+    ) -> Result<ResultCode, ResultCode> {
+        let cache = changes_stmt_cache(ext_data);
+        let mut ret = Ok(ResultCode::OK);
+        for (_, (key, stmt)) in self.stmts {
+            if let Err(rc) = cache.put(generation, key, stmt) {
+                ret = Err(rc);
+            }
+        }
+        ret
+    }
+}
+
+/**
+ * Encodes every change after `since` that was not written by `exclude_site`, in
+ * `(db_version, seq)` order. The clock tables are read directly, one statement
+ * per table that changed after `since`, and merged as `crsql_changes` does.
+ */
+pub fn export_changes(
+    db: *mut sqlite::sqlite3,
+    ext_data: *mut crsql_ExtData,
+    since: i64,
+    exclude_site: Option<&[u8]>,
+    writer: &mut ChangesetWriter,
+) -> Result<ResultCode, ResultCode> {
+    let rc = crsql_ensure_table_infos_are_up_to_date(db, ext_data, core::ptr::null_mut());
+    if rc != ResultCode::OK as c_int {
+        return Err(ResultCode::from_i32(rc).unwrap_or(ResultCode::ERROR));
+    }
+    crate::db_version::fill_db_version_if_needed(db, ext_data).or(Err(ResultCode::ERROR))?;
+    let tbl_infos =
+        unsafe { ManuallyDrop::new(Box::from_raw((*ext_data).tableInfos as *mut Vec<TableInfo>)) };
+
+    // A site this db has never seen wrote none of its changes, so nothing is excluded.
+    let exclude_ordinal = match exclude_site {
+        Some(site_id) => get_site_ordinal(db, ext_data, site_id)?.unwrap_or(-1),
+        None => -1,
+    };
+
+    let cache = changes_stmt_cache(ext_data);
+    let generation = cache.generation();
+    let mut stmts = vec![];
+    for (i, tbl_info) in tbl_infos.iter().enumerate() {
+        if tbl_info.max_db_version(db, ext_data)? <= since {
+            continue;
+        }
+        let key: ChangesStmtKey = (
+            String::from(CHANGESET_IDX_STR),
+            Some(tbl_info.tbl_name.clone()),
+        );
+        let stmt = match cache.take(&key) {
+            Some(stmt) => stmt,
+            None => {
+                let sql = changes_union_query(&[(i, tbl_info)], CHANGESET_IDX_STR, false, &[])?;
+                db.prepare_v3(&sql, sqlite::PREPARE_PERSISTENT)?
+            }
+        };
+        stmt.bind_int64(1, since)?;
+        stmt.bind_int64(2, exclude_ordinal)?;
+        stmts.push((key, stmt));
+    }
+
+    let mut merge = ClockMerge::new(stmts, generation)?;
+    let mut rows = RowValues {
+        stmts: BTreeMap::new(),
+        current: None,
+    };
+    let ret = encode_changes(db, ext_data, &tbl_infos, &mut merge, &mut rows, writer);
+    let released = rows.release(ext_data, generation);
+    merge.release(changes_stmt_cache(ext_data))?;
+    released?;
+    ret
+}
+
+fn encode_changes(
+    db: *mut sqlite::sqlite3,
+    ext_data: *mut crsql_ExtData,
+    tbl_infos: &Vec<TableInfo>,
+    merge: &mut ClockMerge,
+    rows: &mut RowValues,
+    writer: &mut ChangesetWriter,
+) -> Result<ResultCode, ResultCode> {
+    while let Some(stmt) = merge.next()? {
+        let tbl_idx = stmt.column_int64(ClockUnionColumn::TblIdx as i32) as usize;
+        let tbl_info = tbl_infos.get(tbl_idx).ok_or(ResultCode::ERROR)?;
+        let cid = stmt.column_text(ClockUnionColumn::Cid as i32);
+        let pks = stmt.column_blob(ClockUnionColumn::Pks as i32);
+        let val = if cid == crate::c::INSERT_SENTINEL || cid == crate::c::DELETE_SENTINEL {
+            None
+        } else {
+            let col = tbl_info
+                .non_pks
+                .iter()
+                .position(|c| c.name == cid)
+                .ok_or(ResultCode::ERROR)?;
+            rows.value(
+                db,
+                ext_data,
+                tbl_idx,
+                tbl_info,
+                stmt.column_int64(ClockUnionColumn::RowId as i32),
+                pks,
+                col,
+            )?
+        };
+        let site_id = get_site_id(
+            db,
+            ext_data,
+            stmt.column_int64(ClockUnionColumn::SiteOrdinal as i32),
+        )?
+        .ok_or(ResultCode::ERROR)?;
+        writer.push(
+            &tbl_info.tbl_name,
+            pks,
+            cid,
+            val,
+            stmt.column_int64(ClockUnionColumn::ColVrsn as i32),
+            stmt.column_int64(ClockUnionColumn::DbVrsn as i32),
+            site_id,
+            stmt.column_int64(ClockUnionColumn::Cl as i32),
+            stmt.column_int64(ClockUnionColumn::Seq as i32),
+        )?;
+    }
+    Ok(ResultCode::OK)
+}
+
+/**
+ * `crsql_changeset(since [, exclude_site [, codec]])`: the changes
+ * `SELECT * FROM crsql_changes WHERE db_version > since AND site_id IS NOT exclude_site`
+ * would return, as one changeset blob. A NULL `since` exports every change.
+ * `codec` is 'lz' to compress the changeset or 'none', the default.
+ */
+pub extern "C" fn crsql_changeset(
+    ctx: *mut sqlite::context,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+) {
+    let args = sqlite::args!(argc, argv);
+    if args.is_empty() || args.len() > 3 {
+        ctx.result_error(
+            "crsql_changeset takes a db_version and, optionally, a site id to exclude and a codec",
+        );
+        return;
+    }
+    let since = match args[0].value_type() {
+        ColumnType::Null => -1,
+        _ => args[0].int64(),
+    };
+    let exclude_site = match args.get(1) {
+        Some(site) if site.value_type() == ColumnType::Blob => Some(site.blob()),
+        _ => None,
+    };
+    let codec = match args.get(2) {
+        None => CODEC_NONE,
+        Some(codec) if codec.value_type() == ColumnType::Null => CODEC_NONE,
+        Some(codec) => match parse_codec(codec.text()) {
+            Some(codec) => codec,
+            None => {
+                ctx.result_error("crsql_changeset - unknown codec, expected 'lz' or 'none'");
+                return;
+            }
+        },
+    };
+
+    let db = ctx.db_handle();
+    let ext_data = ctx.user_data() as *mut crsql_ExtData;
+    let mut blob = vec![];
+    let mut sink = |bytes: &[u8]| {
+        blob.extend_from_slice(bytes);
+        Ok(ResultCode::OK)
+    };
+    let result = ChangesetWriter::new(codec, &mut sink).and_then(|mut writer| {
+        export_changes(db, ext_data, since, exclude_site, &mut writer)?;
+        writer.finish()
+    });
+    match result {
+        Ok(_) => ctx.result_blob_owned(blob),
+        Err(rc) => {
+            ctx.result_error("crsql_changeset failed to read changes");
+            ctx.result_error_code(rc);
+        }
+    }
+}
+
+pub fn parse_codec(name: &str) -> Option<u8> {
+    if name.eq_ignore_ascii_case("none") {
+        Some(CODEC_NONE)
+    } else if name.eq_ignore_ascii_case("lz") {
+        Some(CODEC_LZ)
+    } else {
+        None
+    }
+}
+
+/**
+ * Merges every change of a changeset's body in one savepoint and returns the number
+ * of rows impacted, as counted by `crsql_rows_impacted`. Nothing is merged if any
+ * change fails to.
+ *
+ * With `commit_batches`, if no transaction is open, the savepoint is instead
+ * released, and so committed, and re-opened once every MERGE_BATCH or so changes.
+ * This keeps the journal from growing with the size of the changeset but a failure
+ * part way leaves the batches before it merged.
+ *
+ * Changes are merged in batches of up to MERGE_BATCH, grouped by row and keeping
+ * their order within it, so each row's key and causal length are looked up once
+ * rather than for every change. Only one chunk is decompressed and only one batch
+ * is decoded at a time, so `body` can be far larger than memory, e.g. a mapped
+ * file.
+ */
+pub unsafe fn apply_changeset(
+    db: *mut sqlite::sqlite3,
+    ext_data: *mut crsql_ExtData,
+    codec: u8,
+    body: &[u8],
+    commit_batches: bool,
+    errmsg: *mut *mut c_char,
+) -> Result<i64, ResultCode> {
+    let rc = crsql_ensure_table_infos_are_up_to_date(db, ext_data, errmsg);
+    if rc != ResultCode::OK as c_int {
+        let err = CString::new("Failed to update CRR table information")?;
+        *errmsg = err.into_raw();
+        return Err(ResultCode::ERROR);
+    }
+    let tbl_infos = ManuallyDrop::new(Box::from_raw((*ext_data).tableInfos as *mut Vec<TableInfo>));
+
+    let commit_batches = commit_batches && db.get_autocommit();
+    let mut savepoint = ApplySavepoint::open(db, ext_data)?;
+    match apply_chunks(
+        db,
+        ext_data,
+        &tbl_infos,
+        codec,
+        body,
+        if commit_batches {
+            Some(&mut savepoint)
+        } else {
+            None
+        },
+        errmsg,
+    ) {
+        Ok(_) => {
+            savepoint.release()?;
+            Ok(savepoint.impacted)
+        }
+        Err(rc) => {
+            savepoint.rollback();
+            Err(rc)
+        }
+    }
+}
+
+/**
+ * The savepoint a changeset is merged in, along with the site id dictionary's
+ * savepoint so ordinals assigned to new site ids are forgotten when it ends.
+ */
+struct ApplySavepoint {
+    db: *mut sqlite::sqlite3,
+    ext_data: *mut crsql_ExtData,
+    level: c_int,
+    // rowsImpacted when the savepoint was opened
+    rows_impacted: c_int,
+    // rows impacted by the merges released so far
+    impacted: i64,
+}
+
+impl ApplySavepoint {
+    unsafe fn open(
+        db: *mut sqlite::sqlite3,
+        ext_data: *mut crsql_ExtData,
+    ) -> Result<ApplySavepoint, ResultCode> {
+        let mut ret = ApplySavepoint {
+            db,
+            ext_data,
+            level: 0,
+            rows_impacted: 0,
+            impacted: 0,
+        };
+        ret.reopen()?;
+        Ok(ret)
+    }
+
+    unsafe fn reopen(&mut self) -> Result<ResultCode, ResultCode> {
+        self.db.exec_safe("SAVEPOINT crsql_apply_changeset")?;
+        let dict = site_id_dict(self.ext_data);
+        self.level = dict.savepoint_level() + 1;
+        dict.savepoint(self.level);
+        self.rows_impacted = (*self.ext_data).rowsImpacted;
+        Ok(ResultCode::OK)
+    }
+
+    unsafe fn release(&mut self) -> Result<ResultCode, ResultCode> {
+        // Counted before the release as, outside of a transaction, the release
+        // commits and the commit hook resets rowsImpacted.
+        self.impacted += ((*self.ext_data).rowsImpacted - self.rows_impacted) as i64;
+        // Inside a transaction the caller may later roll back past this savepoint
+        // without the dictionary seeing it, so the ordinals assigned here are
+        // forgotten and re-read from the table on their next use.
+        let dict = site_id_dict(self.ext_data);
+        dict.forget_since(self.level);
+        dict.release(self.level);
+        self.db.exec_safe("RELEASE crsql_apply_changeset")
+    }
+
+    /**
+     * Commits what was merged so far and carries on in a new savepoint.
+     */
+    unsafe fn commit(&mut self) -> Result<ResultCode, ResultCode> {
+        self.release()?;
+        self.reopen()
+    }
+
+    unsafe fn rollback(self) {
+        let _ = self
+            .db
+            .exec_safe("ROLLBACK TO crsql_apply_changeset; RELEASE crsql_apply_changeset;");
+        let dict = site_id_dict(self.ext_data);
+        dict.rollback_to(self.level);
+        dict.release(self.level);
+        (*self.ext_data).rowsImpacted = self.rows_impacted;
+    }
+}
+
+unsafe fn malformed(errmsg: *mut *mut c_char, rc: ResultCode) -> ResultCode {
+    if let Ok(err) = CString::new("crsql - malformed changeset") {
+        *errmsg = err.into_raw();
+    }
+    rc
+}
+
+unsafe fn apply_chunks(
+    db: *mut sqlite::sqlite3,
+    ext_data: *mut crsql_ExtData,
+    tbl_infos: &Vec<TableInfo>,
+    codec: u8,
+    body: &[u8],
+    mut commit: Option<&mut ApplySavepoint>,
+    errmsg: *mut *mut c_char,
+) -> Result<ResultCode, ResultCode> {
+    let mut chunks = ChunkReader::new(codec, body);
+    // changes merged since the last commit
+    let mut uncommitted = 0;
+    while let Some(records) = chunks.next().map_err(|rc| malformed(errmsg, rc))? {
+        let mut decoder = ChangesetDecoder::new(records);
+        let mut changes = vec![];
+        loop {
+            let change = match decoder.next().map_err(|rc| malformed(errmsg, rc))? {
+                Some(change) => change,
+                None => break,
+            };
+            if change.tbl.len() > crate::consts::MAX_TBL_NAME_LEN as usize
+                || change.cid.len() > crate::consts::MAX_TBL_NAME_LEN as usize
+                || change.site_id.len() > crate::consts::SITE_ID_LEN as usize
+            {
+                let err =
+                    CString::new("crsql - table name, column name or site id exceeded max length")?;
+                *errmsg = err.into_raw();
+                return Err(ResultCode::ERROR);
+            }
+            let tbl_idx = match find_table_info_index(ext_data, tbl_infos, change.tbl) {
+                Some(i) => i,
+                None => {
+                    let err = CString::new(format!(
+                        "crsql - could not find the schema information for table {}",
+                        change.tbl
+                    ))?;
+                    *errmsg = err.into_raw();
+                    return Err(ResultCode::ERROR);
+                }
+            };
+            changes.push((tbl_idx, change));
+            if changes.len() == MERGE_BATCH {
+                uncommitted += changes.len();
+                merge_batch(db, ext_data, tbl_infos, &mut changes, errmsg)?;
+                commit_if_due(&mut commit, &mut uncommitted)?;
+            }
+        }
+        uncommitted += changes.len();
+        merge_batch(db, ext_data, tbl_infos, &mut changes, errmsg)?;
+        // Compressed chunks hold fewer than MERGE_BATCH changes so the changes to
+        // commit are counted across chunks.
+        commit_if_due(&mut commit, &mut uncommitted)?;
+    }
+    Ok(ResultCode::OK)
+}
+
+unsafe fn commit_if_due(
+    commit: &mut Option<&mut ApplySavepoint>,
+    uncommitted: &mut usize,
+) -> Result<ResultCode, ResultCode> {
+    if let Some(savepoint) = commit {
+        if *uncommitted >= MERGE_BATCH {
+            savepoint.commit()?;
+            *uncommitted = 0;
+        }
+    }
+    Ok(ResultCode::OK)
+}
+
+unsafe fn merge_batch(
+    db: *mut sqlite::sqlite3,
+    ext_data: *mut crsql_ExtData,
+    tbl_infos: &Vec<TableInfo>,
+    changes: &mut Vec<(usize, DecodedChange)>,
+    errmsg: *mut *mut c_char,
+) -> Result<ResultCode, ResultCode> {
+    if changes.is_empty() {
+        return Ok(ResultCode::OK);
+    }
+    // stable, so the changes to a row keep their order
+    changes.sort_by(|(l_idx, l), (r_idx, r)| l_idx.cmp(r_idx).then_with(|| l.pk.cmp(r.pk)));
+    merge_changes(db, ext_data, tbl_infos, changes, errmsg)?;
+    changes.clear();
+    Ok(ResultCode::OK)
+}
+
+unsafe fn merge_changes(
+    db: *mut sqlite::sqlite3,
+    ext_data: *mut crsql_ExtData,
+    tbl_infos: &Vec<TableInfo>,
+    changes: &[(usize, DecodedChange)],
+    errmsg: *mut *mut c_char,
+) -> Result<ResultCode, ResultCode> {
+    // The merge compares and binds values as sqlite values so each value is read
+    // back out of a `SELECT ?`.
+    let cache = changes_stmt_cache(ext_data);
+    let generation = cache.generation();
+    let key: ChangesStmtKey = (String::from("SELECT ?"), None);
+    let val_stmt = match cache.take(&key) {
+        Some(stmt) => stmt,
+        None => db.prepare_v3(&key.0, sqlite::PREPARE_PERSISTENT)?,
+    };
+
+    let mut ret = Ok(ResultCode::OK);
+    let mut rowid: sqlite::int64 = 0;
+    let mut start = 0;
+    while start < changes.len() {
+        let (tbl_idx, first) = &changes[start];
+        let end = start
+            + changes[start..]
+                .iter()
+                .take_while(|(i, change)| i == tbl_idx && change.pk == first.pk)
+                .count();
+        ret = RowMerge::new(db, ext_data, tbl_infos, first.tbl, first.pk, errmsg).and_then(
+            |mut row| {
+                for (_, change) in &changes[start..end] {
+                    val_stmt.reset()?;
+                    bind_column_ref(1, &change.val, val_stmt.stmt)?;
+                    val_stmt.step()?;
+                    row.merge_change(
+                        change.cid,
+                        val_stmt.column_value(0)?,
+                        change.col_version,
+                        change.db_version,
+                        change.site_id,
+                        change.cl,
+                        change.seq,
+                        &mut rowid,
+                        errmsg,
+                    )?;
+                }
+                Ok(ResultCode::OK)
+            },
+        );
+        if ret.is_err() {
+            break;
+        }
+        start = end;
+    }
+    // The cached statement must not hold on to a value borrowed from the changeset.
+    reset_cached_stmt(val_stmt.stmt)?;
+    cache.put(generation, key, val_stmt)?;
+    ret
+}
+
+/**
+ * `crsql_apply_changeset(changeset)`: merges a changeset from `crsql_changeset` as
+ * if each change were inserted into `crsql_changes`, and returns the number of rows
+ * impacted.
+ */
+pub extern "C" fn crsql_apply_changeset(
+    ctx: *mut sqlite::context,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+) {
+    let args = sqlite::args!(argc, argv);
+    if args.len() != 1 || args[0].value_type() != ColumnType::Blob {
+        ctx.result_error("crsql_apply_changeset takes a changeset blob");
+        return;
+    }
+    result_apply_changeset(ctx, "crsql_apply_changeset", args[0].blob(), false);
+}
+
+/**
+ * Applies `changeset` for the function `fn_name` and sets the function's result to
+ * the number of rows impacted, or to the error.
+ */
+pub fn result_apply_changeset(
+    ctx: *mut sqlite::context,
+    fn_name: &str,
+    changeset: &[u8],
+    commit_batches: bool,
+) {
+    let (codec, body) = match parse_changeset_header(changeset) {
+        Ok((codec, body)) if codec == CODEC_NONE || codec == CODEC_LZ => (codec, body),
+        Ok(_) => {
+            ctx.result_error(&format!("{} - unsupported changeset codec", fn_name));
+            return;
+        }
+        Err(_) => {
+            ctx.result_error(&format!("{} - not a changeset", fn_name));
+            return;
+        }
+    };
+
+    let db = ctx.db_handle();
+    let ext_data = ctx.user_data() as *mut crsql_ExtData;
+    let mut errmsg: *mut c_char = null_mut();
+    match unsafe {
+        apply_changeset(
+            db,
+            ext_data,
+            codec,
+            body,
+            commit_batches,
+            &mut errmsg as *mut _,
+        )
+    } {
+        Ok(rows_impacted) => ctx.result_int64(rows_impacted),
+        Err(rc) => {
+            if errmsg.is_null() {
+                ctx.result_error(&format!("{} failed to merge changes", fn_name));
+            } else {
+                let err = unsafe { CString::from_raw(errmsg) };
+                ctx.result_error(err.to_str().unwrap_or("crsql - failed to merge changes"));
+            }
+            ctx.result_error_code(rc);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn varints_round_trip() {
+        let mut buf = vec![];
+        let values = [0i64, 1, -1, 63, -64, 64, 300, -300, i64::MAX, i64::MIN];
+        for v in values {
+            put_zigzag(&mut buf, v);
+        }
+        put_varint(&mut buf, u64::MAX);
+        assert_eq!(&buf[..4], &[0, 2, 1, 126]);
+        let mut read = &buf[..];
+        for v in values {
+            assert_eq!(get_zigzag(&mut read), Some(v));
+        }
+        assert_eq!(get_varint(&mut read), Some(u64::MAX));
+        assert!(read.is_empty());
+        assert_eq!(get_varint(&mut &[0x80u8, 0x80][..]), None);
+        assert_eq!(
+            get_varint(&mut &[0xffu8, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02][..]),
+            None
+        );
+    }
+
+    #[test]
+    fn changes_round_trip() {
+        let site_a = [1u8; 16];
+        let site_b = [2u8; 16];
+        // tbl, pk, cid, col_version, db_version, site, cl, seq
+        let changes: [(&str, &[u8], &str, i64, i64, &[u8], i64, i64); 6] = [
+            ("foo", &[1, 9, 1], "-1", 1, 1, &site_a, 1, 0),
+            ("foo", &[1, 9, 1], "b", 1, 1, &site_a, 1, 1),
+            ("bar", &[1, 9, 1], "b", 3, 1, &site_a, 1, 2),
+            ("bar", &[1, 9, 2], "__crsql_del", 2, 5, &site_b, 2, 0),
+            ("foo", &[1, 9, 1], "b", 2, 4, &site_a, 1, 7),
+            ("foo", &[1, 9, 1], "c", -4, 3, &site_a, 1, 1),
+        ];
+        let mut encoder = ChangesetEncoder::new();
+        let mut records = vec![];
+        for (i, c) in changes.iter().enumerate() {
+            encoder.push(c.0, c.1, c.2, None, c.3, c.4, c.5, c.6, c.7);
+            if i == 3 {
+                records.extend_from_slice(&encoder.take_chunk());
+            }
+        }
+        records.extend_from_slice(&encoder.take_chunk());
+        assert_eq!(
+            records.iter().filter(|b| **b == TAG_RESET).count() >= 1,
+            true
+        );
+
+        let mut decoder = ChangesetDecoder::new(&records);
+        for c in changes.iter() {
+            let d = decoder.next().unwrap().unwrap();
+            assert_eq!(
+                (
+                    d.tbl,
+                    d.pk,
+                    d.cid,
+                    d.col_version,
+                    d.db_version,
+                    d.site_id,
+                    d.cl,
+                    d.seq
+                ),
+                *c
+            );
+            assert!(matches!(d.val, ColumnRef::Null));
+        }
+        assert!(decoder.next().unwrap().is_none());
+
+        // a change that refers to a dictionary entry of the previous chunk
+        let mut truncated = vec![TAG_RESET];
+        truncated.extend_from_slice(&records[records.len() - 4..]);
+        assert_eq!(
+            ChangesetDecoder::new(&truncated).next().err(),
+            Some(ResultCode::FORMAT)
+        );
+    }
+
+    #[test]
+    fn every_flag_combination_round_trips() {
+        let sites = [[1u8; 16], [2u8; 16]];
+        for same in 0..16u8 {
+            let prev = (
+                "foo",
+                &[1u8, 9, 1][..],
+                "b",
+                1i64,
+                10i64,
+                &sites[0][..],
+                3i64,
+                5i64,
+            );
+            let next = (
+                if same & SAME_ROW != 0 { "foo" } else { "bar" },
+                &[1u8, 9, 1][..],
+                "c",
+                -2i64,
+                // a later change may have a lower db_version or seq, i.e. a negative delta
+                if same & SAME_DB_VERSION != 0 {
+                    10i64
+                } else {
+                    7i64
+                },
+                if same & SAME_SITE != 0 {
+                    &sites[0][..]
+                } else {
+                    &sites[1][..]
+                },
+                if same & SAME_CL != 0 { 3i64 } else { 1i64 },
+                2i64,
+            );
+
+            let mut encoder = ChangesetEncoder::new();
+            // define every dictionary entry up front so the change records are adjacent
+            for (tbl, site) in [("foo", &sites[0]), ("bar", &sites[1])] {
+                encoder.push(tbl, &[1, 9, 2], "b", None, 1, 1, site, 1, 0);
+                encoder.push(tbl, &[1, 9, 2], "c", None, 1, 1, site, 1, 0);
+            }
+            for c in [prev, next] {
+                let at = encoder.len();
+                encoder.push(c.0, c.1, c.2, None, c.3, c.4, c.5, c.6, c.7);
+                if c == next {
+                    assert_eq!(encoder.buf[at], TAG_CHANGE | same);
+                }
+            }
+            let records = encoder.take_chunk();
+
+            let mut decoder = ChangesetDecoder::new(&records);
+            for _ in 0..4 {
+                decoder.next().unwrap().unwrap();
+            }
+            for c in [prev, next] {
+                let d = decoder.next().unwrap().unwrap();
+                assert_eq!(
+                    (
+                        d.tbl,
+                        d.pk,
+                        d.cid,
+                        d.col_version,
+                        d.db_version,
+                        d.site_id,
+                        d.cl,
+                        d.seq
+                    ),
+                    c
+                );
+            }
+            assert!(decoder.next().unwrap().is_none());
+        }
+    }
+
+    #[test]
+    fn headers_are_checked() {
+        let header = changeset_header(CODEC_LZ);
+        assert_eq!(&header[..4], CHANGESET_MAGIC);
+        let mut blob = header.to_vec();
+        blob.push(TAG_RESET);
+        assert_eq!(
+            parse_changeset_header(&blob),
+            Ok((CODEC_LZ, &[TAG_RESET][..]))
+        );
+        assert_eq!(parse_changeset_header(&header), Ok((CODEC_LZ, &[][..])));
+
+        assert_eq!(
+            parse_changeset_header(&header[..5]),
+            Err(ResultCode::FORMAT)
+        );
+        let mut bad_magic = header;
+        bad_magic[0] = b'X';
+        assert_eq!(parse_changeset_header(&bad_magic), Err(ResultCode::FORMAT));
+        let mut bad_version = header;
+        bad_version[4] = CHANGESET_VERSION + 1;
+        assert_eq!(
+            parse_changeset_header(&bad_version),
+            Err(ResultCode::FORMAT)
+        );
+    }
+
+    #[test]
+    fn compressed_chunks_round_trip() {
+        let site = [3u8; 16];
+        let n = 20000;
+        for codec in [CODEC_NONE, CODEC_LZ] {
+            let mut blob = vec![];
+            let mut chunks = 0;
+            let mut sink = |bytes: &[u8]| {
+                blob.extend_from_slice(bytes);
+                chunks += 1;
+                Ok(ResultCode::OK)
+            };
+            let mut writer = ChangesetWriter::new(codec, &mut sink).unwrap();
+            for i in 0..n {
+                let pk = [1, 9, (i / 3) as u8];
+                writer
+                    .push("foo", &pk, "b", None, 1, i / 3, &site, 1, i % 3)
+                    .unwrap();
+            }
+            writer.finish().unwrap();
+            // the header and more than one chunk
+            assert!(chunks > 2);
+
+            let (read_codec, body) = parse_changeset_header(&blob).unwrap();
+            assert_eq!(read_codec, codec);
+            let mut reader = ChunkReader::new(codec, body);
+            let mut i = 0;
+            while let Some(records) = reader.next().unwrap() {
+                let mut decoder = ChangesetDecoder::new(records);
+                while let Some(d) = decoder.next().unwrap() {
+                    assert_eq!(
+                        (d.pk[2], d.db_version, d.seq),
+                        ((i / 3) as u8, i / 3, i % 3)
+                    );
+                    i += 1;
+                }
+            }
+            assert_eq!(i, n);
+
+            if codec == CODEC_LZ {
+                let mut truncated = ChunkReader::new(codec, &body[..body.len() - 1]);
+                let mut result = Ok(None);
+                for _ in 0..chunks {
+                    result = truncated.next().map(|c| c.map(|_| ()));
+                    if result.is_err() {
+                        break;
+                    }
+                }
+                assert_eq!(result, Err(ResultCode::FORMAT));
+            }
+        }
+    }
+}
@@ -0,0 +1,197 @@
+extern crate alloc;
+
+use alloc::ffi::CString;
+use alloc::format;
+use alloc::string::{String, ToString};
+use alloc::vec::Vec;
+use core::ffi::c_int;
+
+use sqlite::{Connection, Context, Destructor, ManagedConnection, ResultCode, Value};
+use sqlite_nostd as sqlite;
+
+use crate::bootstrap::uuid;
+use crate::consts;
+use crate::util::{escape_ident, get_db_version_union_query};
+
+// `crsql_tracked_peers` rows are keyed by (site_id, tag, event). Tag 0 tracks the
+// whole database, event 0 what was received from the peer and 1 what was sent to it.
+const TRACKED_TAG_WHOLE_DB: i64 = 0;
+const TRACKED_EVENT_RECEIVE: i64 = 0;
+const TRACKED_EVENT_SEND: i64 = 1;
+
+/**
+ * `crsql_clone_to(path)`: copies the database to a new file at `path` that can be
+ * used as a new peer right away, and returns the clone's site id.
+ *
+ * The copy is made with `VACUUM INTO`. VACUUM can not run while the statement
+ * calling this function does, so it runs on a connection of its own and copies the
+ * last committed state of the database; uncommitted writes of the calling
+ * connection are not in the clone. The clone is then given an identity of its own:
+ *
+ * - ordinal 0 of `crsql_site_id` becomes a fresh site id
+ * - the source's site id gets a new ordinal and the clock entries of the source's
+ *   own writes are moved to it, so they stay attributed to the source
+ * - the clone has received every change of the source up to the copied db_version,
+ *   and whatever the source had received from other peers, but it has sent nothing
+ *   to anyone, so `crsql_tracked_peers` keeps the source's receive events, drops its
+ *   send events and records the source as received up to that db_version.
+ *
+ * An in-memory database can not be cloned.
+ */
+pub extern "C" fn crsql_clone_to(
+    ctx: *mut sqlite::context,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+) {
+    let args = sqlite::args!(argc, argv);
+    if args.len() != 1 || args[0].value_type() != sqlite::ColumnType::Text {
+        ctx.result_error("crsql_clone_to takes the path to clone the database to");
+        return;
+    }
+
+    let db = ctx.db_handle();
+    match clone_to(db, args[0].text()) {
+        Ok(site_id) => ctx.result_blob_owned(site_id.to_vec()),
+        Err((rc, msg)) => {
+            ctx.result_error(&format!("crsql_clone_to - {}", msg));
+            ctx.result_error_code(rc);
+        }
+    }
+}
+
+fn clone_to(db: *mut sqlite::sqlite3, path: &str) -> Result<[u8; 16], (ResultCode, String)> {
+    let source_file =
+        main_db_file(db).map_err(|rc| (rc, "failed to read the database file".to_string()))?;
+    if source_file.is_empty() {
+        return Err((
+            ResultCode::MISUSE,
+            "an in-memory database can not be cloned".to_string(),
+        ));
+    }
+
+    let source = open(&source_file)?;
+    vacuum_into(&source, path).map_err(|rc| (rc, conn_errmsg(&source, "VACUUM INTO failed")))?;
+    drop(source);
+
+    let clone = open(path)?;
+    if let Err(rc) = clone.exec_safe("BEGIN EXCLUSIVE") {
+        return Err((rc, conn_errmsg(&clone, "failed to open the clone")));
+    }
+    match assign_clone_identity(&clone) {
+        Ok(site_id) => {
+            clone
+                .exec_safe("COMMIT")
+                .map_err(|rc| (rc, conn_errmsg(&clone, "failed to commit the clone")))?;
+            Ok(site_id)
+        }
+        Err(rc) => {
+            let msg = conn_errmsg(&clone, "failed to rewrite the clone's site id");
+            let _ = clone.exec_safe("ROLLBACK");
+            Err((rc, msg))
+        }
+    }
+}
+
+fn main_db_file(db: *mut sqlite::sqlite3) -> Result<String, ResultCode> {
+    let stmt = db.prepare_v2("SELECT file FROM pragma_database_list WHERE name = 'main'")?;
+    match stmt.step()? {
+        ResultCode::ROW => Ok(stmt.column_text(0)?.to_string()),
+        _ => Ok(String::new()),
+    }
+}
+
+fn open(path: &str) -> Result<ManagedConnection, (ResultCode, String)> {
+    let c_path =
+        CString::new(path).map_err(|_| (ResultCode::MISUSE, "invalid path".to_string()))?;
+    sqlite::open(c_path.as_ptr()).map_err(|rc| (rc, format!("failed to open {}", path)))
+}
+
+fn conn_errmsg(conn: &ManagedConnection, context: &str) -> String {
+    match conn.errmsg() {
+        Ok(msg) => format!("{}: {}", context, msg),
+        Err(_) => context.to_string(),
+    }
+}
+
+fn vacuum_into(source: &ManagedConnection, path: &str) -> Result<ResultCode, ResultCode> {
+    let stmt = source.prepare_v2("VACUUM INTO ?")?;
+    stmt.bind_text(1, path, Destructor::STATIC)?;
+    stmt.step()
+}
+
+fn assign_clone_identity(clone: &ManagedConnection) -> Result<[u8; 16], ResultCode> {
+    let source_site_id = {
+        let stmt = clone.prepare_v2(&format!(
+            "SELECT site_id FROM \"{}\" WHERE ordinal = 0",
+            consts::TBL_SITE_ID
+        ))?;
+        if stmt.step()? != ResultCode::ROW {
+            return Err(ResultCode::CORRUPT);
+        }
+        stmt.column_blob(0)?.to_vec()
+    };
+
+    let site_id = uuid();
+    let stmt = clone.prepare_v2(&format!(
+        "UPDATE \"{}\" SET site_id = ? WHERE ordinal = 0",
+        consts::TBL_SITE_ID
+    ))?;
+    stmt.bind_blob(1, &site_id, Destructor::STATIC)?;
+    stmt.step()?;
+
+    let stmt = clone.prepare_v2(&format!(
+        "INSERT INTO \"{tbl}\" (site_id, ordinal)
+          SELECT ?, coalesce(max(ordinal), 0) + 1 FROM \"{tbl}\" RETURNING ordinal",
+        tbl = consts::TBL_SITE_ID
+    ))?;
+    stmt.bind_blob(1, &source_site_id, Destructor::STATIC)?;
+    if stmt.step()? != ResultCode::ROW {
+        return Err(ResultCode::ERROR);
+    }
+    let source_ordinal = stmt.column_int64(0);
+    stmt.step()?;
+
+    let clock_tables = {
+        let stmt = clone.prepare_v2(
+            "SELECT tbl_name FROM sqlite_master WHERE type='table' AND tbl_name LIKE '%__crsql_clock'",
+        )?;
+        let mut names = Vec::new();
+        while stmt.step()? == ResultCode::ROW {
+            names.push(stmt.column_text(0)?.to_string());
+        }
+        names
+    };
+    for tbl in &clock_tables {
+        let stmt = clone.prepare_v2(&format!(
+            "UPDATE \"{}\" SET site_id = ? WHERE site_id = 0",
+            escape_ident(tbl)
+        ))?;
+        stmt.bind_int64(1, source_ordinal)?;
+        stmt.step()?;
+    }
+
+    let db_version = if clock_tables.is_empty() {
+        consts::MIN_POSSIBLE_DB_VERSION
+    } else {
+        let stmt = clone.prepare_v2(&get_db_version_union_query(&clock_tables))?;
+        match stmt.step()? {
+            ResultCode::ROW => stmt.column_int64(0),
+            _ => consts::MIN_POSSIBLE_DB_VERSION,
+        }
+    };
+
+    let stmt = clone.prepare_v2("DELETE FROM crsql_tracked_peers WHERE event = ?")?;
+    stmt.bind_int64(1, TRACKED_EVENT_SEND)?;
+    stmt.step()?;
+    let stmt = clone.prepare_v2(
+        "INSERT OR REPLACE INTO crsql_tracked_peers (site_id, version, seq, tag, event)
+          VALUES (?, ?, 0, ?, ?)",
+    )?;
+    stmt.bind_blob(1, &source_site_id, Destructor::STATIC)?;
+    stmt.bind_int64(2, db_version)?;
+    stmt.bind_int64(3, TRACKED_TAG_WHOLE_DB)?;
+    stmt.bind_int64(4, TRACKED_EVENT_RECEIVE)?;
+    stmt.step()?;
+
+    Ok(site_id)
+}
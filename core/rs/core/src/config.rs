@@ -1,12 +1,22 @@
+use alloc::boxed::Box;
 use alloc::format;
+use alloc::vec::Vec;
+use core::ffi::c_int;
+use core::mem::ManuallyDrop;
+use num_traits::FromPrimitive;
 
 use sqlite::{Connection, Context};
 use sqlite_nostd as sqlite;
 use sqlite_nostd::{ResultCode, Value};
 
+use crate::bootstrap::create_clock_db_version_index;
 use crate::c::crsql_ExtData;
+use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, TableInfo};
 
 pub const MERGE_EQUAL_VALUES: &str = "merge-equal-values";
+pub const PACKED_PKS: &str = "packed-pks";
+pub const LOOKASIDE_CL: &str = "lookaside-cl";
+pub const COVERING_CLOCK_INDEX: &str = "covering-clock-index";
 
 pub extern "C" fn crsql_config_set(
     ctx: *mut sqlite::context,
@@ -24,6 +34,11 @@ pub extern "C" fn crsql_config_set(
             unsafe { (*ext_data).mergeEqualValues = value.int() };
             value
         }
+        // Only read when a crr's lookaside table is created so there is nothing to
+        // cache on the connection. See `lookaside_option_enabled`.
+        PACKED_PKS | LOOKASIDE_CL => args[1],
+        // Applies to existing crrs right away, see `migrate_clock_db_version_indexes`.
+        COVERING_CLOCK_INDEX => args[1],
         _ => {
             ctx.result_error("Unknown setting name");
             ctx.result_error_code(ResultCode::ERROR);
@@ -32,7 +47,14 @@ pub extern "C" fn crsql_config_set(
     };
 
     let db = ctx.db_handle();
-    match insert_config_setting(db, name, value) {
+    let result = if name == COVERING_CLOCK_INDEX {
+        let ext_data = ctx.user_data() as *mut crsql_ExtData;
+        migrate_clock_db_version_indexes(db, ext_data, value.int() != 0)
+            .and_then(|_| insert_config_setting(db, name, value))
+    } else {
+        insert_config_setting(db, name, value)
+    };
+    match result {
         Ok(value) => {
             ctx.result_value(value);
         }
@@ -44,6 +66,34 @@ pub extern "C" fn crsql_config_set(
     }
 }
 
+/**
+ * Switches the db_version index of every existing clock table to or from the
+ * covering one. Either all clock tables are switched or none are.
+ */
+fn migrate_clock_db_version_indexes(
+    db: *mut sqlite_nostd::sqlite3,
+    ext_data: *mut crsql_ExtData,
+    covering: bool,
+) -> Result<ResultCode, ResultCode> {
+    let rc = crsql_ensure_table_infos_are_up_to_date(db, ext_data, core::ptr::null_mut());
+    if rc != ResultCode::OK as c_int {
+        return Err(ResultCode::from_i32(rc).unwrap_or(ResultCode::ERROR));
+    }
+    let tbl_infos =
+        unsafe { ManuallyDrop::new(Box::from_raw((*ext_data).tableInfos as *mut Vec<TableInfo>)) };
+
+    db.exec_safe("SAVEPOINT crsql_clock_db_version_indexes;")?;
+    for tbl_info in tbl_infos.iter() {
+        if let Err(rc) = create_clock_db_version_index(db, &tbl_info.tbl_name, covering) {
+            let _ = db.exec_safe(
+                "ROLLBACK TO crsql_clock_db_version_indexes; RELEASE crsql_clock_db_version_indexes;",
+            );
+            return Err(rc);
+        }
+    }
+    db.exec_safe("RELEASE crsql_clock_db_version_indexes;")
+}
+
 fn insert_config_setting(
     db: *mut sqlite_nostd::sqlite3,
     name: &str,
@@ -76,6 +126,15 @@ pub extern "C" fn crsql_config_get(
             let ext_data = ctx.user_data() as *mut crsql_ExtData;
             ctx.result_int(unsafe { (*ext_data).mergeEqualValues });
         }
+        PACKED_PKS | LOOKASIDE_CL | COVERING_CLOCK_INDEX => {
+            match lookaside_option_enabled(ctx.db_handle(), name) {
+                Ok(enabled) => ctx.result_int(enabled as i32),
+                Err(rc) => {
+                    ctx.result_error("Could not read config from database");
+                    ctx.result_error_code(rc);
+                }
+            }
+        }
         _ => {
             ctx.result_error("Unknown setting name");
             ctx.result_error_code(ResultCode::ERROR);
@@ -83,3 +142,24 @@ pub extern "C" fn crsql_config_get(
         }
     }
 }
+
+/**
+ * Whether lookaside tables created from now on should carry the column behind
+ * the `PACKED_PKS` or `LOOKASIDE_CL` option. Existing crrs pick it up on their
+ * next `crsql_commit_alter`. Tables that already have the column keep
+ * maintaining it regardless of this setting.
+ *
+ * Also whether clock tables get the `COVERING_CLOCK_INDEX`.
+ */
+pub fn lookaside_option_enabled(
+    db: *mut sqlite_nostd::sqlite3,
+    name: &str,
+) -> Result<bool, ResultCode> {
+    let stmt = db.prepare_v2("SELECT value FROM crsql_master WHERE key = ?")?;
+    stmt.bind_text(1, &format!("config.{name}"), sqlite::Destructor::TRANSIENT)?;
+    if let ResultCode::ROW = stmt.step()? {
+        Ok(stmt.column_int(0) != 0)
+    } else {
+        Ok(false)
+    }
+}
@@ -1,4 +1,4 @@
-#![cfg_attr(not(test), no_std)]
+#![cfg_attr(not(any(test, feature = "std")), no_std)]
 #![feature(vec_into_raw_parts)]
 
 // TODO: these pub mods are exposed for the integration testing
@@ -14,9 +14,16 @@ mod bootstrap;
 pub mod c;
 #[cfg(not(feature = "test"))]
 mod c;
+#[cfg(all(feature = "std", target_os = "linux"))]
+mod changes_file;
+mod changes_rows_vtab;
+mod changes_stats;
+mod changes_summary_vtab;
 mod changes_vtab;
 mod changes_vtab_read;
 mod changes_vtab_write;
+mod changeset;
+mod clone;
 mod compare_values;
 mod config;
 mod consts;
@@ -29,11 +36,14 @@ mod db_version;
 mod ext_data;
 mod is_crr;
 mod local_writes;
+mod lz;
 #[cfg(feature = "test")]
 pub mod pack_columns;
 #[cfg(not(feature = "test"))]
 mod pack_columns;
+mod pk_range;
 mod sha;
+mod site_id_dict;
 mod stmt_cache;
 #[cfg(feature = "test")]
 pub mod tableinfo;
@@ -65,7 +75,7 @@ use local_writes::after_update::x_crsql_after_update;
 use sqlite::{Destructor, ResultCode};
 use sqlite_nostd as sqlite;
 use sqlite_nostd::{Connection, Context, Value};
-use tableinfo::is_table_compatible;
+use tableinfo::{forget_max_db_versions, is_table_compatible};
 use teardown::*;
 
 pub extern "C" fn crsql_as_table(
@@ -140,6 +150,24 @@ pub extern "C" fn sqlite3_crsqlcore_init(
         return null_mut();
     }
 
+    for op in pk_range::PK_OPS {
+        let rc = db
+            .create_function_v2(
+                op.function_name(),
+                2,
+                sqlite::UTF8 | sqlite::INNOCUOUS | sqlite::DETERMINISTIC,
+                Some(op as usize as *mut c_void),
+                Some(pk_range::crsql_pk_filter),
+                None,
+                None,
+                None,
+            )
+            .unwrap_or(sqlite::ResultCode::ERROR);
+        if rc != ResultCode::OK {
+            return null_mut();
+        }
+    }
+
     let rc = db
         .create_function_v2(
             "crsql_as_table",
@@ -507,6 +535,100 @@ pub extern "C" fn sqlite3_crsqlcore_init(
         return null_mut();
     }
 
+    let rc = db
+        .create_function_v2(
+            "crsql_changeset",
+            -1,
+            sqlite::UTF8,
+            Some(ext_data as *mut c_void),
+            Some(changeset::crsql_changeset),
+            None,
+            None,
+            None,
+        )
+        .unwrap_or(ResultCode::ERROR);
+    if rc != ResultCode::OK {
+        unsafe { crsql_freeExtData(ext_data) };
+        return null_mut();
+    }
+
+    let rc = db
+        .create_function_v2(
+            "crsql_apply_changeset",
+            1,
+            sqlite::UTF8,
+            Some(ext_data as *mut c_void),
+            Some(changeset::crsql_apply_changeset),
+            None,
+            None,
+            None,
+        )
+        .unwrap_or(ResultCode::ERROR);
+    if rc != ResultCode::OK {
+        unsafe { crsql_freeExtData(ext_data) };
+        return null_mut();
+    }
+
+    let rc = db
+        .create_function_v2(
+            "crsql_clone_to",
+            1,
+            sqlite::UTF8 | sqlite::DIRECTONLY,
+            None,
+            Some(clone::crsql_clone_to),
+            None,
+            None,
+            None,
+        )
+        .unwrap_or(ResultCode::ERROR);
+    if rc != ResultCode::OK {
+        unsafe { crsql_freeExtData(ext_data) };
+        return null_mut();
+    }
+
+    #[cfg(all(feature = "std", target_os = "linux"))]
+    {
+        let rc = db
+            .create_function_v2(
+                "crsql_export_changes_file",
+                -1,
+                sqlite::UTF8 | sqlite::DIRECTONLY,
+                Some(ext_data as *mut c_void),
+                Some(changes_file::crsql_export_changes_file),
+                None,
+                None,
+                None,
+            )
+            .unwrap_or(ResultCode::ERROR);
+        if rc != ResultCode::OK {
+            unsafe { crsql_freeExtData(ext_data) };
+            return null_mut();
+        }
+
+        let rc = db
+            .create_function_v2(
+                "crsql_import_changes_file",
+                1,
+                sqlite::UTF8 | sqlite::DIRECTONLY,
+                Some(ext_data as *mut c_void),
+                Some(changes_file::crsql_import_changes_file),
+                None,
+                None,
+                None,
+            )
+            .unwrap_or(ResultCode::ERROR);
+        if rc != ResultCode::OK {
+            unsafe { crsql_freeExtData(ext_data) };
+            return null_mut();
+        }
+    }
+
+    let rc = changes_summary_vtab::create_module(db, ext_data).unwrap_or(ResultCode::ERROR);
+    if rc != ResultCode::OK {
+        unsafe { crsql_freeExtData(ext_data) };
+        return null_mut();
+    }
+
     return ext_data as *mut c_void;
 }
 
@@ -678,6 +800,10 @@ unsafe extern "C" fn x_crsql_commit_alter(
     } else {
         rc
     };
+    if rc == ResultCode::OK as c_int {
+        // the backfill wrote clock rows without advancing the tables' high-water marks
+        forget_max_db_versions(ext_data);
+    }
     let rc = if rc == ResultCode::OK as c_int {
         db.exec_safe("RELEASE alter_crr")
             .unwrap_or(ResultCode::ERROR) as c_int
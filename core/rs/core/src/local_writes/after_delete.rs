@@ -40,6 +40,7 @@ fn after_delete(
     pks_old: &[*mut value],
 ) -> Result<ResultCode, String> {
     let db_version = crate::db_version::next_db_version(db, ext_data, None)?;
+    tbl_info.advance_max_db_version(db_version);
     let seq = bump_seq(ext_data);
     let key = tbl_info
         .get_or_create_key_via_raw_values(db, pks_old)
@@ -59,6 +60,7 @@ fn after_delete(
         .and_then(|_| mark_locally_deleted_stmt.bind_int(5, seq))
         .or_else(|_| Err("failed binding to mark locally deleted stmt"))?;
     super::step_trigger_stmt(mark_locally_deleted_stmt)?;
+    super::set_lookaside_cl(db, tbl_info, key)?;
 
     // now actually delete the row metadata
     let drop_clocks_stmt_ref = tbl_info
@@ -40,6 +40,7 @@ fn after_insert(
     pks_new: &[*mut value],
 ) -> Result<ResultCode, String> {
     let db_version = crate::db_version::next_db_version(db, ext_data, None)?;
+    tbl_info.advance_max_db_version(db_version);
     let (create_record_existed, key_new) = tbl_info
         .get_or_create_key_for_insert(db, pks_new)
         .or_else(|_| Err("failed geteting or creating lookaside key"))?;
@@ -58,7 +59,8 @@ fn after_insert(
         let seq = bump_seq(ext_data);
         super::mark_locally_updated(db, tbl_info, key_new, col, db_version, seq)?;
     }
-    Ok(ResultCode::OK)
+    // the row was either created or its sentinel moved
+    super::set_lookaside_cl(db, tbl_info, key_new)
 }
 
 fn update_create_record(
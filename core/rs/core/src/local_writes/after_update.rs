@@ -72,6 +72,7 @@ fn after_update(
     non_pks_old: &[*mut value],
 ) -> Result<ResultCode, String> {
     let next_db_version = crate::db_version::next_db_version(db, ext_data, None)?;
+    tbl_info.advance_max_db_version(next_db_version);
     let new_key = tbl_info
         .get_or_create_key_via_raw_values(db, pks_new)
         .or_else(|_| Err("failed geteting or creating lookaside key"))?;
@@ -143,7 +144,8 @@ fn after_update__mark_old_pk_row_deleted(
         .and_then(|_| mark_locally_deleted_stmt.bind_int64(4, db_version))
         .and_then(|_| mark_locally_deleted_stmt.bind_int(5, seq))
         .or_else(|_| Err("failed binding to mark_locally_deleted_stmt"))?;
-    super::step_trigger_stmt(mark_locally_deleted_stmt)
+    super::step_trigger_stmt(mark_locally_deleted_stmt)?;
+    super::set_lookaside_cl(db, tbl_info, old_key)
 }
 
 // TODO: in the future we can keep sentinel information in the lookaside
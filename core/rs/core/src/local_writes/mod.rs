@@ -13,7 +13,9 @@ use sqlite::{Context, ManagedStmt, Value};
 use sqlite_nostd as sqlite;
 use sqlite_nostd::ResultCode;
 
-use crate::tableinfo::{crsql_ensure_table_infos_are_up_to_date, ColumnInfo, TableInfo};
+use crate::tableinfo::{
+    crsql_ensure_table_infos_are_up_to_date, find_table_info_index, ColumnInfo, TableInfo,
+};
 
 pub mod after_delete;
 pub mod after_insert;
@@ -48,8 +50,8 @@ where
     let table_infos =
         unsafe { ManuallyDrop::new(Box::from_raw((*ext_data).tableInfos as *mut Vec<TableInfo>)) };
     let table_name = values[0].text();
-    let table_info = match table_infos.iter().find(|t| &(t.tbl_name) == table_name) {
-        Some(t) => t,
+    let table_info = match find_table_info_index(ext_data, &table_infos, table_name) {
+        Some(i) => &table_infos[i],
         None => {
             return Err(format!("table {} not found", table_name));
         }
@@ -97,7 +99,18 @@ fn mark_new_pk_row_created(
         .and_then(|_| mark_locally_created_stmt.bind_int64(4, db_version))
         .and_then(|_| mark_locally_created_stmt.bind_int(5, seq))
         .or_else(|_| Err("failed binding to mark_locally_created_stmt"))?;
-    step_trigger_stmt(mark_locally_created_stmt)
+    step_trigger_stmt(mark_locally_created_stmt)?;
+    set_lookaside_cl(db, tbl_info, key_new)
+}
+
+fn set_lookaside_cl(
+    db: *mut sqlite3,
+    tbl_info: &TableInfo,
+    key: sqlite::int64,
+) -> Result<ResultCode, String> {
+    tbl_info
+        .set_lookaside_cl(db, key)
+        .or_else(|_| Err("failed to set the lookaside causal length".into()))
 }
 
 fn bump_seq(ext_data: *mut crsql_ExtData) -> c_int {
@@ -0,0 +1,233 @@
+extern crate alloc;
+
+use alloc::vec;
+use alloc::vec::Vec;
+use sqlite_nostd::ResultCode;
+
+/**
+ * A small LZ77 block codec in the spirit of LZ4, so changesets can be compressed
+ * without a compression crate in the no_std build.
+ *
+ * A block is a run of sequences:
+ * [token:u8, literal_len_ext?, ...literals, offset:u16le, match_len_ext?]
+ *
+ * The token's high nibble is the number of literals and its low nibble the match
+ * length minus MIN_MATCH. A nibble of 15 is followed by bytes that are added to it,
+ * up to and including the first that is not 255. The last sequence of a block ends
+ * after its literals and has no match.
+ *
+ * Matches are found through a hash table of the last position each 4 byte prefix
+ * was seen at, so compression is a single greedy pass. Blocks are compressed
+ * independently; see `changeset::ChangesetWriter` for how a stream is cut into them.
+ */
+const MIN_MATCH: usize = 4;
+const MAX_OFFSET: usize = u16::MAX as usize;
+const HASH_LOG: u32 = 12;
+
+pub struct BlockCompressor {
+    // position + 1 of the last occurrence of each hashed prefix, 0 if none
+    table: Vec<u32>,
+}
+
+impl BlockCompressor {
+    pub fn new() -> BlockCompressor {
+        BlockCompressor {
+            table: vec![0; 1 << HASH_LOG],
+        }
+    }
+
+    fn hash(input: &[u8], i: usize) -> usize {
+        let seq = u32::from_le_bytes([input[i], input[i + 1], input[i + 2], input[i + 3]]);
+        (seq.wrapping_mul(2654435761) >> (32 - HASH_LOG)) as usize
+    }
+
+    /**
+     * Appends the compressed form of `input` to `out`. Blocks must be smaller than
+     * 4 GiB.
+     */
+    pub fn compress(&mut self, input: &[u8], out: &mut Vec<u8>) {
+        self.table.iter_mut().for_each(|p| *p = 0);
+        let mut anchor = 0;
+        let mut i = 0;
+        while i + MIN_MATCH <= input.len() {
+            let h = Self::hash(input, i);
+            let candidate = self.table[h] as usize;
+            self.table[h] = i as u32 + 1;
+            if candidate != 0 {
+                let c = candidate - 1;
+                if i - c <= MAX_OFFSET && input[c..c + MIN_MATCH] == input[i..i + MIN_MATCH] {
+                    let mut len = MIN_MATCH;
+                    while i + len < input.len() && input[c + len] == input[i + len] {
+                        len += 1;
+                    }
+                    put_sequence(out, &input[anchor..i], Some(((i - c) as u16, len)));
+                    // Remember a position inside the match so runs keep matching.
+                    if i + len + MIN_MATCH <= input.len() && len > 2 {
+                        let p = i + len - 2;
+                        self.table[Self::hash(input, p)] = p as u32 + 1;
+                    }
+                    i += len;
+                    anchor = i;
+                    continue;
+                }
+            }
+            i += 1;
+        }
+        put_sequence(out, &input[anchor..], None);
+    }
+}
+
+fn put_len_ext(out: &mut Vec<u8>, mut len: usize) {
+    while len >= 255 {
+        out.push(255);
+        len -= 255;
+    }
+    out.push(len as u8);
+}
+
+fn put_sequence(out: &mut Vec<u8>, literals: &[u8], m: Option<(u16, usize)>) {
+    let lit_nibble = literals.len().min(15);
+    let match_len = m.map_or(0, |(_, len)| len - MIN_MATCH);
+    let match_nibble = match_len.min(15);
+    out.push((lit_nibble << 4 | match_nibble) as u8);
+    if lit_nibble == 15 {
+        put_len_ext(out, literals.len() - 15);
+    }
+    out.extend_from_slice(literals);
+    if let Some((offset, _)) = m {
+        out.extend_from_slice(&offset.to_le_bytes());
+        if match_nibble == 15 {
+            put_len_ext(out, match_len - 15);
+        }
+    }
+}
+
+fn get_len_ext(input: &mut &[u8], nibble: usize) -> Result<usize, ResultCode> {
+    let mut len = nibble;
+    if nibble == 15 {
+        loop {
+            let (&b, rest) = input.split_first().ok_or(ResultCode::FORMAT)?;
+            *input = rest;
+            len = len.checked_add(b as usize).ok_or(ResultCode::FORMAT)?;
+            if b != 255 {
+                break;
+            }
+        }
+    }
+    Ok(len)
+}
+
+/**
+ * Appends the `raw_len` bytes `input` decompresses to, to `out`. Errors with FORMAT,
+ * without reading or writing out of bounds, if `input` is not such a block.
+ */
+pub fn decompress(mut input: &[u8], raw_len: usize, out: &mut Vec<u8>) -> Result<(), ResultCode> {
+    let start = out.len();
+    let end = start.checked_add(raw_len).ok_or(ResultCode::FORMAT)?;
+    // raw_len is not trusted to size the buffer up front
+    out.reserve(raw_len.min(input.len().saturating_mul(4)));
+    loop {
+        let (&token, rest) = input.split_first().ok_or(ResultCode::FORMAT)?;
+        input = rest;
+
+        let lit_len = get_len_ext(&mut input, (token >> 4) as usize)?;
+        if lit_len > input.len() || lit_len > end - out.len() {
+            return Err(ResultCode::FORMAT);
+        }
+        out.extend_from_slice(&input[..lit_len]);
+        input = &input[lit_len..];
+        if input.is_empty() {
+            break;
+        }
+
+        if input.len() < 2 {
+            return Err(ResultCode::FORMAT);
+        }
+        let offset = u16::from_le_bytes([input[0], input[1]]) as usize;
+        input = &input[2..];
+        let match_len = get_len_ext(&mut input, (token & 0x0f) as usize)? + MIN_MATCH;
+        if offset == 0 || offset > out.len() - start || match_len > end - out.len() {
+            return Err(ResultCode::FORMAT);
+        }
+        // The match may overlap what it produces so it is copied a byte at a time.
+        let from = out.len() - offset;
+        for k in 0..match_len {
+            let b = out[from + k];
+            out.push(b);
+        }
+    }
+    if out.len() != end {
+        return Err(ResultCode::FORMAT);
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn round_trip(input: &[u8]) -> usize {
+        let mut compressed = vec![];
+        BlockCompressor::new().compress(input, &mut compressed);
+        let mut out = vec![1, 2, 3];
+        decompress(&compressed, input.len(), &mut out).unwrap();
+        assert_eq!(&out[3..], input);
+        compressed.len()
+    }
+
+    #[test]
+    fn round_trips() {
+        assert_eq!(round_trip(&[]), 1);
+        round_trip(b"abc");
+        round_trip(b"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+        let mut repetitive = vec![];
+        for i in 0..2000u32 {
+            repetitive.extend_from_slice(b"\x10\x01\x02");
+            repetitive.extend_from_slice(&(i % 7).to_le_bytes());
+            repetitive.extend_from_slice(b"some column value");
+        }
+        assert!(round_trip(&repetitive) < repetitive.len() / 4);
+        // not compressible
+        let mut noise = vec![];
+        let mut x = 0x2545F491u32;
+        for _ in 0..5000 {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            noise.push(x as u8);
+        }
+        round_trip(&noise);
+        let mut long_literals = noise.clone();
+        long_literals.extend_from_slice(&noise);
+        round_trip(&long_literals);
+    }
+
+    #[test]
+    fn rejects_bad_blocks() {
+        let mut compressed = vec![];
+        BlockCompressor::new().compress(b"abcabcabcabcabcabc", &mut compressed);
+        let mut out = vec![];
+        assert_eq!(
+            decompress(&compressed, 17, &mut out),
+            Err(ResultCode::FORMAT)
+        );
+        out.clear();
+        assert_eq!(
+            decompress(&compressed, 19, &mut out),
+            Err(ResultCode::FORMAT)
+        );
+        out.clear();
+        assert_eq!(
+            decompress(&compressed[..compressed.len() - 1], 18, &mut out),
+            Err(ResultCode::FORMAT)
+        );
+        // a match reaching before the start of the block
+        out = vec![0; 10];
+        assert_eq!(
+            decompress(&[0x00, 0x05, 0x00], 4, &mut out),
+            Err(ResultCode::FORMAT)
+        );
+        out.clear();
+        assert_eq!(decompress(&[], 0, &mut out), Err(ResultCode::FORMAT));
+    }
+}
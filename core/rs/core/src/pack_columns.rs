@@ -4,7 +4,6 @@ use alloc::string::String;
 use alloc::vec;
 use alloc::vec::Vec;
 use bytes::{Buf, BufMut};
-#[cfg(not(feature = "std"))]
 use num_traits::FromPrimitive;
 use sqlite_nostd as sqlite;
 use sqlite_nostd::{ColumnType, Context, ResultCode, Stmt, Value};
@@ -46,38 +45,7 @@ fn pack_columns(args: &[*mut sqlite::value]) -> Result<Vec<u8>, ResultCode> {
     if let Ok(len) = len_result {
         buf.put_u8(len);
         for value in args {
-            match value.value_type() {
-                ColumnType::Blob => {
-                    let len = value.bytes();
-                    let num_bytes_for_len = num_bytes_needed_i32(len);
-                    let type_byte = num_bytes_for_len << 3 | (ColumnType::Blob as u8);
-                    buf.put_u8(type_byte);
-                    buf.put_int(len as i64, num_bytes_for_len as usize);
-                    buf.put_slice(value.blob());
-                }
-                ColumnType::Null => {
-                    buf.put_u8(ColumnType::Null as u8);
-                }
-                ColumnType::Float => {
-                    buf.put_u8(ColumnType::Float as u8);
-                    buf.put_f64(value.double());
-                }
-                ColumnType::Integer => {
-                    let val = value.int64();
-                    let num_bytes_for_int = num_bytes_needed_i64(val);
-                    let type_byte = num_bytes_for_int << 3 | (ColumnType::Integer as u8);
-                    buf.put_u8(type_byte);
-                    buf.put_int(val, num_bytes_for_int as usize);
-                }
-                ColumnType::Text => {
-                    let len = value.bytes();
-                    let num_bytes_for_len = num_bytes_needed_i32(len);
-                    let type_byte = num_bytes_for_len << 3 | (ColumnType::Text as u8);
-                    buf.put_u8(type_byte);
-                    buf.put_int(len as i64, num_bytes_for_len as usize);
-                    buf.put_slice(value.blob());
-                }
-            }
+            pack_column(&mut buf, *value);
         }
         Ok(buf)
     } else {
@@ -85,6 +53,45 @@ fn pack_columns(args: &[*mut sqlite::value]) -> Result<Vec<u8>, ResultCode> {
     }
 }
 
+/**
+ * Appends `value` to `buf` in the format described in `pack_columns`.
+ * The caller is responsible for the leading column count.
+ */
+pub fn pack_column(buf: &mut Vec<u8>, value: *mut sqlite::value) {
+    match value.value_type() {
+        ColumnType::Blob => {
+            let len = value.bytes();
+            let num_bytes_for_len = num_bytes_needed_i32(len);
+            let type_byte = num_bytes_for_len << 3 | (ColumnType::Blob as u8);
+            buf.put_u8(type_byte);
+            buf.put_int(len as i64, num_bytes_for_len as usize);
+            buf.put_slice(value.blob());
+        }
+        ColumnType::Null => {
+            buf.put_u8(ColumnType::Null as u8);
+        }
+        ColumnType::Float => {
+            buf.put_u8(ColumnType::Float as u8);
+            buf.put_f64(value.double());
+        }
+        ColumnType::Integer => {
+            let val = value.int64();
+            let num_bytes_for_int = num_bytes_needed_i64(val);
+            let type_byte = num_bytes_for_int << 3 | (ColumnType::Integer as u8);
+            buf.put_u8(type_byte);
+            buf.put_int(val, num_bytes_for_int as usize);
+        }
+        ColumnType::Text => {
+            let len = value.bytes();
+            let num_bytes_for_len = num_bytes_needed_i32(len);
+            let type_byte = num_bytes_for_len << 3 | (ColumnType::Text as u8);
+            buf.put_u8(type_byte);
+            buf.put_int(len as i64, num_bytes_for_len as usize);
+            buf.put_slice(value.blob());
+        }
+    }
+}
+
 fn num_bytes_needed_i32(val: i32) -> u8 {
     if val & 0xFF000000u32 as i32 != 0 {
         return 4;
@@ -182,6 +189,85 @@ pub fn unpack_columns(data: &[u8]) -> Result<Vec<ColumnValue>, ResultCode> {
     Ok(ret)
 }
 
+/**
+ * A column read by `unpack_column`. Text and blobs point into the packed data.
+ */
+pub enum ColumnRef<'a> {
+    Blob(&'a [u8]),
+    Float(f64),
+    Integer(i64),
+    Null,
+    Text(&'a str),
+}
+
+/**
+ * Reads one column, as `pack_column` wrote it, off the front of `buf` without
+ * copying it out.
+ */
+pub fn unpack_column<'a>(buf: &mut &'a [u8]) -> Result<ColumnRef<'a>, ResultCode> {
+    if !buf.has_remaining() {
+        return Err(ResultCode::ABORT);
+    }
+    let column_type_and_maybe_intlen = buf.get_u8();
+    let column_type = ColumnType::from_u8(column_type_and_maybe_intlen & 0x07);
+    let intlen = (column_type_and_maybe_intlen >> 3 & 0xFF) as usize;
+    if intlen > 8 {
+        return Err(ResultCode::ABORT);
+    }
+
+    match column_type {
+        Some(ColumnType::Blob) | Some(ColumnType::Text) => {
+            if buf.remaining() < intlen {
+                return Err(ResultCode::ABORT);
+            }
+            let len = buf.get_int(intlen) as usize;
+            if buf.remaining() < len {
+                return Err(ResultCode::ABORT);
+            }
+            let (bytes, rest) = buf.split_at(len);
+            *buf = rest;
+            if column_type == Some(ColumnType::Blob) {
+                Ok(ColumnRef::Blob(bytes))
+            } else {
+                Ok(ColumnRef::Text(unsafe {
+                    core::str::from_utf8_unchecked(bytes)
+                }))
+            }
+        }
+        Some(ColumnType::Float) => {
+            if buf.remaining() < 8 {
+                return Err(ResultCode::ABORT);
+            }
+            Ok(ColumnRef::Float(buf.get_f64()))
+        }
+        Some(ColumnType::Integer) => {
+            if buf.remaining() < intlen {
+                return Err(ResultCode::ABORT);
+            }
+            Ok(ColumnRef::Integer(buf.get_int(intlen)))
+        }
+        Some(ColumnType::Null) => Ok(ColumnRef::Null),
+        None => Err(ResultCode::MISUSE),
+    }
+}
+
+/**
+ * Binds `val` without copying it. It must outlive the statement's use of it.
+ */
+pub fn bind_column_ref(
+    slot_num: usize,
+    val: &ColumnRef,
+    stmt: *mut sqlite::stmt,
+) -> Result<ResultCode, ResultCode> {
+    match val {
+        ColumnRef::Blob(b) => stmt.bind_blob(slot_num as i32, b, sqlite::Destructor::STATIC),
+        ColumnRef::Float(f) => stmt.bind_double(slot_num as i32, *f),
+        ColumnRef::Integer(i) => stmt.bind_int64(slot_num as i32, *i),
+        ColumnRef::Null => stmt.bind_null(slot_num as i32),
+        ColumnRef::Text(t) => stmt.bind_text(slot_num as i32, t, sqlite::Destructor::STATIC),
+    }
+}
+
 pub fn bind_package_to_stmt(
     stmt: *mut sqlite::stmt,
     values: &Vec<ColumnValue>,
@@ -193,7 +279,7 @@ pub fn bind_package_to_stmt(
     Ok(ResultCode::OK)
 }
 
-fn bind_slot(
+pub fn bind_slot(
     slot_num: usize,
     val: &ColumnValue,
     stmt: *mut sqlite::stmt,
@@ -0,0 +1,325 @@
+extern crate alloc;
+
+use alloc::format;
+use alloc::string::String;
+use alloc::vec::Vec;
+use core::cmp::Ordering;
+use core::ffi::{c_char, c_int, c_void, CStr};
+
+use sqlite::{ColumnType, Context, Value};
+use sqlite_nostd as sqlite;
+
+use crate::pack_columns::{unpack_columns, ColumnValue};
+use crate::tableinfo::TableInfo;
+
+/**
+ * Predicates on packed primary keys that `crsql_changes` can push down to the
+ * `__crsql_pks` table of each crr, e.g. to replicate a single tenant's rows:
+ *
+ * SELECT * FROM crsql_changes
+ *   WHERE crsql_pk_ge(pk, crsql_pack_columns('tenant_a'))
+ *   AND crsql_pk_lt(pk, crsql_pack_columns('tenant_b'));
+ *
+ * The bound's cells are compared to the pk's leading cells in the order SQLite
+ * compares row values. A bound with fewer cells than the pk thus bounds a prefix
+ * of it. Bounds should hold values of the pk columns' types since the pushed down
+ * comparison is done by the pk columns themselves.
+ */
+#[derive(Clone, Copy, PartialEq, Debug)]
+pub enum PkOp {
+    Prefix = 0,
+    Gt = 1,
+    Ge = 2,
+    Lt = 3,
+    Le = 4,
+}
+
+pub const PK_OPS: [PkOp; 5] = [PkOp::Prefix, PkOp::Gt, PkOp::Ge, PkOp::Lt, PkOp::Le];
+
+impl PkOp {
+    pub fn function_name(&self) -> &'static str {
+        match self {
+            PkOp::Prefix => "crsql_pk_prefix",
+            PkOp::Gt => "crsql_pk_gt",
+            PkOp::Ge => "crsql_pk_ge",
+            PkOp::Lt => "crsql_pk_lt",
+            PkOp::Le => "crsql_pk_le",
+        }
+    }
+
+    /**
+     * The `aConstraint[].op` best_index sees for a call to this function on
+     * `crsql_changes.pk`. See `crsql_changes_find_function`.
+     */
+    pub fn constraint_op(&self) -> c_int {
+        sqlite::INDEX_CONSTRAINT_FUNCTION as c_int + *self as c_int
+    }
+
+    pub fn from_constraint_op(op: u8) -> Option<PkOp> {
+        let i = (op as usize).checked_sub(sqlite::INDEX_CONSTRAINT_FUNCTION as usize)?;
+        PK_OPS.get(i).copied()
+    }
+
+    fn sql_op(&self) -> &'static str {
+        match self {
+            PkOp::Prefix => "=",
+            PkOp::Gt => ">",
+            PkOp::Ge => ">=",
+            PkOp::Lt => "<",
+            PkOp::Le => "<=",
+        }
+    }
+
+    fn matches(&self, ordering: Ordering) -> bool {
+        match self {
+            PkOp::Prefix => ordering == Ordering::Equal,
+            PkOp::Gt => ordering == Ordering::Greater,
+            PkOp::Ge => ordering != Ordering::Less,
+            PkOp::Lt => ordering == Ordering::Less,
+            PkOp::Le => ordering != Ordering::Greater,
+        }
+    }
+}
+
+/**
+ * A pk predicate of a `crsql_changes` query. `param` is the number of the
+ * statement parameter holding the bound and `cells` the number of cells in it, if
+ * it is packed columns at all.
+ */
+#[derive(Clone, Copy)]
+pub struct PkFilter {
+    pub op: PkOp,
+    pub param: usize,
+    pub cells: Option<usize>,
+}
+
+fn compare_cells(l: &ColumnValue, r: &ColumnValue) -> Option<Ordering> {
+    fn rank(v: &ColumnValue) -> u8 {
+        match v {
+            ColumnValue::Null => 0,
+            ColumnValue::Integer(_) | ColumnValue::Float(_) => 1,
+            ColumnValue::Text(_) => 2,
+            ColumnValue::Blob(_) => 3,
+        }
+    }
+    match (l, r) {
+        (ColumnValue::Null, _) | (_, ColumnValue::Null) => None,
+        (ColumnValue::Integer(l), ColumnValue::Integer(r)) => Some(l.cmp(r)),
+        (ColumnValue::Integer(l), ColumnValue::Float(r)) => (*l as f64).partial_cmp(r),
+        (ColumnValue::Float(l), ColumnValue::Integer(r)) => l.partial_cmp(&(*r as f64)),
+        (ColumnValue::Float(l), ColumnValue::Float(r)) => l.partial_cmp(r),
+        (ColumnValue::Text(l), ColumnValue::Text(r)) => Some(l.as_bytes().cmp(r.as_bytes())),
+        (ColumnValue::Blob(l), ColumnValue::Blob(r)) => Some(l.cmp(r)),
+        _ => Some(rank(l).cmp(&rank(r))),
+    }
+}
+
+/**
+ * Compares the pk's leading cells to the bound's. A pk that is a proper prefix of
+ * the bound is less than it. `None` if a NULL decides the comparison.
+ */
+fn compare_pk(pk: &[ColumnValue], bound: &[ColumnValue]) -> Option<Ordering> {
+    for (l, r) in pk.iter().zip(bound.iter()) {
+        match compare_cells(l, r)? {
+            Ordering::Equal => continue,
+            ordering => return Some(ordering),
+        }
+    }
+    if bound.len() > pk.len() {
+        Some(Ordering::Less)
+    } else {
+        Some(Ordering::Equal)
+    }
+}
+
+/**
+ * `crsql_pk_prefix(pk, bound)`, `crsql_pk_gt(pk, bound)`, ... The op is the
+ * function's user data.
+ */
+pub extern "C" fn crsql_pk_filter(
+    ctx: *mut sqlite::context,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+) {
+    let args = sqlite::args!(argc, argv);
+    let op = match PK_OPS.get(ctx.user_data() as usize) {
+        Some(op) => *op,
+        None => {
+            ctx.result_error("unknown pk predicate");
+            return;
+        }
+    };
+    if args.len() != 2 {
+        ctx.result_error(&format!("{} takes a pk and a bound", op.function_name()));
+        return;
+    }
+    if args[0].value_type() == ColumnType::Null || args[1].value_type() == ColumnType::Null {
+        ctx.result_null();
+        return;
+    }
+    if args[0].value_type() != ColumnType::Blob || args[1].value_type() != ColumnType::Blob {
+        ctx.result_error(&format!(
+            "{} expects packed columns, see crsql_pack_columns",
+            op.function_name()
+        ));
+        return;
+    }
+    match (
+        unpack_columns(args[0].blob()),
+        unpack_columns(args[1].blob()),
+    ) {
+        (Ok(pk), Ok(bound)) => match compare_pk(&pk, &bound) {
+            Some(ordering) => ctx.result_int(op.matches(ordering) as c_int),
+            None => ctx.result_null(),
+        },
+        _ => ctx.result_error(&format!(
+            "{} could not unpack its arguments",
+            op.function_name()
+        )),
+    }
+}
+
+/**
+ * xFindFunction of `crsql_changes`. Calls to the pk predicates on `pk` are handed
+ * to best_index as constraints so they can be pushed down.
+ */
+#[no_mangle]
+pub extern "C" fn crsql_changes_find_function(
+    _vtab: *mut sqlite::vtab,
+    n_arg: c_int,
+    name: *const c_char,
+    px_func: *mut Option<sqlite::xFunc>,
+    pp_arg: *mut *mut c_void,
+) -> c_int {
+    if n_arg != 2 || name.is_null() {
+        return 0;
+    }
+    let name = match unsafe { CStr::from_ptr(name) }.to_str() {
+        Ok(name) => name,
+        Err(_) => return 0,
+    };
+    for op in PK_OPS {
+        if op.function_name().eq_ignore_ascii_case(name) {
+            unsafe {
+                *px_func = Some(crsql_pk_filter as sqlite::xFunc);
+                *pp_arg = op as usize as *mut c_void;
+            }
+            return op.constraint_op();
+        }
+    }
+    0
+}
+
+/**
+ * The condition on the `__crsql_pks` columns, aliased `pk_tbl`, that selects the
+ * same rows as `filter`. The bound is unpacked by SQLite once per statement so the
+ * condition can be served by the `__crsql_pks_pks` index.
+ * None if there is nothing to push down, e.g. for a bound that is not packed columns.
+ */
+pub fn pk_filter_condition(table_info: &TableInfo, filter: &PkFilter) -> Option<String> {
+    let cells = filter.cells?;
+    let num_pks = table_info.pks.len();
+    // The pk is a prefix of a longer bound. Such a pk is less than the bound.
+    let (op, num_cells) = if cells > num_pks {
+        match filter.op {
+            PkOp::Prefix => return Some("0".into()),
+            PkOp::Gt | PkOp::Ge => (PkOp::Gt, num_pks),
+            PkOp::Lt | PkOp::Le => (PkOp::Le, num_pks),
+        }
+    } else {
+        (filter.op, cells)
+    };
+    if num_cells == 0 {
+        return Some(
+            if op.matches(Ordering::Equal) {
+                "1"
+            } else {
+                "0"
+            }
+            .into(),
+        );
+    }
+
+    let columns: Vec<String> = table_info.pks[..num_cells]
+        .iter()
+        .map(|c| format!("pk_tbl.\"{}\"", crate::util::escape_ident(&c.name)))
+        .collect();
+    let bound: Vec<String> = (0..num_cells)
+        .map(|i| {
+            format!(
+                "(SELECT cell FROM crsql_unpack_columns(?{}) LIMIT 1 OFFSET {})",
+                filter.param, i
+            )
+        })
+        .collect();
+    Some(format!(
+        "({}) {} ({})",
+        columns.join(", "),
+        op.sql_op(),
+        bound.join(", ")
+    ))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use alloc::string::ToString;
+    use alloc::vec;
+
+    #[test]
+    fn compares_like_row_values() {
+        let pk = vec![ColumnValue::Text("b".to_string()), ColumnValue::Integer(2)];
+        let bound = |cells: Vec<ColumnValue>| compare_pk(&pk, &cells);
+        assert_eq!(bound(vec![]), Some(Ordering::Equal));
+        assert_eq!(
+            bound(vec![ColumnValue::Text("b".to_string())]),
+            Some(Ordering::Equal)
+        );
+        assert_eq!(
+            bound(vec![
+                ColumnValue::Text("a".to_string()),
+                ColumnValue::Integer(9)
+            ]),
+            Some(Ordering::Greater)
+        );
+        assert_eq!(
+            bound(vec![
+                ColumnValue::Text("b".to_string()),
+                ColumnValue::Float(2.5)
+            ]),
+            Some(Ordering::Less)
+        );
+        assert_eq!(
+            bound(vec![ColumnValue::Integer(100)]),
+            Some(Ordering::Greater)
+        );
+        assert_eq!(
+            bound(vec![
+                ColumnValue::Text("b".to_string()),
+                ColumnValue::Integer(2),
+                ColumnValue::Integer(0)
+            ]),
+            Some(Ordering::Less)
+        );
+        assert_eq!(
+            bound(vec![ColumnValue::Text("b".to_string()), ColumnValue::Null]),
+            None
+        );
+        assert_eq!(
+            bound(vec![ColumnValue::Text("c".to_string()), ColumnValue::Null]),
+            Some(Ordering::Less)
+        );
+    }
+
+    #[test]
+    fn constraint_ops_round_trip() {
+        for op in PK_OPS {
+            assert_eq!(PkOp::from_constraint_op(op.constraint_op() as u8), Some(op));
+        }
+        assert_eq!(
+            PkOp::from_constraint_op(sqlite::INDEX_CONSTRAINT_EQ as u8),
+            None
+        );
+        assert_eq!(PkOp::from_constraint_op(200), None);
+    }
+}
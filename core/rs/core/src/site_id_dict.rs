@@ -0,0 +1,251 @@
+extern crate alloc;
+use alloc::collections::BTreeMap;
+use alloc::vec::Vec;
+use core::ffi::{c_int, c_void};
+
+use alloc::boxed::Box;
+use sqlite::{sqlite3, Connection, Destructor, ResultCode, Stmt};
+use sqlite_nostd as sqlite;
+
+use crate::c::crsql_ExtData;
+
+/**
+ * Per-connection copy of `crsql_site_id` so merges and `crsql_changes` reads can
+ * translate between site ids and their ordinals without querying the table.
+ *
+ * The table is loaded on first use. Anything not found in memory is looked up in
+ * the table and remembered, so rows written by other connections are picked up too.
+ *
+ * Ordinals are assigned as `max(ordinal) + 1` and can be handed out again if the
+ * insert that assigned them is rolled back. Ordinals this connection assigns are
+ * therefore tracked per savepoint and forgotten when the savepoint is rolled back
+ * or the transaction ends. Forgetting an entry is always safe; it is re-read from
+ * the table on its next use.
+ *
+ * A savepoint can also be rolled back without the dictionary seeing it, e.g. by a
+ * `ROLLBACK TO` after `crsql_apply_changeset`, which merges without going through
+ * the crsql_changes vtab. Entries still pending are thus checked against the table
+ * before they are used.
+ */
+pub struct SiteIdDict {
+    loaded: bool,
+    ordinals: BTreeMap<Vec<u8>, i64>,
+    site_ids: BTreeMap<i64, Vec<u8>>,
+    // (ordinal, savepoint) of the ordinals assigned in the current transaction.
+    pending: Vec<(i64, c_int)>,
+    savepoint: c_int,
+}
+
+impl SiteIdDict {
+    fn load(&mut self, db: *mut sqlite3) -> Result<ResultCode, ResultCode> {
+        if self.loaded {
+            return Ok(ResultCode::OK);
+        }
+        let stmt = db.prepare_v2("SELECT ordinal, site_id FROM crsql_site_id")?;
+        while stmt.step()? == ResultCode::ROW {
+            self.remember(stmt.column_int64(0), stmt.column_blob(1)?);
+        }
+        self.loaded = true;
+        Ok(ResultCode::OK)
+    }
+
+    // Replaces whatever either side of the pair was mapped to before.
+    fn remember(&mut self, ordinal: i64, site_id: &[u8]) {
+        if let Some(old_site_id) = self.site_ids.insert(ordinal, site_id.to_vec()) {
+            if old_site_id != site_id {
+                self.ordinals.remove(&old_site_id);
+            }
+        }
+        if let Some(old_ordinal) = self.ordinals.insert(site_id.to_vec(), ordinal) {
+            if old_ordinal != ordinal {
+                self.site_ids.remove(&old_ordinal);
+            }
+        }
+    }
+
+    fn forget(&mut self, ordinal: i64) {
+        if let Some(site_id) = self.site_ids.remove(&ordinal) {
+            self.ordinals.remove(&site_id);
+        }
+    }
+
+    fn is_pending(&self, ordinal: i64) -> bool {
+        self.pending.iter().any(|(o, _)| *o == ordinal)
+    }
+
+    // Forgets an ordinal the table turned out not to have.
+    fn forget_pending(&mut self, ordinal: i64) {
+        self.forget(ordinal);
+        self.pending.retain(|(o, _)| *o != ordinal);
+    }
+
+    /**
+     * The level of the innermost savepoint ordinals are currently assigned under.
+     * Functions that open a savepoint of their own mark it with the next level.
+     */
+    pub fn savepoint_level(&self) -> c_int {
+        self.savepoint
+    }
+
+    pub fn savepoint(&mut self, savepoint: c_int) {
+        self.savepoint = savepoint;
+    }
+
+    pub fn release(&mut self, savepoint: c_int) {
+        self.savepoint = savepoint - 1;
+    }
+
+    pub fn rollback_to(&mut self, savepoint: c_int) {
+        self.forget_since(savepoint);
+        self.savepoint = savepoint;
+    }
+
+    /**
+     * Forgets the ordinals assigned under `savepoint` and the savepoints nested in it.
+     */
+    pub fn forget_since(&mut self, savepoint: c_int) {
+        let (undone, kept): (Vec<_>, Vec<_>) =
+            self.pending.iter().partition(|(_, s)| *s >= savepoint);
+        for (ordinal, _) in undone {
+            self.forget(ordinal);
+        }
+        self.pending = kept;
+    }
+
+    // Called on commit and rollback. A commit that fails leaves the transaction open
+    // so even committed ordinals are re-read rather than trusted.
+    pub fn end_transaction(&mut self) {
+        for (ordinal, _) in core::mem::take(&mut self.pending) {
+            self.forget(ordinal);
+        }
+        self.savepoint = -1;
+    }
+}
+
+pub fn site_id_dict<'a>(ext_data: *mut crsql_ExtData) -> &'a mut SiteIdDict {
+    unsafe { &mut *((*ext_data).siteIdDict as *mut SiteIdDict) }
+}
+
+/**
+ * The ordinal of `site_id` or None if this db has never seen it.
+ */
+pub fn get_site_ordinal(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    site_id: &[u8],
+) -> Result<Option<i64>, ResultCode> {
+    let dict = site_id_dict(ext_data);
+    dict.load(db)?;
+    let cached = dict.ordinals.get(site_id).copied();
+    if let Some(ordinal) = cached {
+        if !dict.is_pending(ordinal) {
+            return Ok(Some(ordinal));
+        }
+    }
+
+    let stmt = unsafe { (*ext_data).pSelectSiteIdOrdinalStmt };
+    stmt.bind_blob(1, site_id, Destructor::STATIC)?;
+    let result = match stmt.step() {
+        Ok(ResultCode::ROW) => Ok(Some(stmt.column_int64(0))),
+        Ok(_) => Ok(None),
+        Err(rc) => Err(rc),
+    };
+    stmt.clear_bindings()?;
+    stmt.reset()?;
+    let ordinal = result?;
+
+    match ordinal {
+        Some(ordinal) => dict.remember(ordinal, site_id),
+        None => {
+            if let Some(cached) = cached {
+                dict.forget_pending(cached);
+            }
+        }
+    }
+    Ok(ordinal)
+}
+
+/**
+ * The ordinal of `site_id`, assigning it one if this db has never seen it.
+ */
+pub fn get_or_create_site_ordinal(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    site_id: &[u8],
+) -> Result<i64, ResultCode> {
+    if let Some(ordinal) = get_site_ordinal(db, ext_data, site_id)? {
+        return Ok(ordinal);
+    }
+
+    let stmt = unsafe { (*ext_data).pSetSiteIdOrdinalStmt };
+    stmt.bind_blob(1, site_id, Destructor::STATIC)?;
+    let result = match stmt.step() {
+        Ok(ResultCode::ROW) => Ok(stmt.column_int64(0)),
+        Ok(_) => Err(ResultCode::ABORT),
+        Err(rc) => Err(rc),
+    };
+    stmt.clear_bindings()?;
+    stmt.reset()?;
+    let ordinal = result?;
+
+    let dict = site_id_dict(ext_data);
+    dict.remember(ordinal, site_id);
+    dict.pending.push((ordinal, dict.savepoint));
+    Ok(ordinal)
+}
+
+/**
+ * The site id that `ordinal` stands for or None if there is no such ordinal.
+ */
+pub fn get_site_id<'a>(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    ordinal: i64,
+) -> Result<Option<&'a [u8]>, ResultCode> {
+    let dict = site_id_dict(ext_data);
+    dict.load(db)?;
+    if !dict.site_ids.contains_key(&ordinal) || dict.is_pending(ordinal) {
+        let stmt = db.prepare_v2("SELECT site_id FROM crsql_site_id WHERE ordinal = ?")?;
+        stmt.bind_int64(1, ordinal)?;
+        if stmt.step()? != ResultCode::ROW {
+            dict.forget_pending(ordinal);
+            return Ok(None);
+        }
+        dict.remember(ordinal, stmt.column_blob(0)?);
+    }
+    Ok(dict
+        .site_ids
+        .get(&ordinal)
+        .map(|site_id| site_id.as_slice()))
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_init_site_id_dict(ext_data: *mut crsql_ExtData) {
+    let dict = SiteIdDict {
+        loaded: false,
+        ordinals: BTreeMap::new(),
+        site_ids: BTreeMap::new(),
+        pending: Vec::new(),
+        savepoint: -1,
+    };
+    unsafe { (*ext_data).siteIdDict = Box::into_raw(Box::new(dict)) as *mut c_void }
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_drop_site_id_dict(ext_data: *mut crsql_ExtData) {
+    unsafe {
+        if !(*ext_data).siteIdDict.is_null() {
+            drop(Box::from_raw((*ext_data).siteIdDict as *mut SiteIdDict));
+            (*ext_data).siteIdDict = core::ptr::null_mut();
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_site_id_dict_end_transaction(ext_data: *mut crsql_ExtData) {
+    unsafe {
+        if !(*ext_data).siteIdDict.is_null() {
+            site_id_dict(ext_data).end_transaction();
+        }
+    }
+}
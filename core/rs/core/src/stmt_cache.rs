@@ -1,9 +1,12 @@
 extern crate alloc;
+use alloc::collections::BTreeMap;
+use alloc::string::String;
 use alloc::vec::Vec;
+use core::ffi::c_void;
 use core::mem::ManuallyDrop;
 
 use alloc::boxed::Box;
-use sqlite::Stmt;
+use sqlite::{ManagedStmt, Stmt};
 use sqlite_nostd as sqlite;
 use sqlite_nostd::ResultCode;
 
@@ -22,6 +25,9 @@ pub extern "C" fn crsql_clear_stmt_cache(ext_data: *mut crsql_ExtData) {
         // TODO: return an error.
         let _ = tbl_info.clear_stmts();
     }
+    if unsafe { !(*ext_data).changesStmtCache.is_null() } {
+        changes_stmt_cache(ext_data).clear();
+    }
 }
 
 pub fn reset_cached_stmt(stmt: *mut sqlite::stmt) -> Result<ResultCode, ResultCode> {
@@ -31,3 +37,102 @@ pub fn reset_cached_stmt(stmt: *mut sqlite::stmt) -> Result<ResultCode, ResultCo
     stmt.clear_bindings()?;
     stmt.reset()
 }
+
+/**
+ * Identifies a prepared `crsql_changes` read statement.
+ * The SQL of such a statement is fully determined by the `idx_str` picked in
+ * best_index and the tables it reads from. `None` stands for all clock tables,
+ * otherwise the names of the tables read are separated by NUL.
+ *
+ * `crsql_changes_rows` keeps the statements it runs here as well, keyed by their
+ * full SQL.
+ */
+pub type ChangesStmtKey = (String, Option<String>);
+
+/**
+ * Per-connection cache of `crsql_changes` read statements so repeated queries
+ * of the same shape are reset and re-bound rather than re-built and re-prepared.
+ *
+ * Statements are removed from the cache while a cursor uses them and put back
+ * once the cursor is done. This way two cursors never share a statement.
+ *
+ * Keys such as the set of tables changed since some db_version are open ended so
+ * the cache holds at most MAX_CACHED_STMTS statements, finalizing the least
+ * recently used one to make room.
+ */
+pub struct ChangesStmtCache {
+    // statements and the tick they were last put back at
+    stmts: BTreeMap<ChangesStmtKey, (ManagedStmt, u64)>,
+    tick: u64,
+    // Bumped on every clear so statements that were checked out before a schema
+    // change are finalized rather than returned to the cache.
+    generation: u64,
+}
+
+pub const MAX_CACHED_STMTS: usize = 64;
+
+impl ChangesStmtCache {
+    pub fn generation(&self) -> u64 {
+        self.generation
+    }
+
+    pub fn take(&mut self, key: &ChangesStmtKey) -> Option<ManagedStmt> {
+        self.stmts.remove(key).map(|(stmt, _)| stmt)
+    }
+
+    pub fn put(
+        &mut self,
+        generation: u64,
+        key: ChangesStmtKey,
+        stmt: ManagedStmt,
+    ) -> Result<ResultCode, ResultCode> {
+        reset_cached_stmt(stmt.stmt)?;
+        if generation != self.generation || self.stmts.contains_key(&key) {
+            return Ok(ResultCode::OK);
+        }
+        if self.stmts.len() >= MAX_CACHED_STMTS {
+            let lru = self
+                .stmts
+                .iter()
+                .min_by_key(|(_, (_, tick))| *tick)
+                .map(|(key, _)| key.clone());
+            if let Some(lru) = lru {
+                self.stmts.remove(&lru);
+            }
+        }
+        self.tick += 1;
+        self.stmts.insert(key, (stmt, self.tick));
+        Ok(ResultCode::OK)
+    }
+
+    pub fn clear(&mut self) {
+        self.stmts.clear();
+        self.generation += 1;
+    }
+}
+
+pub fn changes_stmt_cache<'a>(ext_data: *mut crsql_ExtData) -> &'a mut ChangesStmtCache {
+    unsafe { &mut *((*ext_data).changesStmtCache as *mut ChangesStmtCache) }
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_init_changes_stmt_cache(ext_data: *mut crsql_ExtData) {
+    let cache = ChangesStmtCache {
+        stmts: BTreeMap::new(),
+        tick: 0,
+        generation: 0,
+    };
+    unsafe { (*ext_data).changesStmtCache = Box::into_raw(Box::new(cache)) as *mut c_void }
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_drop_changes_stmt_cache(ext_data: *mut crsql_ExtData) {
+    unsafe {
+        if !(*ext_data).changesStmtCache.is_null() {
+            drop(Box::from_raw(
+                (*ext_data).changesStmtCache as *mut ChangesStmtCache,
+            ));
+            (*ext_data).changesStmtCache = core::ptr::null_mut();
+        }
+    }
+}
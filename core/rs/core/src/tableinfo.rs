@@ -4,19 +4,23 @@ use crate::c::crsql_fetchPragmaSchemaVersion;
 use crate::c::TABLE_INFO_SCHEMA_VERSION;
 use crate::pack_columns::bind_package_to_stmt;
 use crate::pack_columns::ColumnValue;
+use crate::stmt_cache::changes_stmt_cache;
 use crate::stmt_cache::reset_cached_stmt;
 use crate::util::Countable;
 use alloc::boxed::Box;
+use alloc::collections::BTreeMap;
 use alloc::format;
 use alloc::string::String;
 use alloc::vec;
 use alloc::vec::Vec;
+use core::cell::Cell;
 use core::cell::Ref;
 use core::cell::RefCell;
 use core::ffi::c_char;
 use core::ffi::c_int;
 use core::ffi::c_void;
 use core::mem::forget;
+use core::mem::ManuallyDrop;
 use num_traits::ToPrimitive;
 use sqlite::sqlite3;
 use sqlite::value;
@@ -31,6 +35,12 @@ pub struct TableInfo {
     pub tbl_name: String,
     pub pks: Vec<ColumnInfo>,
     pub non_pks: Vec<ColumnInfo>,
+    // The lookaside table stores `crsql_pack_columns(pks...)` in `__crsql_packed_pks`.
+    // See the `packed-pks` config option.
+    pub has_packed_pks: bool,
+    // The lookaside table keeps the causal length of each row in `__crsql_cl`.
+    // See the `lookaside-cl` config option.
+    pub has_lookaside_cl: bool,
 
     // Lookaside --
     // insert returning?
@@ -38,12 +48,14 @@ pub struct TableInfo {
     // insert or ignore returning followed by select?
     // or selecet first?
     select_key_stmt: RefCell<Option<ManagedStmt>>,
+    select_key_via_packed_pks_stmt: RefCell<Option<ManagedStmt>>,
     insert_key_stmt: RefCell<Option<ManagedStmt>>,
     insert_or_ignore_returning_key_stmt: RefCell<Option<ManagedStmt>>,
 
     // For merges --
     set_winner_clock_stmt: RefCell<Option<ManagedStmt>>,
     local_cl_stmt: RefCell<Option<ManagedStmt>>,
+    set_lookaside_cl_stmt: RefCell<Option<ManagedStmt>>,
     col_version_stmt: RefCell<Option<ManagedStmt>>,
     col_site_id_stmt: RefCell<Option<ManagedStmt>>,
     merge_pk_only_insert_stmt: RefCell<Option<ManagedStmt>>,
@@ -63,6 +75,12 @@ pub struct TableInfo {
     mark_locally_created_stmt: RefCell<Option<ManagedStmt>>,
     mark_locally_updated_stmt: RefCell<Option<ManagedStmt>>,
     maybe_mark_locally_reinserted_stmt: RefCell<Option<ManagedStmt>>,
+
+    // For reads --
+    max_db_version_stmt: RefCell<Option<ManagedStmt>>,
+    // (`PRAGMA data_version`, highest db_version in the clock table) once read.
+    // See `max_db_version`.
+    max_db_version: Cell<Option<(c_int, sqlite::int64)>>,
 }
 
 impl TableInfo {
@@ -178,6 +196,35 @@ impl TableInfo {
         }
     }
 
+    /**
+     * Looks up the key of a row by its packed primary key. Only valid when
+     * `has_packed_pks` is set. Returns `None` if the row has no key yet.
+     */
+    pub fn get_key_via_packed_pks(
+        &self,
+        db: *mut sqlite3,
+        packed_pks: &[u8],
+    ) -> Result<Option<sqlite::int64>, ResultCode> {
+        let stmt_ref = self.get_select_key_via_packed_pks_stmt(db)?;
+        let stmt = stmt_ref.as_ref().ok_or(ResultCode::ERROR)?;
+        stmt.bind_blob(1, packed_pks, sqlite::Destructor::STATIC)?;
+        match stmt.step() {
+            Ok(ResultCode::DONE) => {
+                reset_cached_stmt(stmt.stmt)?;
+                Ok(None)
+            }
+            Ok(ResultCode::ROW) => {
+                let ret = stmt.column_int64(0);
+                reset_cached_stmt(stmt.stmt)?;
+                Ok(Some(ret))
+            }
+            Ok(rc) | Err(rc) => {
+                reset_cached_stmt(stmt.stmt)?;
+                Err(rc)
+            }
+        }
+    }
+
     fn create_key(
         &self,
         db: *mut sqlite3,
@@ -241,6 +288,21 @@ impl TableInfo {
         Ok(self.select_key_stmt.try_borrow()?)
     }
 
+    pub fn get_select_key_via_packed_pks_stmt(
+        &self,
+        db: *mut sqlite3,
+    ) -> Result<Ref<Option<ManagedStmt>>, ResultCode> {
+        if self.select_key_via_packed_pks_stmt.try_borrow()?.is_none() {
+            let sql = format!(
+                "SELECT __crsql_key FROM \"{table_name}__crsql_pks\" WHERE __crsql_packed_pks = ?",
+                table_name = crate::util::escape_ident(&self.tbl_name),
+            );
+            let ret = db.prepare_v3(&sql, sqlite::PREPARE_PERSISTENT)?;
+            *self.select_key_via_packed_pks_stmt.try_borrow_mut()? = Some(ret);
+        }
+        Ok(self.select_key_via_packed_pks_stmt.try_borrow()?)
+    }
+
     pub fn get_insert_key_stmt(
         &self,
         db: *mut sqlite3,
@@ -249,8 +311,8 @@ impl TableInfo {
             let sql = format!(
                 "INSERT INTO \"{table_name}__crsql_pks\" ({pk_list}) VALUES ({pk_bindings}) RETURNING __crsql_key",
                 table_name = crate::util::escape_ident(&self.tbl_name),
-                pk_list = crate::util::as_identifier_list(&self.pks, None)?,
-                pk_bindings = crate::util::binding_list(self.pks.len()),
+                pk_list = lookaside_insert_list(&self.pks, self.has_packed_pks)?,
+                pk_bindings = lookaside_binding_list(self.pks.len(), self.has_packed_pks),
             );
             let ret = db.prepare_v3(&sql, sqlite::PREPARE_PERSISTENT)?;
             *self.insert_key_stmt.try_borrow_mut()? = Some(ret);
@@ -270,8 +332,8 @@ impl TableInfo {
             let sql = format!(
                 "INSERT OR IGNORE INTO \"{table_name}__crsql_pks\" ({pk_list}) VALUES ({pk_bindings}) RETURNING __crsql_key",
                 table_name = crate::util::escape_ident(&self.tbl_name),
-                pk_list = crate::util::as_identifier_list(&self.pks, None)?,
-                pk_bindings = crate::util::binding_list(self.pks.len()),
+                pk_list = lookaside_insert_list(&self.pks, self.has_packed_pks)?,
+                pk_bindings = lookaside_binding_list(self.pks.len(), self.has_packed_pks),
             );
             let ret = db.prepare_v3(&sql, sqlite::PREPARE_PERSISTENT)?;
             *self.insert_or_ignore_returning_key_stmt.try_borrow_mut()? = Some(ret);
@@ -309,20 +371,56 @@ impl TableInfo {
     ) -> Result<Ref<Option<ManagedStmt>>, ResultCode> {
         if self.local_cl_stmt.try_borrow()?.is_none() {
             // prepare it
-            let sql = format!(
-              "SELECT COALESCE(
-                (SELECT col_version FROM \"{table_name}__crsql_clock\" WHERE key = ? AND col_name = '{delete_sentinel}'),
-                (SELECT 1 FROM \"{table_name}__crsql_clock\" WHERE key = ?)
-              )",
-              table_name = crate::util::escape_ident(&self.tbl_name),
-              delete_sentinel = crate::c::DELETE_SENTINEL,
-            );
+            let sql = if self.has_lookaside_cl {
+                format!(
+                  "SELECT COALESCE(__crsql_cl, 0) FROM \"{table_name}__crsql_pks\" WHERE __crsql_key = ?",
+                  table_name = crate::util::escape_ident(&self.tbl_name),
+                )
+            } else {
+                format!(
+                  "SELECT COALESCE(
+                    (SELECT col_version FROM \"{table_name}__crsql_clock\" WHERE key = ?1 AND col_name = '{delete_sentinel}'),
+                    (SELECT 1 FROM \"{table_name}__crsql_clock\" WHERE key = ?1)
+                  )",
+                  table_name = crate::util::escape_ident(&self.tbl_name),
+                  delete_sentinel = crate::c::DELETE_SENTINEL,
+                )
+            };
             let ret = db.prepare_v3(&sql, sqlite::PREPARE_PERSISTENT)?;
             *self.local_cl_stmt.try_borrow_mut()? = Some(ret);
         }
         Ok(self.local_cl_stmt.try_borrow()?)
     }
 
+    /**
+     * Brings `__crsql_cl` of the row with lookaside key `key` up to date with its
+     * clock entries. Must follow every write of the row's sentinel and the first
+     * clock write of a row. Does nothing unless the table has `__crsql_cl`.
+     */
+    pub fn set_lookaside_cl(
+        &self,
+        db: *mut sqlite3,
+        key: sqlite::int64,
+    ) -> Result<ResultCode, ResultCode> {
+        if !self.has_lookaside_cl {
+            return Ok(ResultCode::OK);
+        }
+        if self.set_lookaside_cl_stmt.try_borrow()?.is_none() {
+            let sql = format!(
+                "UPDATE \"{table_name}__crsql_pks\" SET __crsql_cl = {cl} WHERE __crsql_key = ?1",
+                table_name = crate::util::escape_ident(&self.tbl_name),
+                cl = crate::bootstrap::lookaside_cl_of(&self.tbl_name, "?1"),
+            );
+            let ret = db.prepare_v3(&sql, sqlite::PREPARE_PERSISTENT)?;
+            *self.set_lookaside_cl_stmt.try_borrow_mut()? = Some(ret);
+        }
+        let stmt_ref = self.set_lookaside_cl_stmt.try_borrow()?;
+        let stmt = stmt_ref.as_ref().ok_or(ResultCode::ERROR)?;
+        let ret = stmt.bind_int64(1, key).and_then(|_| stmt.step());
+        reset_cached_stmt(stmt.stmt)?;
+        ret
+    }
+
     pub fn get_col_version_stmt(
         &self,
         db: *mut sqlite3,
@@ -344,8 +442,8 @@ impl TableInfo {
     ) -> Result<Ref<Option<ManagedStmt>>, ResultCode> {
         if self.col_site_id_stmt.try_borrow()?.is_none() {
             let sql = format!(
-              "SELECT site_id FROM crsql_site_id WHERE ordinal = (SELECT site_id FROM \"{table_name}__crsql_clock\" WHERE key = ? AND col_name = ?)",
-              table_name = crate::util::escape_ident(&self.tbl_name),
+                "SELECT site_id FROM \"{table_name}__crsql_clock\" WHERE key = ? AND col_name = ?",
+                table_name = crate::util::escape_ident(&self.tbl_name),
             );
             let ret = db.prepare_v3(&sql, sqlite::PREPARE_PERSISTENT)?;
             *self.col_site_id_stmt.try_borrow_mut()? = Some(ret);
@@ -577,13 +675,85 @@ impl TableInfo {
         col_info.get_merge_insert_stmt(self, db)
     }
 
-    pub fn get_row_patch_data_stmt(
+    /**
+     * Selects the non-pk columns at positions `cols` of `non_pks` of a row in one lookup.
+     * The pk values are its parameters, in pk order.
+     */
+    pub fn row_data_query(&self, cols: &[usize]) -> Result<String, ResultCode> {
+        let mut col_list = vec![];
+        for i in cols {
+            let col = self.non_pks.get(*i).ok_or(ResultCode::ERROR)?;
+            col_list.push(format!("\"{}\"", crate::util::escape_ident(&col.name)));
+        }
+        Ok(format!(
+            "SELECT {col_list} FROM \"{table_name}\" WHERE {where_list}\0",
+            col_list = col_list.join(","),
+            table_name = crate::util::escape_ident(&self.tbl_name),
+            where_list = crate::util::where_list(&self.pks, None)?
+        ))
+    }
+
+    /**
+     * The highest db_version in the clock table. It is read from the clock table
+     * once and then advanced by local writes and merges via `advance_max_db_version`.
+     * It is read again once another connection has written to the db, which the
+     * caller must have checked for with `fill_db_version_if_needed`.
+     *
+     * It may be higher than the clock table's (e.g., after a rollback) but never lower,
+     * so skipping a table whose mark is at or below a version never skips changes.
+     */
+    pub fn max_db_version(
         &self,
         db: *mut sqlite3,
-        col_name: &str,
-    ) -> Result<Ref<Option<ManagedStmt>>, ResultCode> {
-        let col_info = self.find_non_pk_col(col_name)?;
-        col_info.get_row_patch_data_stmt(self, db)
+        ext_data: *mut crsql_ExtData,
+    ) -> Result<sqlite::int64, ResultCode> {
+        let data_version = unsafe { (*ext_data).pragmaDataVersion };
+        if let Some((seen_data_version, max)) = self.max_db_version.get() {
+            if seen_data_version == data_version {
+                return Ok(max);
+            }
+        }
+
+        if self.max_db_version_stmt.try_borrow()?.is_none() {
+            let sql = format!(
+                "SELECT max(db_version) FROM \"{table_name}__crsql_clock\"",
+                table_name = crate::util::escape_ident(&self.tbl_name),
+            );
+            let ret = db.prepare_v3(&sql, sqlite::PREPARE_PERSISTENT)?;
+            *self.max_db_version_stmt.try_borrow_mut()? = Some(ret);
+        }
+        let stmt_ref = self.max_db_version_stmt.try_borrow()?;
+        let stmt = stmt_ref.as_ref().ok_or(ResultCode::ERROR)?;
+        let result = match stmt.step() {
+            // an empty clock table reads as NULL, i.e. 0
+            Ok(ResultCode::ROW) => Ok(stmt.column_int64(0)),
+            Ok(_) => Ok(0),
+            Err(rc) => Err(rc),
+        };
+        reset_cached_stmt(stmt.stmt)?;
+        let max = result?;
+
+        self.max_db_version.set(Some((data_version, max)));
+        Ok(max)
+    }
+
+    /**
+     * Records that a clock row of this table was written at `db_version`.
+     */
+    pub fn advance_max_db_version(&self, db_version: sqlite::int64) {
+        if let Some((data_version, max)) = self.max_db_version.get() {
+            if db_version > max {
+                self.max_db_version.set(Some((data_version, db_version)));
+            }
+        }
+    }
+
+    /**
+     * Drops the mark so it is read from the clock table on its next use.
+     * For writers that do not advance it, e.g. backfills.
+     */
+    pub fn forget_max_db_version(&self) {
+        self.max_db_version.set(None);
     }
 
     pub fn clear_stmts(&self) -> Result<ResultCode, ResultCode> {
@@ -592,6 +762,8 @@ impl TableInfo {
         stmt.take();
         let mut stmt = self.local_cl_stmt.try_borrow_mut()?;
         stmt.take();
+        let mut stmt = self.set_lookaside_cl_stmt.try_borrow_mut()?;
+        stmt.take();
         let mut stmt = self.col_version_stmt.try_borrow_mut()?;
         stmt.take();
         let mut stmt = self.merge_pk_only_insert_stmt.try_borrow_mut()?;
@@ -618,6 +790,10 @@ impl TableInfo {
         stmt.take();
         let mut stmt = self.select_key_stmt.try_borrow_mut()?;
         stmt.take();
+        let mut stmt = self.select_key_via_packed_pks_stmt.try_borrow_mut()?;
+        stmt.take();
+        let mut stmt = self.max_db_version_stmt.try_borrow_mut()?;
+        stmt.take();
 
         // primary key columns shouldn't have statements? right?
         for col in &self.non_pks {
@@ -650,7 +826,6 @@ pub struct ColumnInfo {
     // have different "seen since" records for the old site_id.
     curr_value_stmt: RefCell<Option<ManagedStmt>>,
     merge_insert_stmt: RefCell<Option<ManagedStmt>>,
-    row_patch_data_stmt: RefCell<Option<ManagedStmt>>,
 }
 
 impl ColumnInfo {
@@ -694,31 +869,11 @@ impl ColumnInfo {
         Ok(self.merge_insert_stmt.try_borrow()?)
     }
 
-    fn get_row_patch_data_stmt(
-        &self,
-        tbl_info: &TableInfo,
-        db: *mut sqlite3,
-    ) -> Result<Ref<Option<ManagedStmt>>, ResultCode> {
-        if self.row_patch_data_stmt.try_borrow()?.is_none() {
-            let sql = format!(
-                "SELECT \"{col_name}\" FROM \"{table_name}\" WHERE {where_list}\0",
-                col_name = crate::util::escape_ident(&self.name),
-                table_name = crate::util::escape_ident(&tbl_info.tbl_name),
-                where_list = crate::util::where_list(&tbl_info.pks, None)?
-            );
-            let ret = db.prepare_v3(&sql, sqlite::PREPARE_PERSISTENT)?;
-            *self.row_patch_data_stmt.try_borrow_mut()? = Some(ret);
-        }
-        Ok(self.row_patch_data_stmt.try_borrow()?)
-    }
-
     pub fn clear_stmts(&self) -> Result<ResultCode, ResultCode> {
         let mut stmt = self.curr_value_stmt.try_borrow_mut()?;
         stmt.take();
         let mut stmt = self.merge_insert_stmt.try_borrow_mut()?;
         stmt.take();
-        let mut stmt = self.row_patch_data_stmt.try_borrow_mut()?;
-        stmt.take();
 
         Ok(ResultCode::OK)
     }
@@ -731,9 +886,47 @@ impl Drop for ColumnInfo {
     }
 }
 
+/**
+ * Index from table name to the table's position in `crsql_ExtData.tableInfos`.
+ *
+ * The position doubles as the table's id. It is stable for as long as the
+ * table infos are, i.e., until the next schema change re-pulls them. Anything that
+ * embeds the id (like cached crsql_changes statements) must be dropped at that point.
+ */
+pub type TableInfoIndex = BTreeMap<String, usize>;
+
+/**
+ * Returns the position (id) of the named table in `crsql_ExtData.tableInfos`.
+ */
+pub fn find_table_info_index(
+    ext_data: *mut crsql_ExtData,
+    tbl_infos: &Vec<TableInfo>,
+    name: &str,
+) -> Option<usize> {
+    let index = unsafe { &*((*ext_data).tableInfoIndex as *const TableInfoIndex) };
+    index.get(name).copied().filter(|i| *i < tbl_infos.len())
+}
+
+fn rebuild_table_info_index(ext_data: *mut crsql_ExtData, tbl_infos: &Vec<TableInfo>) {
+    let index: TableInfoIndex = tbl_infos
+        .iter()
+        .enumerate()
+        .map(|(i, tbl_info)| (tbl_info.tbl_name.clone(), i))
+        .collect();
+    unsafe {
+        if !(*ext_data).tableInfoIndex.is_null() {
+            drop(Box::from_raw(
+                (*ext_data).tableInfoIndex as *mut TableInfoIndex,
+            ));
+        }
+        (*ext_data).tableInfoIndex = Box::into_raw(Box::new(index)) as *mut c_void;
+    }
+}
+
 #[no_mangle]
 pub extern "C" fn crsql_init_table_info_vec(ext_data: *mut crsql_ExtData) {
     let vec: Vec<TableInfo> = vec![];
+    rebuild_table_info_index(ext_data, &vec);
     unsafe { (*ext_data).tableInfos = Box::into_raw(Box::new(vec)) as *mut c_void }
 }
 
@@ -741,6 +934,23 @@ pub extern "C" fn crsql_init_table_info_vec(ext_data: *mut crsql_ExtData) {
 pub extern "C" fn crsql_drop_table_info_vec(ext_data: *mut crsql_ExtData) {
     unsafe {
         drop(Box::from_raw((*ext_data).tableInfos as *mut Vec<TableInfo>));
+        if !(*ext_data).tableInfoIndex.is_null() {
+            drop(Box::from_raw(
+                (*ext_data).tableInfoIndex as *mut TableInfoIndex,
+            ));
+            (*ext_data).tableInfoIndex = core::ptr::null_mut();
+        }
+    }
+}
+
+/**
+ * Forgets the `max_db_version` of every table, e.g. after a backfill wrote clock rows.
+ */
+pub fn forget_max_db_versions(ext_data: *mut crsql_ExtData) {
+    let tbl_infos =
+        unsafe { ManuallyDrop::new(Box::from_raw((*ext_data).tableInfos as *mut Vec<TableInfo>)) };
+    for tbl_info in tbl_infos.iter() {
+        tbl_info.forget_max_db_version();
     }
 }
 
@@ -768,7 +978,10 @@ pub extern "C" fn crsql_ensure_table_infos_are_up_to_date(
         match pull_all_table_infos(db, ext_data, err) {
             Ok(new_table_infos) => {
                 *table_infos = new_table_infos;
+                rebuild_table_info_index(ext_data, &table_infos);
                 forget(table_infos);
+                // cached crsql_changes statements were built against the old set of tables
+                changes_stmt_cache(ext_data).clear();
                 unsafe {
                     (*ext_data).updatedTableInfosThisTx = 1;
                 }
@@ -861,7 +1074,6 @@ pub fn pull_table_info(
                     pk: stmt.column_int(2),
                     curr_value_stmt: RefCell::new(None),
                     merge_insert_stmt: RefCell::new(None),
-                    row_patch_data_stmt: RefCell::new(None),
                 });
             }
 
@@ -880,16 +1092,37 @@ pub fn pull_table_info(
     let (mut pks, non_pks): (Vec<_>, Vec<_>) = column_infos.into_iter().partition(|x| x.pk > 0);
     pks.sort_by_key(|x| x.pk);
 
+    let lookaside_columns =
+        lookaside_has_column(db, table, "__crsql_packed_pks").and_then(|has_packed_pks| {
+            Ok((
+                has_packed_pks,
+                lookaside_has_column(db, table, "__crsql_cl")?,
+            ))
+        });
+    let (has_packed_pks, has_lookaside_cl) = match lookaside_columns {
+        Ok(has) => has,
+        Err(code) => {
+            err.set(&format!(
+                "Failed to inspect lookaside table for crr -- {table}"
+            ));
+            return Err(code);
+        }
+    };
+
     return Ok(TableInfo {
         tbl_name: table.to_string(),
         pks,
         non_pks,
+        has_packed_pks,
+        has_lookaside_cl,
         set_winner_clock_stmt: RefCell::new(None),
         local_cl_stmt: RefCell::new(None),
+        set_lookaside_cl_stmt: RefCell::new(None),
         col_version_stmt: RefCell::new(None),
         col_site_id_stmt: RefCell::new(None),
 
         select_key_stmt: RefCell::new(None),
+        select_key_via_packed_pks_stmt: RefCell::new(None),
         insert_key_stmt: RefCell::new(None),
         insert_or_ignore_returning_key_stmt: RefCell::new(None),
 
@@ -903,9 +1136,59 @@ pub fn pull_table_info(
         mark_locally_created_stmt: RefCell::new(None),
         mark_locally_updated_stmt: RefCell::new(None),
         maybe_mark_locally_reinserted_stmt: RefCell::new(None),
+
+        max_db_version_stmt: RefCell::new(None),
+        max_db_version: Cell::new(None),
     });
 }
 
+/**
+ * Whether the lookaside table of `table` has the optional `column`,
+ * e.g. `__crsql_packed_pks`. The lookaside table may not exist yet,
+ * e.g. while a crr is being created.
+ */
+pub fn lookaside_has_column(
+    db: *mut sqlite::sqlite3,
+    table: &str,
+    column: &str,
+) -> Result<bool, ResultCode> {
+    Ok(db.count(&format!(
+        "SELECT count(*) FROM pragma_table_info('{table}__crsql_pks') WHERE name = '{column}'",
+        table = crate::util::escape_ident_as_value(table),
+    ))? > 0)
+}
+
+/**
+ * Column list for inserts into a lookaside table, with `__crsql_packed_pks`
+ * appended when the table stores packed primary keys.
+ */
+pub fn lookaside_insert_list(
+    pks: &Vec<ColumnInfo>,
+    packed_pks: bool,
+) -> Result<String, ResultCode> {
+    let pk_list = crate::util::as_identifier_list(pks, None)?;
+    if packed_pks {
+        Ok(format!("{pk_list}, __crsql_packed_pks"))
+    } else {
+        Ok(pk_list)
+    }
+}
+
+/**
+ * Bindings matching `lookaside_insert_list`. The packed primary key is computed
+ * from the same bound values so it always agrees with the pk columns.
+ */
+pub fn lookaside_binding_list(num_pks: usize, packed_pks: bool) -> String {
+    if !packed_pks {
+        return crate::util::binding_list(num_pks);
+    }
+    let bindings = (1..=num_pks)
+        .map(|i| format!("?{i}"))
+        .collect::<Vec<_>>()
+        .join(", ");
+    format!("{bindings}, crsql_pack_columns({bindings})")
+}
+
 pub fn is_table_compatible(
     db: *mut sqlite::sqlite3,
     table: &str,
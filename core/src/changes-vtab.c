@@ -17,18 +17,12 @@ int crsql_changes_next(sqlite3_vtab_cursor *cur);
  * The method allocated the crsql_Changes_vtab for use for the duration
  * of the connection.
  */
-static int changesConnect(sqlite3 *db, void *pAux, int argc,
-                          const char *const *argv, sqlite3_vtab **ppVtab,
-                          char **pzErr) {
+static int connectChangesVtab(sqlite3 *db, void *pAux, const char *zSchema,
+                              sqlite3_vtab **ppVtab, char **pzErr) {
   crsql_Changes_vtab *pNew;
   int rc;
 
-  rc = sqlite3_declare_vtab(
-      db,
-      "CREATE TABLE x([table] TEXT NOT NULL, [pk] BLOB NOT NULL, [cid] TEXT "
-      "NOT NULL, [val] ANY, [col_version] INTEGER NOT NULL, [db_version] "
-      "INTEGER NOT NULL, [site_id] BLOB NOT NULL, [cl] INTEGER NOT NULL, [seq] "
-      "INTEGER NOT NULL)");
+  rc = sqlite3_declare_vtab(db, zSchema);
   if (rc != SQLITE_OK) {
     *pzErr = sqlite3_mprintf("Could not define the table");
     return rc;
@@ -54,6 +48,36 @@ static int changesConnect(sqlite3 *db, void *pAux, int argc,
   return rc;
 }
 
+static int changesConnect(sqlite3 *db, void *pAux, int argc,
+                          const char *const *argv, sqlite3_vtab **ppVtab,
+                          char **pzErr) {
+  return connectChangesVtab(
+      db, pAux,
+      "CREATE TABLE x([table] TEXT NOT NULL, [pk] BLOB NOT NULL, [cid] TEXT "
+      "NOT NULL, [val] ANY, [col_version] INTEGER NOT NULL, [db_version] "
+      "INTEGER NOT NULL, [site_id] BLOB NOT NULL, [cl] INTEGER NOT NULL, [seq] "
+      "INTEGER NOT NULL, [max_bytes] INTEGER HIDDEN, [part_count] INTEGER "
+      "HIDDEN, [part_id] INTEGER HIDDEN)",
+      ppVtab, pzErr);
+}
+
+/**
+ * `crsql_changes_rows` has one row per changed row rather than per changed
+ * column. `cids`, `col_versions` and `vals` are packed with
+ * `crsql_pack_columns` and the i-th column's change has `seq + i`.
+ */
+static int changesRowsConnect(sqlite3 *db, void *pAux, int argc,
+                              const char *const *argv, sqlite3_vtab **ppVtab,
+                              char **pzErr) {
+  return connectChangesVtab(
+      db, pAux,
+      "CREATE TABLE x([table] TEXT NOT NULL, [pk] BLOB NOT NULL, [cids] BLOB "
+      "NOT NULL, [col_versions] BLOB NOT NULL, [vals] BLOB NOT NULL, "
+      "[db_version] INTEGER NOT NULL, [site_id] BLOB NOT NULL, [cl] INTEGER "
+      "NOT NULL, [seq] INTEGER NOT NULL)",
+      ppVtab, pzErr);
+}
+
 /**
  * Called when the connection closes to free
  * all resources allocated by `changesConnect`
@@ -83,21 +107,26 @@ static int changesOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor) {
   return SQLITE_OK;
 }
 
-static int changesCrsrFinalize(crsql_Changes_cursor *crsr) {
-  // Assign pointers to null after freeing
-  // since we can get into this twice for the same cursor object.
-  int rc = SQLITE_OK;
-  rc += sqlite3_finalize(crsr->pChangesStmt);
-  crsr->pChangesStmt = 0;
-  if (crsr->pRowStmt != 0) {
-    rc += sqlite3_clear_bindings(crsr->pRowStmt);
-    rc += sqlite3_reset(crsr->pRowStmt);
-  }
-  crsr->pRowStmt = 0;
+int crsql_changes_crsr_finalize(crsql_Changes_cursor *crsr);
+int crsql_changes_rows_crsr_finalize(crsql_ChangesRows_cursor *crsr);
 
-  crsr->dbVersion = MIN_POSSIBLE_DB_VERSION;
+static int changesRowsOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor) {
+  crsql_ChangesRows_cursor *pCur;
+  pCur = sqlite3_malloc(sizeof(*pCur));
+  if (pCur == 0) {
+    return SQLITE_NOMEM;
+  }
+  memset(pCur, 0, sizeof(*pCur));
+  *ppCursor = &pCur->base;
+  pCur->pTab = (crsql_Changes_vtab *)p;
+  return SQLITE_OK;
+}
 
-  return rc;
+static int changesRowsClose(sqlite3_vtab_cursor *cur) {
+  crsql_ChangesRows_cursor *pCur = (crsql_ChangesRows_cursor *)cur;
+  crsql_changes_rows_crsr_finalize(pCur);
+  sqlite3_free(pCur);
+  return SQLITE_OK;
 }
 
 /**
@@ -115,7 +144,7 @@ static int changesCrsrFinalize(crsql_Changes_cursor *crsr) {
  */
 static int changesClose(sqlite3_vtab_cursor *cur) {
   crsql_Changes_cursor *pCur = (crsql_Changes_cursor *)cur;
-  changesCrsrFinalize(pCur);
+  crsql_changes_crsr_finalize(pCur);
   sqlite3_free(pCur);
   return SQLITE_OK;
 }
@@ -135,15 +164,69 @@ int crsql_changes_filter(sqlite3_vtab_cursor *pVtabCursor, int idxNum,
 ** that uses the virtual table.  This routine needs to create
 ** a query plan for each invocation and compute an estimated cost for that
 ** plan.
-** TODO: should we support `where table` filters?
 */
 int crsql_changes_best_index(sqlite3_vtab *tab, sqlite3_index_info *pIdxInfo);
+int crsql_changes_find_function(
+    sqlite3_vtab *pVtab, int nArg, const char *zName,
+    void (**pxFunc)(sqlite3_context *, int, sqlite3_value **), void **ppArg);
+
+/**
+ * The right-hand side of constraint `iCons` if it is known while planning
+ * (e.g. a literal) or null otherwise. Used by crsql_changes_best_index to
+ * estimate how selective a constraint is.
+ */
+sqlite3_value *crsql_changes_rhs_value(sqlite3_index_info *pIdxInfo,
+                                       int iCons) {
+  sqlite3_value *pVal = 0;
+  if (sqlite3_vtab_rhs_value(pIdxInfo, iCons, &pVal) != SQLITE_OK) {
+    return 0;
+  }
+  return pVal;
+}
+
+/**
+ * Asks for the `IN (...)` constraint `iCons` to be handed to xFilter as a single
+ * list rather than running xFilter once per value. Returns whether it will be.
+ */
+int crsql_changes_vtab_in(sqlite3_index_info *pIdxInfo, int iCons) {
+  if (!sqlite3_vtab_in(pIdxInfo, iCons, -1)) {
+    return 0;
+  }
+  return sqlite3_vtab_in(pIdxInfo, iCons, 1);
+}
+
+/**
+ * Iterate the values of a list passed by crsql_changes_vtab_in.
+ * `*ppOut` is null once the list is exhausted.
+ */
+int crsql_changes_vtab_in_first(sqlite3_value *pList, sqlite3_value **ppOut) {
+  int rc = sqlite3_vtab_in_first(pList, ppOut);
+  if (rc == SQLITE_DONE) {
+    *ppOut = 0;
+    return SQLITE_OK;
+  }
+  return rc;
+}
+
+int crsql_changes_vtab_in_next(sqlite3_value *pList, sqlite3_value **ppOut) {
+  int rc = sqlite3_vtab_in_next(pList, ppOut);
+  if (rc == SQLITE_DONE) {
+    *ppOut = 0;
+    return SQLITE_OK;
+  }
+  return rc;
+}
 
 int crsql_changes_update(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv,
                          sqlite3_int64 *pRowid);
 // If xBegin is not defined xCommit is not called.
 int crsql_changes_begin(sqlite3_vtab *pVTab);
 int crsql_changes_commit(sqlite3_vtab *pVTab);
+// Savepoints are tracked so site id ordinals assigned by merges are forgotten
+// when the savepoint that assigned them is rolled back.
+int crsql_changes_savepoint(sqlite3_vtab *pVTab, int iSavepoint);
+int crsql_changes_release(sqlite3_vtab *pVTab, int iSavepoint);
+int crsql_changes_rollback_to(sqlite3_vtab *pVTab, int iSavepoint);
 int crsql_changes_rowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid);
 int crsql_changes_column(
     sqlite3_vtab_cursor *cur, /* The cursor */
@@ -153,7 +236,7 @@ int crsql_changes_column(
 int crsql_changes_eof(sqlite3_vtab_cursor *cur);
 
 sqlite3_module crsql_changesModule = {
-    /* iVersion    */ 0,
+    /* iVersion    */ 2,
     /* xCreate     */ 0,
     /* xConnect    */ changesConnect,
     /* xBestIndex  */ crsql_changes_best_index,
@@ -171,11 +254,56 @@ sqlite3_module crsql_changesModule = {
     /* xSync       */ 0,
     /* xCommit     */ crsql_changes_commit,
     /* xRollback   */ 0,
+    /* xFindMethod */ crsql_changes_find_function,
+    /* xRename     */ 0,
+    /* xSavepoint  */ crsql_changes_savepoint,
+    /* xRelease    */ crsql_changes_release,
+    /* xRollbackTo */ crsql_changes_rollback_to,
+    /* xShadowName */ 0
+#ifdef LIBSQL
+    ,
+    /* xPreparedSql */ 0
+#endif
+};
+
+int crsql_changes_rows_best_index(sqlite3_vtab *tab,
+                                  sqlite3_index_info *pIdxInfo);
+int crsql_changes_rows_filter(sqlite3_vtab_cursor *pVtabCursor, int idxNum,
+                              const char *idxStr, int argc,
+                              sqlite3_value **argv);
+int crsql_changes_rows_next(sqlite3_vtab_cursor *cur);
+int crsql_changes_rows_eof(sqlite3_vtab_cursor *cur);
+int crsql_changes_rows_column(sqlite3_vtab_cursor *cur, sqlite3_context *ctx,
+                              int i);
+int crsql_changes_rows_rowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid);
+int crsql_changes_rows_update(sqlite3_vtab *pVTab, int argc,
+                              sqlite3_value **argv, sqlite3_int64 *pRowid);
+
+// Shares crsql_Changes_vtab and its transaction hooks with crsql_changes.
+sqlite3_module crsql_changesRowsModule = {
+    /* iVersion    */ 2,
+    /* xCreate     */ 0,
+    /* xConnect    */ changesRowsConnect,
+    /* xBestIndex  */ crsql_changes_rows_best_index,
+    /* xDisconnect */ changesDisconnect,
+    /* xDestroy    */ 0,
+    /* xOpen       */ changesRowsOpen,
+    /* xClose      */ changesRowsClose,
+    /* xFilter     */ crsql_changes_rows_filter,
+    /* xNext       */ crsql_changes_rows_next,
+    /* xEof        */ crsql_changes_rows_eof,
+    /* xColumn     */ crsql_changes_rows_column,
+    /* xRowid      */ crsql_changes_rows_rowid,
+    /* xUpdate     */ crsql_changes_rows_update,
+    /* xBegin      */ crsql_changes_begin,
+    /* xSync       */ 0,
+    /* xCommit     */ crsql_changes_commit,
+    /* xRollback   */ 0,
     /* xFindMethod */ 0,
     /* xRename     */ 0,
-    /* xSavepoint  */ 0,
-    /* xRelease    */ 0,
-    /* xRollbackTo */ 0,
+    /* xSavepoint  */ crsql_changes_savepoint,
+    /* xRelease    */ crsql_changes_release,
+    /* xRollbackTo */ crsql_changes_rollback_to,
     /* xShadowName */ 0
 #ifdef LIBSQL
     ,
@@ -47,6 +47,7 @@ SQLITE_EXTENSION_INIT3
 #include "ext-data.h"
 
 extern sqlite3_module crsql_changesModule;
+extern sqlite3_module crsql_changesRowsModule;
 
 /**
  * Data maintained by the virtual table across
@@ -85,7 +86,7 @@ struct crsql_Changes_vtab {
  * from the physical row.
  *
  * Everything allocated here must be constructed in
- * changesOpen and released in changesCrsrFinalize
+ * changesOpen and released in crsql_changes_crsr_finalize
  */
 #define ROW_TYPE_UPDATE 0
 #define ROW_TYPE_DELETE 1
@@ -105,6 +106,31 @@ struct crsql_Changes_cursor {
 
   sqlite3_int64 changesRowid;
   int tblInfoIdx;
+
+  // Owns the statements changes are read from. Changes are streamed by
+  // merging one statement per clock table or from a single union statement.
+  // `pChangesStmt` points at whichever statement holds the current row.
+  void *pClockMerge;
+
+  // Set when the query does not select `val`. The base table lookup that
+  // fills `pRowStmt` is then skipped.
+  int omitVal;
+
+  // `pRowStmt` is the row buffer of `pClockMerge`, which selects the columns
+  // the current run of changes to a row needs so they share one lookup. This
+  // is the position of the current change's column in that statement.
+  int rowValIdx;
+};
+
+typedef struct crsql_ChangesRows_cursor crsql_ChangesRows_cursor;
+struct crsql_ChangesRows_cursor {
+  sqlite3_vtab_cursor base;
+
+  crsql_Changes_vtab *pTab;
+
+  // The changes being packed into rows. Owned by rust, see
+  // `changes_rows_vtab.rs`.
+  void *pRows;
 };
 
 #endif
\ No newline at end of file
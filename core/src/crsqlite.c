@@ -26,6 +26,8 @@ unsigned char __rust_no_alloc_shim_is_unstable;
 int crsql_compact_post_alter(sqlite3 *db, const char *tblName,
                              crsql_ExtData *pExtData, char **errmsg);
 
+void crsql_site_id_dict_end_transaction(crsql_ExtData *pExtData);
+
 static void freeConnectionExtData(void *pUserData) {
   crsql_ExtData *pExtData = (crsql_ExtData *)pUserData;
 
@@ -39,6 +41,10 @@ static int commitHook(void *pUserData) {
   pExtData->pendingDbVersion = -1;
   pExtData->seq = 0;
   pExtData->updatedTableInfosThisTx = 0;
+  // crsql_apply_changeset merges without going through the crsql_changes vtab
+  // so its xCommit may not run.
+  pExtData->rowsImpacted = 0;
+  crsql_site_id_dict_end_transaction(pExtData);
   return SQLITE_OK;
 }
 
@@ -48,6 +54,7 @@ static void rollbackHook(void *pUserData) {
   pExtData->pendingDbVersion = -1;
   pExtData->seq = 0;
   pExtData->updatedTableInfosThisTx = 0;
+  crsql_site_id_dict_end_transaction(pExtData);
 }
 
 #ifdef LIBSQL
@@ -91,6 +98,11 @@ __declspec(dllexport)
                                   pExtData, 0);
   }
 
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_module_v2(db, "crsql_changes_rows",
+                                  &crsql_changesRowsModule, pExtData, 0);
+  }
+
   if (rc == SQLITE_OK) {
 #ifdef LIBSQL
     libsql_close_hook(db, closeHook, pExtData);
@@ -8,6 +8,12 @@
 void crsql_clear_stmt_cache(crsql_ExtData *pExtData);
 void crsql_init_table_info_vec(crsql_ExtData *pExtData);
 void crsql_drop_table_info_vec(crsql_ExtData *pExtData);
+void crsql_init_changes_stmt_cache(crsql_ExtData *pExtData);
+void crsql_drop_changes_stmt_cache(crsql_ExtData *pExtData);
+void crsql_init_site_id_dict(crsql_ExtData *pExtData);
+void crsql_drop_site_id_dict(crsql_ExtData *pExtData);
+void crsql_init_changes_stats(crsql_ExtData *pExtData);
+void crsql_drop_changes_stats(crsql_ExtData *pExtData);
 
 crsql_ExtData *crsql_newExtData(sqlite3 *db, unsigned char *siteIdBuffer) {
   crsql_ExtData *pExtData = sqlite3_malloc(sizeof *pExtData);
@@ -54,7 +60,14 @@ crsql_ExtData *crsql_newExtData(sqlite3 *db, unsigned char *siteIdBuffer) {
   pExtData->tableInfos = 0;
   pExtData->rowsImpacted = 0;
   pExtData->updatedTableInfosThisTx = 0;
+  pExtData->changesStmtCache = 0;
+  pExtData->tableInfoIndex = 0;
+  pExtData->siteIdDict = 0;
+  pExtData->changesStats = 0;
   crsql_init_table_info_vec(pExtData);
+  crsql_init_changes_stmt_cache(pExtData);
+  crsql_init_site_id_dict(pExtData);
+  crsql_init_changes_stats(pExtData);
 
   sqlite3_stmt *pStmt;
 
@@ -111,6 +124,9 @@ void crsql_freeExtData(crsql_ExtData *pExtData) {
   sqlite3_finalize(pExtData->pSelectSiteIdOrdinalStmt);
   sqlite3_finalize(pExtData->pSelectClockTablesStmt);
   crsql_clear_stmt_cache(pExtData);
+  crsql_drop_changes_stmt_cache(pExtData);
+  crsql_drop_site_id_dict(pExtData);
+  crsql_drop_changes_stats(pExtData);
   crsql_drop_table_info_vec(pExtData);
   sqlite3_free(pExtData);
 }
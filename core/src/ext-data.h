@@ -44,6 +44,20 @@ struct crsql_ExtData {
   sqlite3_stmt *pSelectClockTablesStmt;
 
   int mergeEqualValues;
+
+  // prepared crsql_changes read statements, reused across queries.
+  // dropped whenever table infos are re-pulled.
+  void *changesStmtCache;
+
+  // name -> position in `tableInfos`. Rebuilt along with `tableInfos`.
+  void *tableInfoIndex;
+
+  // site_id <-> ordinal of `crsql_site_id`, loaded lazily.
+  // ordinals assigned in the current transaction are forgotten when it ends.
+  void *siteIdDict;
+
+  // per clock table stats used to estimate the cost of crsql_changes queries.
+  void *changesStats;
 };
 
 crsql_ExtData *crsql_newExtData(sqlite3 *db, unsigned char *siteIdBuffer);
@@ -35,6 +35,11 @@ static void textNewExtData() {
   assert(pExtData->pDbVersionStmt == 0);
   // table info allocated to an empty vec
   assert(pExtData->tableInfos != 0);
+  // empty cache of crsql_changes statements
+  assert(pExtData->changesStmtCache != 0);
+  // site id dictionary, loaded on first use
+  assert(pExtData->siteIdDict != 0);
+  assert(pExtData->changesStats != 0);
 
   // data version should have been fetched
   assert(pExtData->pragmaDataVersion != -1);
@@ -0,0 +1,229 @@
+from crsql_correctness import connect, close
+
+columns = "[table], pk, cid, val, col_version, db_version, site_id, cl, seq"
+
+
+def create_schema(c):
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER, c TEXT, d BLOB)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("CREATE TABLE bar (a TEXT NOT NULL, b INTEGER NOT NULL, c, PRIMARY KEY (a, b))")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+
+
+def setup_source():
+    c = connect(":memory:")
+    create_schema(c)
+    for i in range(30):
+        c.execute("INSERT INTO foo VALUES (?, ?, ?, ?)", (i, i - 10, "t" + str(i), bytes([i])))
+        c.execute("INSERT INTO bar VALUES (?, ?, ?)", (str(i % 4), i, i * 1.5))
+        if i % 6 == 0:
+            c.commit()
+    c.execute("UPDATE foo SET b = b * 2 WHERE a % 3 = 0")
+    c.execute("DELETE FROM foo WHERE a % 7 = 0")
+    c.execute("DELETE FROM bar WHERE b > 25")
+    c.execute("INSERT INTO foo VALUES (7, 1, 'back', NULL)")
+    c.commit()
+    return c
+
+
+def setup_target():
+    c = connect(":memory:")
+    create_schema(c)
+    # some conflicting local writes
+    c.execute("INSERT INTO foo VALUES (1, 100, 'local', NULL)")
+    c.execute("INSERT INTO foo VALUES (100, 100, 'local only', NULL)")
+    c.commit()
+    return c
+
+
+def merged_state(c):
+    # local writes are compared by who made them rather than by site id
+    return (c.execute("SELECT * FROM foo ORDER BY a").fetchall(),
+            c.execute("SELECT * FROM bar ORDER BY a, b").fetchall(),
+            c.execute(
+                """SELECT [table], pk, cid, val, col_version,
+                CASE WHEN site_id = crsql_site_id() THEN 'local' ELSE site_id END, cl
+                FROM crsql_changes ORDER BY 1, 2, 3""").fetchall())
+
+
+def apply_via_changes(source, target, since):
+    for change in source.execute(
+            "SELECT {} FROM crsql_changes WHERE db_version > ?".format(columns), (since,)):
+        target.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", change)
+    impacted = target.execute("SELECT crsql_rows_impacted()").fetchone()[0]
+    target.commit()
+    return impacted
+
+
+def test_matches_inserting_into_crsql_changes():
+    source = setup_source()
+    for since in [0, 3, 10]:
+        (expected, actual) = (setup_target(), setup_target())
+        expected_impacted = apply_via_changes(source, expected, since)
+        changeset = source.execute("SELECT crsql_changeset(?)", (since,)).fetchone()[0]
+        impacted = actual.execute("SELECT crsql_apply_changeset(?)", (changeset,)).fetchone()[0]
+        actual.commit()
+        assert (impacted == expected_impacted)
+        assert (merged_state(actual) == merged_state(expected))
+        # and the counter is reset by the commit
+        assert (actual.execute("SELECT crsql_rows_impacted()").fetchone()[0] == 0)
+        # applying again changes nothing
+        assert (actual.execute("SELECT crsql_apply_changeset(?)", (changeset,)).fetchone()[0] == 0)
+        actual.commit()
+        close(expected)
+        close(actual)
+    close(source)
+
+
+def test_rows_impacted_with_and_without_a_transaction():
+    source = setup_source()
+    changeset = source.execute("SELECT crsql_changeset(NULL)").fetchone()[0]
+    expected = setup_target()
+    expected_impacted = apply_via_changes(source, expected, -1)
+    assert (expected_impacted > 0)
+
+    # no open transaction, the apply commits on its own
+    autocommit = setup_target()
+    autocommit.isolation_level = None
+    impacted = autocommit.execute("SELECT crsql_apply_changeset(?)", (changeset,)).fetchone()[0]
+    assert (not autocommit.in_transaction)
+    assert (impacted == expected_impacted)
+    assert (merged_state(autocommit) == merged_state(expected))
+    assert (autocommit.execute("SELECT crsql_rows_impacted()").fetchone()[0] == 0)
+
+    # in a transaction the count is also added to crsql_rows_impacted
+    in_tx = setup_target()
+    in_tx.isolation_level = None
+    in_tx.execute("BEGIN")
+    impacted = in_tx.execute("SELECT crsql_apply_changeset(?)", (changeset,)).fetchone()[0]
+    assert (impacted == expected_impacted)
+    assert (in_tx.execute("SELECT crsql_rows_impacted()").fetchone()[0] == impacted)
+    in_tx.execute("COMMIT")
+    assert (merged_state(in_tx) == merged_state(expected))
+    close(expected)
+    close(autocommit)
+    close(in_tx)
+    close(source)
+
+
+def test_new_sites_after_rolling_back_an_apply():
+    sources = []
+    for i in range(3):
+        c = connect(":memory:")
+        create_schema(c)
+        c.execute("INSERT INTO foo VALUES (?, ?, ?, NULL)", (i, i, "s" + str(i)))
+        c.commit()
+        sources.append(c)
+    changesets = [s.execute("SELECT crsql_changeset(NULL)").fetchone()[0] for s in sources]
+    site_ids = [s.execute("SELECT crsql_site_id()").fetchone()[0] for s in sources]
+
+    target = connect(":memory:")
+    create_schema(target)
+    target.isolation_level = None
+    target.execute("BEGIN")
+    target.execute("SAVEPOINT a")
+    target.execute("SELECT crsql_apply_changeset(?)", (changesets[0],))
+    target.execute("ROLLBACK TO a")
+    # the ordinal the rolled back apply assigned to the first site is handed out again
+    target.execute("SELECT crsql_apply_changeset(?)", (changesets[1],))
+    target.execute("SELECT crsql_apply_changeset(?)", (changesets[2],))
+    target.execute("RELEASE a")
+    target.execute("COMMIT")
+
+    def sites_by_val():
+        return target.execute(
+            "SELECT val, site_id FROM crsql_changes WHERE cid = 'c' ORDER BY val").fetchall()
+
+    assert (sites_by_val() == [("s1", site_ids[1]), ("s2", site_ids[2])])
+
+    target.execute("SELECT crsql_apply_changeset(?)", (changesets[0],))
+    assert (sites_by_val() == [("s0", site_ids[0]), ("s1", site_ids[1]), ("s2", site_ids[2])])
+    assert (target.execute(
+        "SELECT count(DISTINCT ordinal), count(*) FROM crsql_site_id").fetchone() == (4, 4))
+    close(target)
+    for s in sources:
+        close(s)
+
+
+def test_round_trip():
+    source = setup_source()
+    target = setup_target()
+    target.execute("SELECT crsql_apply_changeset(?)",
+                   (source.execute("SELECT crsql_changeset(NULL)").fetchone()[0],))
+    target.commit()
+    source.execute("SELECT crsql_apply_changeset(?)",
+                   (target.execute("SELECT crsql_changeset(NULL)").fetchone()[0],))
+    source.commit()
+    assert (merged_state(source)[:2] == merged_state(target)[:2])
+    close(source)
+    close(target)
+
+
+def test_failures_apply_nothing():
+    source = setup_source()
+    target = setup_target()
+    before = merged_state(target)
+    try:
+        target.execute("SELECT crsql_apply_changeset(X'00')").fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("not a changeset" in str(e))
+
+    # the last change is to a column the target does not have
+    source.execute("SELECT crsql_begin_alter('foo')")
+    source.execute("ALTER TABLE foo ADD COLUMN e")
+    source.execute("SELECT crsql_commit_alter('foo')")
+    source.execute("UPDATE foo SET e = 1 WHERE a = 29")
+    source.commit()
+    changeset = source.execute("SELECT crsql_changeset(NULL)").fetchone()[0]
+    try:
+        target.execute("SELECT crsql_apply_changeset(?)", (changeset,)).fetchone()
+        assert (False)
+    except Exception:
+        pass
+    target.commit()
+    assert (merged_state(target) == before)
+    assert (target.execute("SELECT crsql_rows_impacted()").fetchone()[0] == 0)
+
+    # truncated changesets are rejected and nothing is merged
+    changeset = source.execute("SELECT crsql_changeset(0)").fetchone()[0]
+    try:
+        target.execute("SELECT crsql_apply_changeset(?)", (changeset[:-3],)).fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("malformed changeset" in str(e))
+    assert (merged_state(target) == before)
+    close(source)
+    close(target)
+
+
+def test_lz_codec():
+    source = setup_source()
+    for i in range(30, 2000):
+        source.execute("INSERT INTO foo VALUES (?, ?, ?, ?)", (i, i % 10, "repeated text", None))
+    source.commit()
+    raw = source.execute("SELECT crsql_changeset(NULL, NULL, 'none')").fetchone()[0]
+    lz = source.execute("SELECT crsql_changeset(NULL, NULL, 'lz')").fetchone()[0]
+    assert (lz[:6] == b"CRCS\x01\x01")
+    assert (len(lz) < len(raw) / 2)
+
+    (expected, actual) = (setup_target(), setup_target())
+    expected_impacted = expected.execute(
+        "SELECT crsql_apply_changeset(?)", (raw,)).fetchone()[0]
+    expected.commit()
+    impacted = actual.execute("SELECT crsql_apply_changeset(?)", (lz,)).fetchone()[0]
+    actual.commit()
+    assert (impacted == expected_impacted)
+    assert (merged_state(actual) == merged_state(expected))
+
+    before = merged_state(actual)
+    try:
+        actual.execute("SELECT crsql_apply_changeset(?)", (lz[:-3],)).fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("malformed changeset" in str(e))
+    assert (merged_state(actual) == before)
+    close(expected)
+    close(actual)
+    close(source)
@@ -0,0 +1,58 @@
+from crsql_correctness import connect, close
+
+
+def setup_db(num_rows=500):
+    c = connect(":memory:")
+    c.execute("CREATE TABLE item (id INTEGER PRIMARY KEY NOT NULL, x INTEGER, y INTEGER)")
+    c.execute("SELECT crsql_as_crr('item')")
+    c.commit()
+    for i in range(num_rows):
+        c.execute("INSERT INTO item VALUES (?, ?, ?)", (i, i, i))
+        c.commit()
+
+    c.execute("CREATE TABLE peer (name TEXT PRIMARY KEY, version INTEGER)")
+    c.execute("INSERT INTO peer VALUES ('a', ?), ('b', ?)",
+              (num_rows - 2, num_rows - 1))
+    c.commit()
+    return c
+
+
+def plan(c, query):
+    return [row[3] for row in c.execute("EXPLAIN QUERY PLAN " + query).fetchall()]
+
+
+join_query = "SELECT peer.name, c.pk, c.cid FROM peer JOIN crsql_changes AS c ON c.db_version > peer.version"
+
+
+def test_join_seeks_db_version():
+    c = setup_db()
+    steps = plan(c, join_query)
+    # the small table drives the join and crsql_changes is probed by db_version
+    assert (steps[0].startswith("SCAN peer"))
+    assert ("VIRTUAL TABLE" in steps[1] and "db_vrsn > ?" in steps[1])
+    assert (len(c.execute(join_query).fetchall()) == 4 + 2)
+    close(c)
+
+
+def test_join_seeks_db_version_with_stat1():
+    c = setup_db()
+    c.execute("ANALYZE")
+    c.commit()
+    steps = plan(c, join_query)
+    assert (steps[0].startswith("SCAN peer"))
+    assert ("VIRTUAL TABLE" in steps[1] and "db_vrsn > ?" in steps[1])
+    close(c)
+
+
+def test_estimates_follow_writes():
+    c = setup_db(num_rows=1)
+    # plans and results stay correct as stats are refreshed by later writes
+    for i in range(1, 200):
+        c.execute("INSERT INTO item VALUES (?, ?, ?)", (i, i, i))
+        c.commit()
+        if i % 50 == 0:
+            steps = plan(c, join_query)
+            assert ("db_vrsn > ?" in steps[1])
+    assert (c.execute(
+        "SELECT count(*) FROM crsql_changes WHERE db_version > 150").fetchone()[0] == 50 * 2)
+    close(c)
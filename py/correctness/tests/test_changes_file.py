@@ -0,0 +1,174 @@
+import pytest
+from crsql_correctness import connect, close
+
+
+def create_schema(c):
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER, c TEXT, d BLOB)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+
+
+def setup_source():
+    c = connect(":memory:")
+    create_schema(c)
+    for i in range(3000):
+        c.execute("INSERT INTO foo VALUES (?, ?, ?, ?)",
+                  (i, i % 10, "text " + str(i), bytes([i % 256])))
+        if i % 500 == 0:
+            c.commit()
+    c.execute("DELETE FROM foo WHERE a % 7 = 0")
+    c.commit()
+    return c
+
+
+def setup_target():
+    c = connect(":memory:")
+    create_schema(c)
+    c.execute("INSERT INTO foo VALUES (1, 100, 'local', NULL)")
+    c.commit()
+    return c
+
+
+def merged_state(c):
+    return (c.execute("SELECT * FROM foo ORDER BY a").fetchall(),
+            c.execute(
+                """SELECT [table], pk, cid, val, col_version,
+                CASE WHEN site_id = crsql_site_id() THEN 'local' ELSE site_id END, cl
+                FROM crsql_changes ORDER BY 1, 2, 3""").fetchall())
+
+
+def has_changes_file():
+    c = connect(":memory:")
+    ret = c.execute(
+        "SELECT count(*) FROM pragma_function_list WHERE name = 'crsql_import_changes_file'"
+    ).fetchone()[0] == 1
+    close(c)
+    return ret
+
+
+# only built with the `std` feature on linux, see `std_feature` in core/Makefile
+pytestmark = pytest.mark.skipif(not has_changes_file(), reason="built without the std feature")
+
+
+@pytest.mark.parametrize("codec", [None, "none", "lz"])
+def test_export_import_matches_changeset(tmp_path, codec):
+    source = setup_source()
+    path = str(tmp_path / "changes.crcs")
+    written = source.execute(
+        "SELECT crsql_export_changes_file(?, ?, ?)", (path, 0, codec)).fetchone()[0]
+    with open(path, "rb") as f:
+        data = f.read()
+    assert (written == len(data))
+    assert (data == source.execute(
+        "SELECT crsql_changeset(0, NULL, ?)", (codec,)).fetchone()[0])
+
+    (expected, actual) = (setup_target(), setup_target())
+    expected_impacted = expected.execute(
+        "SELECT crsql_apply_changeset(?)", (data,)).fetchone()[0]
+    expected.commit()
+    impacted = actual.execute("SELECT crsql_import_changes_file(?)", (path,)).fetchone()[0]
+    actual.commit()
+    assert (impacted == expected_impacted)
+    assert (merged_state(actual) == merged_state(expected))
+    close(expected)
+    close(actual)
+    close(source)
+
+
+def test_bad_files(tmp_path):
+    target = setup_target()
+    before = merged_state(target)
+    try:
+        target.execute("SELECT crsql_import_changes_file(?)",
+                       (str(tmp_path / "missing"),)).fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("could not map the file" in str(e))
+
+    empty = tmp_path / "empty"
+    empty.write_bytes(b"")
+    try:
+        target.execute("SELECT crsql_import_changes_file(?)", (str(empty),)).fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("not a changeset" in str(e))
+
+    source = setup_source()
+    path = str(tmp_path / "truncated")
+    source.execute("SELECT crsql_export_changes_file(?, NULL)", (path,)).fetchone()
+    with open(path, "r+b") as f:
+        f.truncate(len(f.read()) - 3)
+    try:
+        target.execute("SELECT crsql_import_changes_file(?)", (path,)).fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("malformed changeset" in str(e))
+    target.commit()
+    assert (merged_state(target) == before)
+    close(source)
+    close(target)
+
+
+def test_import_commits_in_batches(tmp_path):
+    # more changes than are merged between commits
+    source = connect(":memory:")
+    create_schema(source)
+    source.executemany("INSERT INTO foo VALUES (?, ?, ?, ?)",
+                       ((i, i, "t", None) for i in range(25000)))
+    source.commit()
+    num_changes = source.execute("SELECT count(*) FROM crsql_changes").fetchone()[0]
+    assert (num_changes > 64 * 1024)
+    path = str(tmp_path / "changes.crcs")
+    source.execute("SELECT crsql_export_changes_file(?, NULL)", (path,)).fetchone()
+
+    with open(path, "rb") as f:
+        changeset = f.read()
+    expected = connect(":memory:")
+    create_schema(expected)
+    expected.isolation_level = None
+    expected.execute("BEGIN")
+    expected_impacted = expected.execute(
+        "SELECT crsql_apply_changeset(?)", (changeset,)).fetchone()[0]
+    expected.execute("COMMIT")
+    assert (expected_impacted > 0)
+
+    # no open transaction, the import commits as it goes and counts every batch
+    target = connect(":memory:")
+    create_schema(target)
+    target.isolation_level = None
+    impacted = target.execute("SELECT crsql_import_changes_file(?)", (path,)).fetchone()[0]
+    assert (impacted == expected_impacted)
+    assert (not target.in_transaction)
+    assert (merged_state(target) == merged_state(expected))
+    close(expected)
+    assert (target.execute("SELECT count(*) FROM foo").fetchone()[0] == 25000)
+    close(target)
+
+    with open(path, "r+b") as f:
+        f.truncate(len(f.read()) - 3)
+    # batches committed before the failure stay merged
+    partial = connect(":memory:")
+    create_schema(partial)
+    partial.isolation_level = None
+    try:
+        partial.execute("SELECT crsql_import_changes_file(?)", (path,)).fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("malformed changeset" in str(e))
+    assert (0 < partial.execute("SELECT count(*) FROM foo").fetchone()[0] < 25000)
+    close(partial)
+
+    # in a transaction nothing is merged
+    in_tx = connect(":memory:")
+    create_schema(in_tx)
+    in_tx.isolation_level = None
+    in_tx.execute("BEGIN")
+    try:
+        in_tx.execute("SELECT crsql_import_changes_file(?)", (path,)).fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("malformed changeset" in str(e))
+    in_tx.execute("COMMIT")
+    assert (in_tx.execute("SELECT count(*) FROM foo").fetchone()[0] == 0)
+    close(in_tx)
+    close(source)
@@ -0,0 +1,97 @@
+from crsql_correctness import connect, close
+
+columns = "[table], pk, cid, val, col_version, db_version, site_id, seq"
+
+site_a = bytes.fromhex("1dc8d6bb7f8941088327d9439a7927a4")
+site_b = bytes.fromhex("2dc8d6bb7f8941088327d9439a7927a4")
+unknown_site = bytes.fromhex("ffc8d6bb7f8941088327d9439a7927a4")
+
+
+def setup_db():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER, c TEXT)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("CREATE TABLE bar (a TEXT PRIMARY KEY NOT NULL, b INTEGER)")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.execute("CREATE TABLE baz (a INTEGER PRIMARY KEY NOT NULL, c TEXT)")
+    c.execute("SELECT crsql_as_crr('baz')")
+    c.commit()
+    for i in range(10):
+        c.execute("INSERT INTO foo VALUES (?, ?, ?)", (i, i, str(i)))
+        c.execute("INSERT INTO bar VALUES (?, ?)", (str(i), i))
+        c.execute("INSERT INTO baz VALUES (?, ?)", (i, str(i)))
+        c.commit()
+    # changes from two other sites
+    for (i, site) in enumerate([site_a, site_b]):
+        pk = bytes([0x01, 0x09, 100 + i])
+        c.execute("INSERT INTO crsql_changes VALUES ('foo', ?, 'b', ?, 1, 1, ?, 1, 0)",
+                  (pk, i, site))
+        c.execute("INSERT INTO crsql_changes VALUES ('baz', ?, 'c', ?, 1, 1, ?, 1, 0)",
+                  (pk, str(i), site))
+        c.commit()
+    return c
+
+
+def select(c, where, params=()):
+    return sorted(c.execute(
+        "SELECT {} FROM crsql_changes WHERE {}".format(columns, where), params).fetchall())
+
+
+def test_site_id_in():
+    c = setup_db()
+    everything = select(c, "1")
+    local_site = c.execute("SELECT crsql_site_id()").fetchone()[0]
+    for sites in [[site_a], [site_a, site_b], [site_b, unknown_site], [unknown_site],
+                  [local_site, site_a], [site_a, site_a]]:
+        expected = sorted(row for row in everything if row[6] in sites)
+        placeholders = ", ".join("?" for _ in sites)
+        assert (select(c, "site_id IN ({})".format(placeholders), sites) == expected)
+        # with the other IN lists
+        expected = [row for row in expected if row[0] == 'foo']
+        assert (select(c, "site_id IN ({}) AND [table] IN ('foo', 'nope')".format(
+            placeholders), sites) == expected)
+    assert (select(c, "site_id IN (SELECT site_id FROM crsql_site_id WHERE ordinal = 1)")
+            == sorted(row for row in everything if row[6] == site_a))
+    assert (select(c, "site_id IN (SELECT site_id FROM crsql_site_id WHERE 0)") == [])
+    close(c)
+
+
+def test_cid_in():
+    c = setup_db()
+    everything = select(c, "1")
+    for cids in [["b"], ["b", "c"], ["c", "nope"], ["nope"], ["-1", "b"]]:
+        expected = sorted(row for row in everything if row[2] in cids)
+        placeholders = ", ".join("?" for _ in cids)
+        assert (select(c, "cid IN ({})".format(placeholders), cids) == expected)
+        # and alongside a db_version bound
+        expected = [row for row in expected if row[5] > 4]
+        assert (select(c, "cid IN ({}) AND db_version > 4".format(placeholders), cids)
+                == expected)
+    close(c)
+
+
+def test_table_in():
+    c = setup_db()
+    everything = select(c, "1")
+    for tables in [["foo"], ["foo", "baz"], ["bar", "nope"], ["nope"], ["foo", "foo"],
+                   ["foo", "bar", "baz"]]:
+        expected = sorted(row for row in everything if row[0] in tables)
+        placeholders = ", ".join("?" for _ in tables)
+        assert (select(c, "[table] IN ({})".format(placeholders), tables) == expected)
+        # merged rather than unioned
+        ordered = c.execute(
+            "SELECT {} FROM crsql_changes WHERE [table] IN ({}) ORDER BY db_version, seq".format(
+                columns, placeholders), tables).fetchall()
+        assert (sorted(ordered) == expected)
+        assert ([(row[5], row[7]) for row in ordered] ==
+                sorted((row[5], row[7]) for row in ordered))
+    close(c)
+
+
+def test_in_lists_of_different_lengths_share_no_statement():
+    c = setup_db()
+    for cids in [["b"], ["b", "c"], ["b"], ["c"], ["b", "c", "-1"]]:
+        placeholders = ", ".join("?" for _ in cids)
+        for row in select(c, "cid IN ({})".format(placeholders), cids):
+            assert (row[2] in cids)
+    close(c)
@@ -0,0 +1,82 @@
+from crsql_correctness import connect, close
+
+columns = "[table], pk, cid, val, col_version, db_version, seq"
+
+
+def setup_db():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER, c TEXT)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("CREATE TABLE bar (a TEXT PRIMARY KEY NOT NULL, b INTEGER)")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    # a few large versions so pages end in the middle of one
+    for v in range(5):
+        for i in range(20):
+            c.execute("INSERT INTO foo VALUES (?, ?, ?)",
+                      (v * 100 + i, i, str(i)))
+            c.execute("INSERT INTO bar VALUES (?, ?)", (str(v * 100 + i), i))
+        c.commit()
+    c.execute("UPDATE foo SET b = b + 1 WHERE a % 3 = 0")
+    c.execute("DELETE FROM bar WHERE b % 4 = 0")
+    c.commit()
+    return c
+
+
+def test_keyset_pagination():
+    c = setup_db()
+    everything = c.execute(
+        "SELECT {} FROM crsql_changes ORDER BY db_version, seq".format(columns)).fetchall()
+
+    for page_size in [1, 7, 50]:
+        pages = []
+        (db_version, seq) = (0, -1)
+        while True:
+            page = c.execute(
+                "SELECT {} FROM crsql_changes WHERE (db_version, seq) > (?, ?) ORDER BY db_version, seq LIMIT ?".format(columns),
+                (db_version, seq, page_size)).fetchall()
+            if len(page) == 0:
+                break
+            pages += page
+            (db_version, seq) = (page[-1][5], page[-1][6])
+        assert (pages == everything)
+    close(c)
+
+
+def test_rowid_seeks():
+    c = setup_db()
+    rows = c.execute("SELECT rowid, {} FROM crsql_changes".format(columns)).fetchall()
+    rowids = sorted(set(row[0] for row in rows))
+    assert (len(rowids) > 1)
+
+    for rowid in rowids[::7] + [rowids[-1], rowids[0] - 1, rowids[-1] + 1]:
+        for (op, predicate) in [("=", lambda x: x == rowid),
+                                (">", lambda x: x > rowid),
+                                (">=", lambda x: x >= rowid),
+                                ("<", lambda x: x < rowid),
+                                ("<=", lambda x: x <= rowid)]:
+            expected = sorted(row for row in rows if predicate(row[0]))
+            actual = sorted(c.execute(
+                "SELECT rowid, {} FROM crsql_changes WHERE rowid {} ?".format(columns, op), (rowid,)).fetchall())
+            assert (actual == expected)
+    close(c)
+
+
+def test_rowid_pagination():
+    c = setup_db()
+    rows = sorted(c.execute("SELECT rowid, {} FROM crsql_changes".format(columns)).fetchall())
+    pages = []
+    last = -1
+    while True:
+        page = c.execute(
+            "SELECT rowid, {} FROM crsql_changes WHERE rowid > ? ORDER BY rowid, db_version, seq LIMIT 13".format(columns), (last,)).fetchall()
+        if len(page) == 0:
+            break
+        # a page ends on a whole row so the next one can start after it
+        last_rowid = page[-1][0]
+        rest = c.execute(
+            "SELECT rowid, {} FROM crsql_changes WHERE rowid = ? ORDER BY db_version, seq".format(columns), (last_rowid,)).fetchall()
+        pages += [row for row in page if row[0] != last_rowid] + rest
+        last = last_rowid
+    assert (sorted(pages) == rows)
+    close(c)
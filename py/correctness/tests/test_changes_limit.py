@@ -0,0 +1,62 @@
+from crsql_correctness import connect, close
+
+columns = "[table], pk, cid, val, col_version, db_version, seq"
+
+
+def setup_db():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER, c TEXT)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("CREATE TABLE bar (a TEXT PRIMARY KEY NOT NULL, b INTEGER)")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    for v in range(5):
+        for i in range(10):
+            c.execute("INSERT INTO foo VALUES (?, ?, ?)",
+                      (v * 100 + i, i, str(i)))
+            c.execute("INSERT INTO bar VALUES (?, ?)", (str(v * 100 + i), i))
+        c.commit()
+    c.execute("UPDATE foo SET b = b + 1 WHERE a % 3 = 0")
+    c.commit()
+    return c
+
+
+def check_pages(c, query, params=()):
+    everything = c.execute(query, params).fetchall()
+    assert (len(everything) > 0)
+    for (limit, offset) in [(0, 0), (1, 0), (7, 0), (7, 3), (50, 20), (1000, 0),
+                            (-1, 5), (5, -1), (5, len(everything) - 2),
+                            (5, len(everything) + 10)]:
+        start = max(offset, 0)
+        expected = everything[start:] if limit < 0 else everything[start:start + limit]
+        assert (c.execute(query + " LIMIT ? OFFSET ?", params + (limit, offset)).fetchall()
+                == expected)
+        if start == 0:
+            assert (c.execute(query + " LIMIT ?", params + (limit,)).fetchall()
+                    == expected)
+
+
+def test_limit_offset_in_order():
+    c = setup_db()
+    check_pages(c, "SELECT {} FROM crsql_changes ORDER BY db_version, seq".format(columns))
+    check_pages(c, "SELECT {} FROM crsql_changes WHERE db_version > ? ORDER BY db_version, seq".format(
+        columns), (2,))
+    check_pages(c, "SELECT {} FROM crsql_changes WHERE [table] = 'foo' ORDER BY db_version, seq".format(
+        columns))
+    close(c)
+
+
+def test_limit_offset_with_sort():
+    c = setup_db()
+    check_pages(c, "SELECT {} FROM crsql_changes ORDER BY db_version DESC, seq DESC".format(columns))
+    check_pages(c, "SELECT {} FROM crsql_changes WHERE cid != 'c' ORDER BY pk, cid, [table]".format(columns))
+    close(c)
+
+
+def test_limit_with_unconsumed_constraints():
+    c = setup_db()
+    # `val` and `pk` are filtered by SQLite so the limit must be applied after them
+    check_pages(c, "SELECT {} FROM crsql_changes WHERE val = 3 ORDER BY db_version, seq".format(columns))
+    check_pages(c, "SELECT {} FROM crsql_changes WHERE cid LIKE 'b%' ORDER BY db_version, seq".format(columns))
+    check_pages(c, "SELECT {} FROM crsql_changes WHERE val > 2 ORDER BY seq, db_version".format(columns))
+    close(c)
@@ -0,0 +1,99 @@
+from crsql_correctness import connect, close
+
+columns = "[table], pk, cid, val, col_version, db_version, site_id, cl, seq"
+
+
+def setup_db():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b BLOB, c TEXT)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("CREATE TABLE bar (a TEXT PRIMARY KEY NOT NULL, b BLOB)")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    for v in range(10):
+        # transactions of varying size, some with a large value
+        for i in range(v % 3 + 1):
+            c.execute("INSERT INTO foo VALUES (?, ?, ?)",
+                      (v * 100 + i, b"x" * (1000 * (v % 4)), str(i)))
+        c.execute("INSERT INTO bar VALUES (?, ?)", (str(v), b"y" * 10))
+        c.commit()
+    return c
+
+
+def change_bytes(row):
+    (pk, val) = (row[1], row[3])
+    if val is None:
+        return len(pk)
+    if isinstance(val, (bytes, str)):
+        return len(pk) + len(val)
+    return len(pk) + 8
+
+
+def test_no_budget():
+    c = setup_db()
+    everything = c.execute(
+        "SELECT {} FROM crsql_changes ORDER BY db_version, seq".format(columns)).fetchall()
+    assert (c.execute("SELECT {} FROM crsql_changes WHERE max_bytes = ? ORDER BY db_version, seq".format(
+        columns), (None,)).fetchall() == everything)
+    assert (c.execute("SELECT {} FROM crsql_changes WHERE max_bytes = -1 ORDER BY db_version, seq".format(
+        columns)).fetchall() == everything)
+    assert (c.execute("SELECT {} FROM crsql_changes WHERE max_bytes = 100000000".format(
+        columns)).fetchall() == everything)
+    close(c)
+
+
+def test_batches_end_on_db_version_boundaries():
+    c = setup_db()
+    everything = c.execute(
+        "SELECT {} FROM crsql_changes ORDER BY db_version, seq".format(columns)).fetchall()
+    versions = sorted(set(row[5] for row in everything))
+
+    for max_bytes in [0, 1, 500, 2000, 5000]:
+        batches = []
+        since = 0
+        while True:
+            batch = c.execute(
+                "SELECT {} FROM crsql_changes WHERE db_version > ? AND max_bytes = ?".format(columns),
+                (since, max_bytes)).fetchall()
+            if len(batch) == 0:
+                break
+            batch_versions = set(row[5] for row in batch)
+            # only whole db_versions
+            for v in batch_versions:
+                assert (len([r for r in batch if r[5] == v]) ==
+                        len([r for r in everything if r[5] == v]))
+            # the batch ended at the first db_version that would not fit
+            last = max(batch_versions)
+            first_of_last = [r for r in batch if r[5] == last][0]
+            size = sum(change_bytes(row) for row in batch
+                       if row[5] != last or row is first_of_last)
+            assert (size <= max_bytes or len(batch_versions) == 1)
+            if last != versions[-1]:
+                nxt = [r for r in everything if r[5] > last][0]
+                assert (sum(change_bytes(row) for row in batch) + change_bytes(nxt) > max_bytes)
+            batches.append(batch)
+            since = max(batch_versions)
+        assert ([row for batch in batches for row in batch] == everything)
+        if max_bytes <= 1:
+            assert (len(batches) == len(versions))
+    close(c)
+
+
+def test_budget_counts_only_selected_values():
+    c = setup_db()
+    with_vals = c.execute(
+        "SELECT db_version FROM crsql_changes WHERE max_bytes = 3000 AND val IS NOT 1").fetchall()
+    without_vals = c.execute(
+        "SELECT db_version FROM crsql_changes WHERE max_bytes = 3000").fetchall()
+    assert (len(without_vals) > len(with_vals))
+    close(c)
+
+
+def test_max_bytes_column():
+    c = setup_db()
+    assert (c.execute("SELECT DISTINCT max_bytes FROM crsql_changes WHERE max_bytes = 100000").fetchall()
+            == [(100000,)])
+    assert (c.execute("SELECT DISTINCT max_bytes FROM crsql_changes").fetchall() == [(None,)])
+    # hidden from `SELECT *` and inserts
+    assert (len(c.execute("SELECT * FROM crsql_changes").description) == 9)
+    close(c)
@@ -0,0 +1,138 @@
+from crsql_correctness import connect, close
+
+
+def setup_db():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE a (id PRIMARY KEY NOT NULL, x)")
+    c.execute("CREATE TABLE b (id PRIMARY KEY NOT NULL, x, y)")
+    c.execute("CREATE TABLE c (id PRIMARY KEY NOT NULL)")
+    c.execute("SELECT crsql_as_crr('a')")
+    c.execute("SELECT crsql_as_crr('b')")
+    c.execute("SELECT crsql_as_crr('c')")
+    c.commit()
+
+    # interleave writes across tables within and between transactions
+    for i in range(10):
+        c.execute("INSERT INTO b VALUES (?, ?, ?)", (i, i, i))
+        c.execute("INSERT INTO a VALUES (?, ?)", (i, i))
+        if i % 3 == 0:
+            c.execute("INSERT INTO c VALUES (?)", (i,))
+        c.commit()
+    for i in range(0, 10, 2):
+        c.execute("UPDATE a SET x = x + 1 WHERE id = ?", (i,))
+        c.execute("DELETE FROM c WHERE id = ?", (i,))
+        c.execute("UPDATE b SET y = 0 WHERE id = ?", (i,))
+        c.commit()
+    return c
+
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, site_id, cl, seq FROM crsql_changes"
+
+
+def test_changes_are_returned_in_version_order():
+    c = setup_db()
+    changes = c.execute(changes_query).fetchall()
+    assert (len(changes) > 0)
+    assert (changes == sorted(changes, key=lambda row: (row[5], row[8])))
+    assert (c.execute(changes_query + " ORDER BY db_version, seq ASC").fetchall() == changes)
+    assert (c.execute(changes_query + " ORDER BY db_version").fetchall() == changes)
+    close(c)
+
+
+def test_merge_matches_sorted_union():
+    c = setup_db()
+    changes = c.execute(changes_query + " WHERE db_version > 3").fetchall()
+    # A descending order is not served by the merge and goes through a sort of the union
+    reversed_changes = c.execute(
+        changes_query + " WHERE db_version > 3 ORDER BY db_version DESC, seq DESC").fetchall()
+    assert (changes == list(reversed(reversed_changes)))
+    close(c)
+
+
+def test_merge_with_table_filter():
+    c = setup_db()
+    changes = c.execute(changes_query).fetchall()
+    for tbl in ['a', 'b', 'c']:
+        assert (c.execute(changes_query + " WHERE [table] = ?", (tbl,)).fetchall() ==
+                list(filter(lambda row: row[0] == tbl, changes)))
+    close(c)
+
+
+def test_vals_of_many_changed_columns_in_a_row():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE w (id PRIMARY KEY NOT NULL, a, b, c, d)")
+    c.execute("CREATE TABLE n (id PRIMARY KEY NOT NULL, a)")
+    c.execute("SELECT crsql_as_crr('w')")
+    c.execute("SELECT crsql_as_crr('n')")
+    c.commit()
+    c.execute("INSERT INTO w VALUES (1, 'a1', 'b1', 'c1', 'd1')")
+    c.execute("INSERT INTO n VALUES (1, 'n1')")
+    c.execute("INSERT INTO w VALUES (2, 'a2', 'b2', 'c2', 'd2')")
+    c.commit()
+    c.execute("UPDATE w SET c = 'c1x', a = 'a1x' WHERE id = 1")
+    c.execute("DELETE FROM w WHERE id = 2")
+    c.commit()
+
+    changes = c.execute("SELECT [table], cid, val, db_version FROM crsql_changes").fetchall()
+    assert (changes == [
+        ('w', 'b', 'b1', 1),
+        ('w', 'd', 'd1', 1),
+        ('n', 'a', 'n1', 1),
+        ('w', 'a', 'a1x', 2),
+        ('w', 'c', 'c1x', 2),
+        ('w', '-1', None, 2)
+    ])
+    close(c)
+
+
+
+def test_vals_when_runs_change_different_columns():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE w (id PRIMARY KEY NOT NULL, a, b, c)")
+    c.execute("SELECT crsql_as_crr('w')")
+    c.commit()
+    c.execute("INSERT INTO w VALUES (1, 'a1', 'b1', 'c1')")
+    c.execute("INSERT INTO w VALUES (2, 'a2', 'b2', 'c2')")
+    c.commit()
+    c.execute("UPDATE w SET a = 'a2x' WHERE id = 2")
+    c.commit()
+    # the run on row 1 needs a column the run before it did not
+    c.execute("UPDATE w SET a = 'a1y', c = 'c1y' WHERE id = 1")
+    c.execute("UPDATE w SET b = 'b2y' WHERE id = 2")
+    c.commit()
+
+    changes = c.execute(
+        "SELECT [table], cid, val, db_version FROM crsql_changes WHERE db_version > 1").fetchall()
+    assert (changes == [
+        ('w', 'a', 'a2x', 2),
+        ('w', 'a', 'a1y', 3),
+        ('w', 'c', 'c1y', 3),
+        ('w', 'b', 'b2y', 3),
+    ])
+    close(c)
+
+
+def test_interleaved_cursors_over_the_same_table():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE w (id PRIMARY KEY NOT NULL, a, b)")
+    c.execute("SELECT crsql_as_crr('w')")
+    c.commit()
+    for i in range(5):
+        c.execute("INSERT INTO w VALUES (?, ?, ?)", (i, 'a' + str(i), 'b' + str(i)))
+        c.commit()
+
+    query = "SELECT cid, val, db_version FROM crsql_changes"
+    expected = c.execute(query).fetchall()
+    first = c.cursor().execute(query)
+    second = c.cursor().execute(query + " WHERE db_version > 2")
+    interleaved = ([], [])
+    for i in range(len(expected)):
+        row = first.fetchone()
+        if row is not None:
+            interleaved[0].append(row)
+        row = second.fetchone()
+        if row is not None:
+            interleaved[1].append(row)
+    assert interleaved[0] == expected
+    assert interleaved[1] == [row for row in expected if row[2] > 2]
+    close(c)
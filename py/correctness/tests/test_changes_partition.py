@@ -0,0 +1,72 @@
+from crsql_correctness import connect, close
+
+columns = "[table], pk, cid, val, col_version, db_version, site_id, cl, seq"
+
+
+def setup_db():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER, c TEXT)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("CREATE TABLE bar (a TEXT PRIMARY KEY NOT NULL, b INTEGER)")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    for i in range(40):
+        c.execute("INSERT INTO foo VALUES (?, ?, ?)", (i, i, str(i)))
+        c.execute("INSERT INTO bar VALUES (?, ?)", (str(i), i))
+        if i % 5 == 0:
+            c.commit()
+    c.execute("UPDATE foo SET b = b + 1 WHERE a % 3 = 0")
+    c.execute("DELETE FROM bar WHERE b % 7 = 0")
+    c.commit()
+    return c
+
+
+def test_partitions_split_changes_without_overlap():
+    c = setup_db()
+    everything = c.execute(
+        "SELECT {} FROM crsql_changes ORDER BY db_version, seq".format(columns)).fetchall()
+    for n in [1, 2, 3, 8, 100]:
+        parts = [c.execute(
+            "SELECT {} FROM crsql_changes WHERE part_count = ? AND part_id = ? ORDER BY db_version, seq".format(
+                columns), (n, i)).fetchall() for i in range(n)]
+        # disjoint and together every change, each in order
+        assert (sum(len(part) for part in parts) == len(everything))
+        assert (sorted(row for part in parts for row in part) == sorted(everything))
+        for part in parts:
+            assert ([(r[5], r[8]) for r in part] == sorted((r[5], r[8]) for r in part))
+        # all changes to a row land in the same partition
+        for part in parts:
+            rows = set((r[0], r[1]) for r in part)
+            for other in parts:
+                if other is not part:
+                    assert (rows.isdisjoint((r[0], r[1]) for r in other))
+    close(c)
+
+
+def test_partitions_with_other_constraints():
+    c = setup_db()
+    expected = c.execute(
+        "SELECT {} FROM crsql_changes WHERE db_version > 3 AND [table] = 'foo' ORDER BY db_version, seq".format(
+            columns)).fetchall()
+    parts = [c.execute(
+        """SELECT {} FROM crsql_changes WHERE db_version > 3 AND [table] = 'foo'
+        AND part_count = 4 AND part_id = ? ORDER BY db_version, seq LIMIT 1000""".format(
+            columns), (i,)).fetchall() for i in range(4)]
+    assert (sorted(row for part in parts for row in part) == sorted(expected))
+    close(c)
+
+
+def test_partition_columns():
+    c = setup_db()
+    assert (c.execute(
+        "SELECT DISTINCT part_count, part_id FROM crsql_changes WHERE part_count = 3 AND part_id = 1")
+        .fetchall() == [(3, 1)])
+    assert (c.execute("SELECT DISTINCT part_count, part_id FROM crsql_changes").fetchall()
+            == [(None, None)])
+    # out of range or missing partitions are empty
+    assert (c.execute(
+        "SELECT count(*) FROM crsql_changes WHERE part_count = 3 AND part_id = 3").fetchone()[0] == 0)
+    assert (c.execute(
+        "SELECT count(*) FROM crsql_changes WHERE part_count = 0 AND part_id = 0").fetchone()[0] == 0)
+    assert (len(c.execute("SELECT * FROM crsql_changes").description) == 9)
+    close(c)
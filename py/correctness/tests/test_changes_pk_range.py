@@ -0,0 +1,106 @@
+from crsql_correctness import connect, close
+
+columns = "[table], pk, cid, val, col_version, db_version, site_id, cl, seq"
+
+
+def setup_db():
+    c = connect(":memory:")
+    c.execute(
+        "CREATE TABLE item (tenant TEXT NOT NULL, id INTEGER NOT NULL, name TEXT, PRIMARY KEY (tenant, id))")
+    c.execute("SELECT crsql_as_crr('item')")
+    c.execute("CREATE TABLE note (id INTEGER PRIMARY KEY NOT NULL, body TEXT)")
+    c.execute("SELECT crsql_as_crr('note')")
+    c.commit()
+    for tenant in ["a", "b", "bb", "c"]:
+        for i in range(5):
+            c.execute("INSERT INTO item VALUES (?, ?, ?)", (tenant, i, tenant + str(i)))
+        c.commit()
+    for i in range(10):
+        c.execute("INSERT INTO note VALUES (?, ?)", (i, str(i)))
+    c.execute("DELETE FROM item WHERE tenant = 'b' AND id = 2")
+    c.commit()
+    return c
+
+
+def unpack(c, blob):
+    return tuple(r[0] for r in c.execute("SELECT cell FROM crsql_unpack_columns(?)", (blob,)))
+
+
+def cell_key(v):
+    # NULL < numbers < text < blobs, as SQLite orders them
+    if isinstance(v, (int, float)):
+        return (1, v)
+    if isinstance(v, str):
+        return (2, v.encode())
+    return (3, v)
+
+
+def compare(pk, bound):
+    for (l, r) in zip(pk, bound):
+        (l, r) = (cell_key(l), cell_key(r))
+        if l != r:
+            return -1 if l < r else 1
+    return -1 if len(bound) > len(pk) else 0
+
+
+matchers = {
+    "crsql_pk_prefix": lambda o: o == 0,
+    "crsql_pk_gt": lambda o: o > 0,
+    "crsql_pk_ge": lambda o: o >= 0,
+    "crsql_pk_lt": lambda o: o < 0,
+    "crsql_pk_le": lambda o: o <= 0,
+}
+
+
+def test_predicates_match_unpacked_comparison():
+    c = setup_db()
+    everything = c.execute(
+        "SELECT {} FROM crsql_changes ORDER BY db_version, seq".format(columns)).fetchall()
+    bounds = [(), ("a",), ("b",), ("b", 2), ("b", 3), ("bb", 0), ("c", 4, 1), ("z",), (3,), (3, 1)]
+    for bound in bounds:
+        packed = c.execute("SELECT crsql_pack_columns({})".format(
+            ", ".join("?" for _ in bound)), bound).fetchone()[0]
+        for (fn, matches) in matchers.items():
+            expected = [row for row in everything if matches(compare(unpack(c, row[1]), bound))]
+            assert (c.execute(
+                "SELECT {} FROM crsql_changes WHERE {}(pk, ?) ORDER BY db_version, seq".format(
+                    columns, fn), (packed,)).fetchall() == expected)
+            # the scalar function agrees with what was pushed down
+            assert ([row[:-1] for row in c.execute(
+                "SELECT {}, {}(pk, ?) FROM crsql_changes ORDER BY db_version, seq".format(
+                    columns, fn), (packed,)).fetchall() if row[-1] == 1] == expected)
+    close(c)
+
+
+def test_tenant_range():
+    c = setup_db()
+    rows = c.execute(
+        """SELECT [table], pk FROM crsql_changes
+        WHERE crsql_pk_ge(pk, crsql_pack_columns('b')) AND crsql_pk_lt(pk, crsql_pack_columns('c'))
+        AND [table] = 'item'""").fetchall()
+    tenants = set(unpack(c, pk)[0] for (_, pk) in rows)
+    assert (tenants == {"b", "bb"})
+    rows = c.execute(
+        """SELECT pk FROM crsql_changes
+        WHERE crsql_pk_prefix(pk, crsql_pack_columns('b')) AND db_version > 0
+        ORDER BY db_version, seq LIMIT 3""").fetchall()
+    assert (len(rows) == 3)
+    assert (all(unpack(c, pk)[0] == "b" for (pk,) in rows))
+    close(c)
+
+
+def test_other_constraints_and_bounds():
+    c = setup_db()
+    # a NULL bound matches nothing
+    assert (c.execute("SELECT count(*) FROM crsql_changes WHERE crsql_pk_ge(pk, NULL)").fetchone()[0]
+            == 0)
+    assert (c.execute("SELECT crsql_pk_prefix(crsql_pack_columns('a', 1), crsql_pack_columns('a'))")
+            .fetchone()[0] == 1)
+    assert (c.execute("SELECT crsql_pk_lt(crsql_pack_columns('a', 1), crsql_pack_columns('a', NULL))")
+            .fetchone()[0] is None)
+    try:
+        c.execute("SELECT count(*) FROM crsql_changes WHERE crsql_pk_ge(pk, 'a')").fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("expects packed columns" in str(e))
+    close(c)
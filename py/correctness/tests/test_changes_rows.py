@@ -0,0 +1,117 @@
+from crsql_correctness import connect, close
+
+change_columns = "[table], pk, cid, val, col_version, db_version, site_id, cl, seq"
+
+
+def create_schema(c):
+    c.execute("CREATE TABLE wide (id INTEGER PRIMARY KEY NOT NULL, a, b, c, d, e, f, g, h)")
+    c.execute("SELECT crsql_as_crr('wide')")
+    c.execute("CREATE TABLE other (id TEXT PRIMARY KEY NOT NULL, x)")
+    c.execute("SELECT crsql_as_crr('other')")
+    c.commit()
+
+
+def make_db():
+    c = connect(":memory:")
+    create_schema(c)
+    for i in range(10):
+        c.execute("INSERT INTO wide VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+                  (i, i, str(i), b"b" * i, 1.5 * i, None, i, i, i))
+        c.execute("INSERT INTO other VALUES (?, ?)", (str(i), i))
+        c.commit()
+    c.execute("UPDATE wide SET a = a + 1, c = 'x' WHERE id % 2 = 0")
+    c.execute("UPDATE other SET x = 'y' WHERE id > '5'")
+    c.execute("DELETE FROM wide WHERE id = 3")
+    c.commit()
+    return c
+
+
+def unpack(c, blob):
+    return [r[0] for r in c.execute("SELECT cell FROM crsql_unpack_columns(?)", (blob,))]
+
+
+def unpacked_rows(c, where="", params=()):
+    ret = []
+    for (tbl, pk, cids, col_versions, vals, db_version, site_id, cl, seq) in c.execute(
+            "SELECT * FROM crsql_changes_rows" + where, params).fetchall():
+        for (i, (cid, col_version, val)) in enumerate(
+                zip(unpack(c, cids), unpack(c, col_versions), unpack(c, vals))):
+            ret.append((tbl, pk, cid, val, col_version,
+                       db_version, site_id, cl, seq + i))
+    return ret
+
+
+def test_rows_hold_every_change():
+    c = make_db()
+    changes = c.execute(
+        "SELECT {} FROM crsql_changes ORDER BY db_version, seq".format(change_columns)).fetchall()
+    assert (unpacked_rows(c) == changes)
+    # one row per changed row rather than per changed column
+    num_rows = c.execute("SELECT count(*) FROM crsql_changes_rows").fetchone()[0]
+    assert (num_rows < len(changes) / 3)
+    close(c)
+
+
+def test_filters():
+    c = make_db()
+    for (where, params) in [(" WHERE db_version > ?", (5,)),
+                            (" WHERE db_version >= ? AND [table] = ?", (5, "wide")),
+                            (" WHERE [table] = 'other'", ()),
+                            (" WHERE site_id = crsql_site_id()", ()),
+                            (" WHERE site_id != crsql_site_id()", ()),
+                            (" WHERE cl = 2", ()),
+                            (" WHERE pk = crsql_pack_columns(4)", ())]:
+        expected = c.execute(
+            "SELECT {} FROM crsql_changes{} ORDER BY db_version, seq".format(
+                change_columns, where), params).fetchall()
+        assert (unpacked_rows(c, where, params) == expected)
+    # `seq` is left to SQLite as it is that of the row's first change
+    assert (c.execute("SELECT * FROM crsql_changes_rows WHERE seq > 3").fetchall() ==
+            [row for row in c.execute("SELECT * FROM crsql_changes_rows").fetchall() if row[8] > 3])
+    close(c)
+
+
+def test_insert_rows():
+    a = make_db()
+    b = connect(":memory:")
+    create_schema(b)
+    b.executemany("INSERT INTO crsql_changes_rows VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+                  a.execute("SELECT * FROM crsql_changes_rows").fetchall())
+    b.commit()
+
+    # the same as merging each change through crsql_changes
+    c = connect(":memory:")
+    create_schema(c)
+    c.executemany("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+                  a.execute("SELECT {} FROM crsql_changes".format(change_columns)).fetchall())
+    c.commit()
+
+    for tbl in ["wide", "other"]:
+        expected = a.execute("SELECT * FROM {} ORDER BY id".format(tbl)).fetchall()
+        assert (b.execute("SELECT * FROM {} ORDER BY id".format(tbl)).fetchall() == expected)
+    query = "SELECT [table], pk, cid, val, col_version, site_id, cl, seq FROM crsql_changes ORDER BY [table], pk, cid"
+    assert (b.execute(query).fetchall() == c.execute(query).fetchall())
+
+    # merging again is a no-op
+    b.executemany("INSERT INTO crsql_changes_rows VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)",
+                  a.execute("SELECT * FROM crsql_changes_rows").fetchall())
+    assert (b.execute("SELECT crsql_rows_impacted()").fetchone()[0] == 0)
+    b.commit()
+    close(a)
+    close(b)
+    close(c)
+
+
+def test_insert_rejects_mismatched_columns():
+    a = make_db()
+    row = list(a.execute("SELECT * FROM crsql_changes_rows WHERE [table] = 'wide'").fetchone())
+    b = connect(":memory:")
+    create_schema(b)
+    row[3] = a.execute("SELECT crsql_pack_columns(1)").fetchone()[0]
+    try:
+        b.execute("INSERT INTO crsql_changes_rows VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", row)
+        assert (False)
+    except Exception as e:
+        assert ("same number of columns" in str(e))
+    close(a)
+    close(b)
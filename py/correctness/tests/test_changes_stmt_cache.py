@@ -0,0 +1,49 @@
+from crsql_correctness import connect, close
+
+
+changes_query = "SELECT [table], pk, cid, val, db_version FROM crsql_changes WHERE db_version > ?"
+
+
+def test_repeated_queries_rebind():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (id PRIMARY KEY NOT NULL, x)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+    for i in range(5):
+        c.execute("INSERT INTO foo VALUES (?, ?)", (i, i))
+        c.commit()
+
+    for since in [0, 3, 1, 5, 0]:
+        rows = c.execute(changes_query, (since,)).fetchall()
+        assert ([r[4] for r in rows] == list(range(since + 1, 6)))
+    close(c)
+
+
+def test_schema_change_invalidates():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (id PRIMARY KEY NOT NULL, x)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("INSERT INTO foo VALUES (1, 1)")
+    c.commit()
+    assert (len(c.execute(changes_query, (0,)).fetchall()) == 1)
+
+    c.execute("CREATE TABLE bar (id PRIMARY KEY NOT NULL, x)")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.execute("INSERT INTO bar VALUES (1, 1)")
+    c.commit()
+    assert ([r[0] for r in c.execute(changes_query, (0,)).fetchall()] == ['foo', 'bar'])
+    close(c)
+
+
+def test_concurrent_cursors_of_the_same_shape():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (id PRIMARY KEY NOT NULL, x)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    for i in range(3):
+        c.execute("INSERT INTO foo VALUES (?, ?)", (i, i))
+        c.commit()
+
+    rows = c.execute(
+        "SELECT a.db_version, b.db_version FROM crsql_changes AS a, crsql_changes AS b WHERE a.db_version > ? AND b.db_version > ?", (0, 0)).fetchall()
+    assert (len(rows) == 9)
+    close(c)
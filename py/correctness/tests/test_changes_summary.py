@@ -0,0 +1,83 @@
+from crsql_correctness import connect, close
+
+site_a = bytes.fromhex("1dc8d6bb7f8941088327d9439a7927a4")
+unknown_site = bytes.fromhex("ffc8d6bb7f8941088327d9439a7927a4")
+
+
+def setup_db():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER, c TEXT)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("CREATE TABLE bar (a TEXT PRIMARY KEY NOT NULL, b INTEGER)")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.execute("CREATE TABLE baz (a INTEGER PRIMARY KEY NOT NULL, b INTEGER)")
+    c.execute("SELECT crsql_as_crr('baz')")
+    c.commit()
+    for i in range(10):
+        c.execute("INSERT INTO foo VALUES (?, ?, ?)", (i, i, str(i)))
+        if i < 5:
+            c.execute("INSERT INTO bar VALUES (?, ?)", (str(i), i))
+        c.commit()
+    c.execute("DELETE FROM foo WHERE a = 3")
+    c.commit()
+    # changes from another site
+    c.execute("INSERT INTO crsql_changes VALUES ('foo', X'010964', 'b', 1, 1, 20, ?, 1, 0)",
+              (site_a,))
+    c.execute("INSERT INTO crsql_changes VALUES ('bar', X'010B0178', 'b', 1, 1, 21, ?, 1, 0)",
+              (site_a,))
+    c.commit()
+    return c
+
+
+def expected_summary(c, since, exclude_site):
+    return c.execute(
+        """SELECT [table], count(*), max(db_version) FROM crsql_changes
+        WHERE db_version > ? AND site_id IS NOT ? GROUP BY [table] ORDER BY [table]""",
+        (since, exclude_site)).fetchall()
+
+
+def test_summary_matches_changes():
+    c = setup_db()
+    local_site = c.execute("SELECT crsql_site_id()").fetchone()[0]
+    for since in [-1, 0, 3, 9, 11, 12, 20, 100]:
+        for exclude_site in [None, local_site, site_a, unknown_site]:
+            assert (c.execute(
+                "SELECT * FROM crsql_changes_summary(?, ?) ORDER BY [table]",
+                (since, exclude_site)).fetchall() == expected_summary(c, since, exclude_site))
+    close(c)
+
+
+def test_optional_arguments():
+    c = setup_db()
+    everything = expected_summary(c, -1, None)
+    assert (c.execute("SELECT * FROM crsql_changes_summary ORDER BY [table]").fetchall()
+            == everything)
+    assert (c.execute("SELECT * FROM crsql_changes_summary(NULL) ORDER BY [table]").fetchall()
+            == everything)
+    assert (c.execute("SELECT * FROM crsql_changes_summary(5) ORDER BY [table]").fetchall()
+            == expected_summary(c, 5, None))
+    # tables with no changes are left out
+    assert ("baz" not in [row[0] for row in everything])
+    close(c)
+
+
+def test_sums_across_tables():
+    c = setup_db()
+    local_site = c.execute("SELECT crsql_site_id()").fetchone()[0]
+    assert (c.execute(
+        "SELECT sum(count), max(max_db_version) FROM crsql_changes_summary(?, ?)",
+        (2, local_site)).fetchone() ==
+        c.execute("SELECT count(*), max(db_version) FROM crsql_changes WHERE site_id IS NOT ? AND db_version > ?",
+                  (local_site, 2)).fetchone())
+    close(c)
+
+
+def test_sees_new_writes():
+    c = setup_db()
+    before = c.execute("SELECT * FROM crsql_changes_summary(11)").fetchall()
+    c.execute("INSERT INTO baz VALUES (1, 1)")
+    c.commit()
+    after = c.execute("SELECT * FROM crsql_changes_summary(11) ORDER BY [table]").fetchall()
+    assert (after != before)
+    assert (after == expected_summary(c, 11, None))
+    close(c)
@@ -0,0 +1,153 @@
+import struct
+from crsql_correctness import connect, close
+
+columns = "[table], pk, cid, val, col_version, db_version, site_id, cl, seq"
+site_a = bytes.fromhex("1dc8d6bb7f8941088327d9439a7927a4")
+
+
+def setup_db():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER, c TEXT, d BLOB, e REAL)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("CREATE TABLE bar (a TEXT NOT NULL, b INTEGER NOT NULL, c, PRIMARY KEY (a, b))")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.execute("CREATE TABLE pkonly (a INTEGER PRIMARY KEY NOT NULL)")
+    c.execute("SELECT crsql_as_crr('pkonly')")
+    c.commit()
+    for i in range(20):
+        c.execute("INSERT INTO foo VALUES (?, ?, ?, ?, ?)",
+                  (i, i * 1000 - 5000, "text " + str(i), bytes([i, 0, 255]), i / 3))
+        c.execute("INSERT INTO bar VALUES (?, ?, ?)", (str(i % 3), i, None if i % 2 else -i))
+        c.execute("INSERT INTO pkonly VALUES (?)", (i,))
+        if i % 4 == 0:
+            c.commit()
+    c.execute("UPDATE foo SET b = NULL WHERE a % 5 = 0")
+    c.execute("DELETE FROM foo WHERE a = 7")
+    c.execute("DELETE FROM pkonly WHERE a > 15")
+    c.commit()
+    c.execute("INSERT INTO crsql_changes VALUES ('foo', X'010964', 'c', 'remote', 1, 30, ?, 1, 0)",
+              (site_a,))
+    c.commit()
+    return c
+
+
+def get_varint(data, pos):
+    ret = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        ret |= (byte & 0x7f) << shift
+        if byte & 0x80 == 0:
+            return (ret, pos)
+        shift += 7
+
+
+def get_zigzag(data, pos):
+    (v, pos) = get_varint(data, pos)
+    return ((v >> 1) ^ -(v & 1), pos)
+
+
+def get_value(data, pos):
+    t = data[pos]
+    pos += 1
+    (kind, n) = (t & 7, t >> 3)
+    if kind == 1:
+        return (int.from_bytes(data[pos:pos + n], "big", signed=True), pos + n)
+    if kind == 2:
+        return (struct.unpack(">d", data[pos:pos + 8])[0], pos + 8)
+    if kind in (3, 4):
+        length = int.from_bytes(data[pos:pos + n], "big")
+        pos += n
+        raw = bytes(data[pos:pos + length])
+        return (raw.decode() if kind == 3 else raw, pos + length)
+    if kind == 5:
+        return (None, pos)
+    raise Exception("unknown type {}".format(kind))
+
+
+def decode(changeset):
+    assert (changeset[:4] == b"CRCS")
+    assert (changeset[4] == 1 and changeset[5] == 0)
+    pos = 6
+    (tables, cids, sites) = ([], [], [])
+    (tbl, pk, db_version, seq, site, cl) = (None, None, 0, 0, None, None)
+    ret = []
+    while pos < len(changeset):
+        tag = changeset[pos]
+        pos += 1
+        if tag in (1, 2, 3):
+            (length, pos) = get_varint(changeset, pos)
+            entry = bytes(changeset[pos:pos + length])
+            pos += length
+            [tables, cids, sites][tag - 1].append(entry if tag == 3 else entry.decode())
+            continue
+        if tag == 4:
+            (tables, cids, sites) = ([], [], [])
+            db_version = 0
+            continue
+        assert (tag & 0xf0 == 0x10)
+        if not tag & 1:
+            (t, pos) = get_varint(changeset, pos)
+            tbl = tables[t]
+            (length, pos) = get_varint(changeset, pos)
+            pk = bytes(changeset[pos:pos + length])
+            pos += length
+        (cid, pos) = get_varint(changeset, pos)
+        (col_version, pos) = get_zigzag(changeset, pos)
+        if not tag & 2:
+            (delta, pos) = get_zigzag(changeset, pos)
+            db_version += delta
+            (seq, pos) = get_zigzag(changeset, pos)
+        else:
+            (delta, pos) = get_zigzag(changeset, pos)
+            seq += delta
+        if not tag & 4:
+            (s, pos) = get_varint(changeset, pos)
+            site = sites[s]
+        if not tag & 8:
+            (cl, pos) = get_zigzag(changeset, pos)
+        (val, pos) = get_value(changeset, pos)
+        ret.append((tbl, pk, cids[cid], val, col_version, db_version, site, cl, seq))
+    return ret
+
+
+def test_changeset_matches_changes():
+    c = setup_db()
+    local_site = c.execute("SELECT crsql_site_id()").fetchone()[0]
+    for since in [-1, 0, 2, 5, 6, 30]:
+        for exclude_site in [None, local_site, site_a]:
+            expected = c.execute(
+                """SELECT {} FROM crsql_changes WHERE db_version > ? AND site_id IS NOT ?
+                ORDER BY db_version, seq""".format(columns), (since, exclude_site)).fetchall()
+            changeset = c.execute(
+                "SELECT crsql_changeset(?, ?)", (since, exclude_site)).fetchone()[0]
+            assert (decode(changeset) == expected)
+    close(c)
+
+
+def test_changeset_is_compact():
+    c = setup_db()
+    changeset = c.execute("SELECT crsql_changeset(NULL)").fetchone()[0]
+    rows = c.execute("SELECT {} FROM crsql_changes".format(columns)).fetchall()
+    assert (decode(changeset) == sorted(rows, key=lambda r: (r[5], r[8])))
+    # table names and site ids are not repeated per change
+    assert (len(changeset) < sum(len(r[0]) + len(r[1]) + len(r[6]) for r in rows))
+    assert (changeset.count(b"pkonly") == 1)
+    close(c)
+
+
+def test_empty_and_bad_arguments():
+    c = setup_db()
+    assert (c.execute("SELECT crsql_changeset(1000)").fetchone()[0] == b"CRCS\x01\x00")
+    try:
+        c.execute("SELECT crsql_changeset()").fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("crsql_changeset takes" in str(e))
+    try:
+        c.execute("SELECT crsql_changeset(0, NULL, 'zstd')").fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("unknown codec" in str(e))
+    close(c)
@@ -0,0 +1,101 @@
+from crsql_correctness import connect, close, get_site_id
+
+columns = "[table], pk, cid, val, col_version, db_version, site_id, cl, seq"
+peer = bytes.fromhex("1dc8d6bb7f8941088327d9439a7927a4")
+
+
+def setup_source(path):
+    c = connect(path)
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER, c TEXT)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+    for i in range(20):
+        c.execute("INSERT INTO foo VALUES (?, ?, ?)", (i, i * 2, str(i)))
+        if i % 5 == 0:
+            c.commit()
+    c.execute("DELETE FROM foo WHERE a % 6 = 0")
+    c.commit()
+    # a change from another peer
+    c.execute("INSERT INTO crsql_changes VALUES ('foo', X'010964', 'c', 'remote', 1, 3, ?, 1, 0)",
+              (peer,))
+    c.execute("INSERT INTO crsql_tracked_peers VALUES (?, 3, 0, 0, 0)", (peer,))
+    c.execute("INSERT INTO crsql_tracked_peers VALUES (?, 7, 0, 0, 1)", (peer,))
+    c.commit()
+    return c
+
+
+def changes(c):
+    return c.execute(
+        "SELECT {} FROM crsql_changes ORDER BY db_version, seq".format(columns)).fetchall()
+
+
+def test_clone_is_a_new_peer(tmp_path):
+    source = setup_source(str(tmp_path / "source.db"))
+    source_site = get_site_id(source)
+    clone_path = str(tmp_path / "clone.db")
+    clone_site = source.execute("SELECT crsql_clone_to(?)", (clone_path,)).fetchone()[0]
+    assert (len(clone_site) == 16 and clone_site != source_site)
+
+    clone = connect(clone_path)
+    assert (get_site_id(clone) == clone_site)
+    assert (clone.execute("SELECT * FROM foo ORDER BY a").fetchall() ==
+            source.execute("SELECT * FROM foo ORDER BY a").fetchall())
+    # every change keeps the site id that made it
+    assert (changes(clone) == changes(source))
+    assert (not any(row[6] == clone_site for row in changes(clone)))
+    assert (clone.execute("SELECT crsql_db_version()").fetchone()[0] ==
+            source.execute("SELECT crsql_db_version()").fetchone()[0])
+
+    db_version = source.execute("SELECT crsql_db_version()").fetchone()[0]
+    tracked = clone.execute(
+        "SELECT site_id, version, seq, tag, event FROM crsql_tracked_peers ORDER BY site_id")
+    assert (tracked.fetchall() == sorted([(peer, 3, 0, 0, 0), (source_site, db_version, 0, 0, 0)]))
+    # the source is untouched
+    assert (get_site_id(source) == source_site)
+    assert (source.execute("SELECT count(*) FROM crsql_tracked_peers").fetchone()[0] == 2)
+
+    # writes on either side sync as from different peers
+    clone.execute("UPDATE foo SET b = 1000 WHERE a = 1")
+    clone.commit()
+    source.execute("UPDATE foo SET b = 2000 WHERE a = 2")
+    source.commit()
+    for change in clone.execute(
+            "SELECT {} FROM crsql_changes WHERE db_version > ? AND site_id = ?".format(columns),
+            (db_version, clone_site)):
+        source.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", change)
+    source.commit()
+    for change in source.execute(
+            "SELECT {} FROM crsql_changes WHERE db_version > ? AND site_id = ?".format(columns),
+            (db_version, source_site)):
+        clone.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", change)
+    clone.commit()
+    assert (source.execute("SELECT b FROM foo WHERE a IN (1, 2) ORDER BY a").fetchall() ==
+            [(1000,), (2000,)])
+    assert (clone.execute("SELECT b FROM foo WHERE a IN (1, 2) ORDER BY a").fetchall() ==
+            [(1000,), (2000,)])
+    assert (source.execute(
+        "SELECT site_id FROM crsql_changes WHERE pk = X'010901' AND cid = 'b'").fetchone()[0] ==
+        clone_site)
+    close(clone)
+    close(source)
+
+
+def test_bad_targets(tmp_path):
+    c = connect(":memory:")
+    try:
+        c.execute("SELECT crsql_clone_to(?)", (str(tmp_path / "clone.db"),)).fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("in-memory" in str(e))
+    close(c)
+
+    source = setup_source(str(tmp_path / "source.db"))
+    clone_path = str(tmp_path / "clone.db")
+    source.execute("SELECT crsql_clone_to(?)", (clone_path,)).fetchone()
+    # an existing clone is not overwritten
+    try:
+        source.execute("SELECT crsql_clone_to(?)", (clone_path,)).fetchone()
+        assert (False)
+    except Exception as e:
+        assert ("crsql_clone_to" in str(e))
+    close(source)
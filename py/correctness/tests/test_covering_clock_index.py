@@ -0,0 +1,76 @@
+from crsql_correctness import connect, close
+
+columns = "[table], pk, cid, val, col_version, db_version, site_id, cl, seq"
+
+
+def clock_indexes(c, table):
+    return [r[0] for r in c.execute(
+        """SELECT name FROM sqlite_master WHERE type = 'index' AND tbl_name = ?
+        AND name LIKE '%dbv%' ORDER BY name""", (table + "__crsql_clock",)).fetchall()]
+
+
+def setup_db():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER, c TEXT)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+    for i in range(20):
+        c.execute("INSERT INTO foo VALUES (?, ?, ?)", (i, i, str(i)))
+        c.commit()
+    c.execute("DELETE FROM foo WHERE a % 4 = 0")
+    c.commit()
+    return c
+
+
+def test_config():
+    c = connect(":memory:")
+    assert (c.execute("SELECT crsql_config_get('covering-clock-index')").fetchone()[0] == 0)
+    assert (c.execute("SELECT crsql_config_set('covering-clock-index', 1)").fetchone()[0] == 1)
+    assert (c.execute("SELECT crsql_config_get('covering-clock-index')").fetchone()[0] == 1)
+    close(c)
+
+
+def test_migrates_existing_and_new_crrs():
+    c = setup_db()
+    assert (clock_indexes(c, "foo") == ["foo__crsql_clock_dbv_idx"])
+    c.execute("SELECT crsql_config_set('covering-clock-index', 1)")
+    c.commit()
+    assert (clock_indexes(c, "foo") == ["foo__crsql_clock_dbv_cover_idx"])
+    c.execute("CREATE TABLE bar (a TEXT PRIMARY KEY NOT NULL, b INTEGER)")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    assert (clock_indexes(c, "bar") == ["bar__crsql_clock_dbv_cover_idx"])
+    # and the index survives an alter
+    c.execute("SELECT crsql_begin_alter('foo')")
+    c.execute("ALTER TABLE foo ADD COLUMN d INTEGER")
+    c.execute("SELECT crsql_commit_alter('foo')")
+    c.commit()
+    assert (clock_indexes(c, "foo") == ["foo__crsql_clock_dbv_cover_idx"])
+
+    c.execute("SELECT crsql_config_set('covering-clock-index', 0)")
+    c.commit()
+    assert (clock_indexes(c, "foo") == ["foo__crsql_clock_dbv_idx"])
+    assert (clock_indexes(c, "bar") == ["bar__crsql_clock_dbv_idx"])
+    close(c)
+
+
+def test_changes_are_unchanged():
+    c = setup_db()
+    queries = [
+        ("SELECT {} FROM crsql_changes ORDER BY db_version, seq".format(columns), ()),
+        ("SELECT {} FROM crsql_changes WHERE db_version > ?".format(columns), (10,)),
+        ("SELECT [table], pk, cid, db_version FROM crsql_changes WHERE db_version >= ? LIMIT 5",
+         (3,)),
+    ]
+    before = [c.execute(sql, args).fetchall() for (sql, args) in queries]
+    c.execute("SELECT crsql_config_set('covering-clock-index', 1)")
+    c.commit()
+    after = [c.execute(sql, args).fetchall() for (sql, args) in queries]
+    assert (before == after)
+    # writes after the switch show up as usual
+    c.execute("UPDATE foo SET b = 100 WHERE a = 1")
+    c.commit()
+    assert (c.execute(
+        "SELECT cid, val FROM crsql_changes WHERE db_version > ?",
+        (c.execute("SELECT crsql_db_version()").fetchone()[0] - 1,)).fetchall() == [("b", 100)])
+    close(c)
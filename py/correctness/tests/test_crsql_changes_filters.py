@@ -94,3 +94,40 @@ def test_site_id_filter():
 # value type of the underlying storage rather than a stringified version
 # def test_val_filter():
 #     run_test("val")
+
+
+def test_table_filter_prunes_other_tables():
+    (c, all_changes) = setup_db()
+    c.execute("CREATE TABLE other (id PRIMARY KEY NOT NULL, x)")
+    c.execute("SELECT crsql_as_crr('other')")
+    c.execute("INSERT INTO other VALUES (1, 2)")
+    c.commit()
+
+    all_rowids = c.execute(
+        "SELECT [table], _rowid_ FROM crsql_changes ORDER BY db_version, seq ASC").fetchall()
+
+    for tbl in ['item', 'other', 'missing']:
+        tbl_changes = c.execute(
+            changes_query + " WHERE [table] = ? ORDER BY db_version, seq ASC", (tbl, )).fetchall()
+        expected = list(filter(lambda row: row[0] == tbl, c.execute(
+            changes_query + " ORDER BY db_version, seq ASC").fetchall()))
+        assert (tbl_changes == expected)
+
+        # rowids must not depend on which tables were pruned
+        tbl_rowids = c.execute(
+            "SELECT [table], _rowid_ FROM crsql_changes WHERE [table] = ? ORDER BY db_version, seq ASC", (tbl, )).fetchall()
+        assert (tbl_rowids == list(filter(lambda row: row[0] == tbl, all_rowids)))
+
+    assert (c.execute(
+        "SELECT [table], pk, cid, val, col_version, db_version FROM crsql_changes WHERE [table] = 'other' AND db_version > 0").fetchall() ==
+        [('other', b'\x01\t\x01', 'x', 2, 1, 5)])
+
+    close(c)
+
+
+def test_metadata_only_scan_matches_full_scan():
+    (c, all_changes) = setup_db()
+    meta = c.execute(
+        "SELECT [table], pk, cid, col_version, db_version, site_id, seq FROM crsql_changes ORDER BY db_version, seq ASC").fetchall()
+    assert (meta == [row[0:3] + row[4:8] for row in all_changes])
+    close(c)
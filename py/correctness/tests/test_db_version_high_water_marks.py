@@ -0,0 +1,127 @@
+from crsql_correctness import connect, close
+
+num_tables = 20
+
+
+def create_tables(c):
+    for i in range(num_tables):
+        c.execute("CREATE TABLE t{} (a INTEGER PRIMARY KEY NOT NULL, b INTEGER)".format(i))
+        c.execute("SELECT crsql_as_crr('t{}')".format(i))
+    c.commit()
+
+
+def populate(c):
+    for i in range(num_tables):
+        c.execute("INSERT INTO t{} VALUES (1, 1)".format(i))
+        c.commit()
+
+
+def changed_tables(c, op, since):
+    # one union of the changed tables
+    unioned = c.execute(
+        "SELECT DISTINCT [table] FROM crsql_changes WHERE db_version {} ? ORDER BY [table]".format(op), (since,)).fetchall()
+    # one statement per changed table
+    merged = c.execute(
+        "SELECT [table] FROM crsql_changes WHERE db_version {} ?".format(op), (since,)).fetchall()
+    assert (sorted(set(merged)) == unioned)
+    return unioned
+
+
+def expected_tables(c, op, since):
+    # `+` keeps the constraint from being handed to crsql_changes
+    return c.execute(
+        "SELECT DISTINCT [table] FROM crsql_changes WHERE +db_version {} ? ORDER BY [table]".format(op), (since,)).fetchall()
+
+
+def test_polls_see_only_changed_tables():
+    c = connect(":memory:")
+    create_tables(c)
+    populate(c)
+    since = c.execute("SELECT crsql_db_version()").fetchone()[0]
+    assert (changed_tables(c, ">", since) == [])
+
+    c.execute("UPDATE t3 SET b = 2")
+    c.execute("UPDATE t7 SET b = 2")
+    c.commit()
+    assert (changed_tables(c, ">", since) == [("t3",), ("t7",)])
+    # a later local write advances the mark of the table it touches
+    c.execute("DELETE FROM t11")
+    c.commit()
+    assert (changed_tables(c, ">", since) == [("t11",), ("t3",), ("t7",)])
+
+    for op in [">", ">="]:
+        for v in range(0, since + 3):
+            assert (changed_tables(c, op, v) == expected_tables(c, op, v))
+    close(c)
+
+
+def test_marks_follow_merges():
+    a = connect(":memory:")
+    b = connect(":memory:")
+    create_tables(a)
+    create_tables(b)
+    populate(a)
+    populate(b)
+    since = b.execute("SELECT crsql_db_version()").fetchone()[0]
+    assert (changed_tables(b, ">", since) == [])
+
+    a.execute("UPDATE t5 SET b = 100")
+    a.commit()
+    for change in a.execute("SELECT * FROM crsql_changes WHERE [table] = 't5'").fetchall():
+        b.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", change)
+    b.commit()
+    assert (changed_tables(b, ">", since) == [("t5",)])
+    close(a)
+    close(b)
+
+
+def test_marks_see_writes_from_other_connections(tmpdir):
+    dbfile = str(tmpdir.join("marks.db"))
+    a = connect(dbfile)
+    create_tables(a)
+    populate(a)
+    since = a.execute("SELECT crsql_db_version()").fetchone()[0]
+    assert (changed_tables(a, ">", since) == [])
+
+    b = connect(dbfile)
+    b.execute("UPDATE t9 SET b = 3")
+    b.commit()
+    close(b)
+
+    assert (changed_tables(a, ">", since) == [("t9",)])
+    close(a)
+
+
+def test_marks_see_backfills():
+    c = connect(":memory:")
+    create_tables(c)
+    populate(c)
+    c.execute("UPDATE t2 SET b = 2")
+    c.commit()
+    since = c.execute("SELECT crsql_db_version()").fetchone()[0] - 1
+    assert (changed_tables(c, ">", since) == [("t2",)])
+
+    c.execute("SELECT crsql_begin_alter('t0')")
+    c.execute("ALTER TABLE t0 ADD COLUMN c INTEGER DEFAULT 0")
+    c.execute("SELECT crsql_commit_alter('t0')")
+    assert (changed_tables(c, ">", since) == expected_tables(c, ">", since))
+    c.commit()
+    assert (changed_tables(c, ">", since) == expected_tables(c, ">", since))
+    close(c)
+
+
+def test_many_polls_past_the_statement_cache():
+    # every bound reads a different set of tables, more sets than statements are cached
+    c = connect(":memory:")
+    for i in range(70):
+        c.execute("CREATE TABLE s{} (a INTEGER PRIMARY KEY NOT NULL, b INTEGER)".format(i))
+        c.execute("SELECT crsql_as_crr('s{}')".format(i))
+    c.commit()
+    for i in range(70):
+        c.execute("INSERT INTO s{} VALUES (1, 1)".format(i))
+        c.commit()
+    latest = c.execute("SELECT crsql_db_version()").fetchone()[0]
+    for _ in range(2):
+        for v in range(0, latest + 1):
+            assert (changed_tables(c, ">", v) == expected_tables(c, ">", v))
+    close(c)
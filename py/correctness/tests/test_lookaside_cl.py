@@ -0,0 +1,129 @@
+from crsql_correctness import connect, close
+
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, cl, seq FROM crsql_changes ORDER BY db_version, seq"
+
+
+def sync_left_to_right(l, r, since):
+    changes = l.execute(
+        "SELECT * FROM crsql_changes WHERE db_version > ?", (since,))
+    for change in changes:
+        r.execute(
+            "INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", change)
+    r.commit()
+
+
+def make_db(lookaside_cl):
+    c = connect(":memory:")
+    if lookaside_cl:
+        c.execute("SELECT crsql_config_set('lookaside-cl', 1)")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b TEXT)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("CREATE TABLE bar (a PRIMARY KEY NOT NULL)")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    return c
+
+
+def write(c):
+    c.execute("INSERT INTO foo VALUES (1, 'one'), (2, 'two'), (3, 'three')")
+    c.execute("INSERT INTO bar VALUES (1), (2)")
+    c.commit()
+    c.execute("UPDATE foo SET b = 'uno' WHERE a = 1")
+    c.execute("DELETE FROM foo WHERE a = 2")
+    c.execute("DELETE FROM bar WHERE a = 1")
+    c.commit()
+    # resurrect
+    c.execute("INSERT INTO foo VALUES (2, 'dos')")
+    # primary key change
+    c.execute("UPDATE foo SET a = 4 WHERE a = 3")
+    c.commit()
+
+
+def assert_cl_matches_clock(c, table):
+    rows = c.execute(
+        """SELECT __crsql_key, __crsql_cl, COALESCE(
+          (SELECT col_version FROM {t}__crsql_clock WHERE key = __crsql_key AND col_name = '-1'),
+          (SELECT 1 FROM {t}__crsql_clock WHERE key = __crsql_key)
+        ) FROM {t}__crsql_pks""".format(t=table)).fetchall()
+    assert (len(rows) > 0)
+    for (key, stored, computed) in rows:
+        assert (stored == computed)
+
+
+def test_cl_is_kept_on_lookaside():
+    c = make_db(True)
+    write(c)
+    assert_cl_matches_clock(c, "foo")
+    assert_cl_matches_clock(c, "bar")
+    assert (c.execute("SELECT a, __crsql_cl FROM bar__crsql_pks ORDER BY a").fetchall()
+            == [(1, 2), (2, 1)])
+    assert (c.execute("SELECT a, __crsql_cl FROM foo__crsql_pks ORDER BY a").fetchall()
+            == [(1, 1), (2, 3), (3, 2), (4, 1)])
+    assert (c.execute("SELECT crsql_config_get('lookaside-cl')").fetchone()[0] == 1)
+    close(c)
+
+
+def test_changes_match_clock_cl():
+    with_cl = make_db(True)
+    without_cl = make_db(False)
+    write(with_cl)
+    write(without_cl)
+    assert (with_cl.execute(changes_query).fetchall()
+            == without_cl.execute(changes_query).fetchall())
+    close(with_cl)
+    close(without_cl)
+
+
+def test_merges_maintain_cl():
+    source = make_db(False)
+    write(source)
+    target = make_db(True)
+    sync_left_to_right(source, target, 0)
+    assert_cl_matches_clock(target, "foo")
+    assert_cl_matches_clock(target, "bar")
+    assert (target.execute("SELECT * FROM foo ORDER BY a").fetchall()
+            == source.execute("SELECT * FROM foo ORDER BY a").fetchall())
+
+    # changes from an older causal length are ignored
+    source.execute("DELETE FROM foo WHERE a = 2")
+    source.commit()
+    sync_left_to_right(source, target, 0)
+    assert_cl_matches_clock(target, "foo")
+    assert (target.execute("SELECT * FROM foo ORDER BY a").fetchall()
+            == source.execute("SELECT * FROM foo ORDER BY a").fetchall())
+    close(source)
+    close(target)
+
+
+def test_existing_rows_get_cl_when_enabled_later():
+    c = make_db(False)
+    write(c)
+    before = c.execute(changes_query).fetchall()
+
+    c.execute("SELECT crsql_config_set('lookaside-cl', 1)")
+    c.execute("SELECT crsql_begin_alter('foo')")
+    c.execute("SELECT crsql_commit_alter('foo')")
+    c.commit()
+    assert_cl_matches_clock(c, "foo")
+    assert (c.execute(changes_query).fetchall() == before)
+    close(c)
+
+
+def test_backfilled_rows_get_cl():
+    c = connect(":memory:")
+    c.execute("SELECT crsql_config_set('lookaside-cl', 1)")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b TEXT)")
+    c.execute("CREATE TABLE bar (a PRIMARY KEY NOT NULL)")
+    c.execute("INSERT INTO foo VALUES (1, 'one'), (2, 'two')")
+    c.execute("INSERT INTO bar VALUES (1), (2)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    assert_cl_matches_clock(c, "foo")
+    assert_cl_matches_clock(c, "bar")
+    # clock writes maintain the column themselves rather than through triggers
+    assert (c.execute(
+        "SELECT count(*) FROM sqlite_master WHERE type = 'trigger' AND tbl_name LIKE '%__crsql_clock'"
+    ).fetchone()[0] == 0)
+    close(c)
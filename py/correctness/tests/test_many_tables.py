@@ -0,0 +1,34 @@
+from crsql_correctness import connect, close
+
+
+def make_db(n):
+    c = connect(":memory:")
+    for i in range(n):
+        c.execute("CREATE TABLE t{} (id PRIMARY KEY NOT NULL, x)".format(i))
+        c.execute("SELECT crsql_as_crr('t{}')".format(i))
+    c.commit()
+    return c
+
+
+def test_changes_across_many_tables():
+    n = 50
+    a = make_db(n)
+    b = make_db(n)
+    for i in reversed(range(n)):
+        a.execute("INSERT INTO t{} VALUES (1, {})".format(i, i))
+    a.commit()
+
+    changes = a.execute("SELECT * FROM crsql_changes").fetchall()
+    assert ([row[0] for row in changes] == ["t{}".format(i) for i in reversed(range(n))])
+    assert (a.execute("SELECT [table], val FROM crsql_changes WHERE [table] = 't17'").fetchall() == [
+        ('t17', 17)])
+
+    for change in changes:
+        b.execute(
+            "INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", change)
+    b.commit()
+
+    for i in range(n):
+        assert (b.execute("SELECT x FROM t{}".format(i)).fetchall() == [(i,)])
+    close(a)
+    close(b)
@@ -0,0 +1,110 @@
+from crsql_correctness import connect, close
+
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, site_id, cl, seq FROM crsql_changes"
+
+
+def sync_left_to_right(l, r, since):
+    changes = l.execute(
+        "SELECT * FROM crsql_changes WHERE db_version > ?", (since,))
+    for change in changes:
+        r.execute(
+            "INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?)", change)
+    r.commit()
+
+
+def make_db(packed):
+    c = connect(":memory:")
+    if packed:
+        c.execute("SELECT crsql_config_set('packed-pks', 1)")
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b TEXT)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("CREATE TABLE bar (a NOT NULL, b NOT NULL, c, PRIMARY KEY(a, b))")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    return c
+
+
+def write(c):
+    c.execute("INSERT INTO foo VALUES (1, 'one'), (2, 'two')")
+    c.execute("INSERT INTO bar VALUES ('x', 1.5, 'a'), (x'0102', 2, 'b')")
+    c.commit()
+    c.execute("UPDATE foo SET b = 'uno' WHERE a = 1")
+    c.execute("DELETE FROM bar WHERE a = 'x'")
+    c.commit()
+
+
+def test_config_is_off_by_default():
+    c = connect(":memory:")
+    assert (c.execute("SELECT crsql_config_get('packed-pks')").fetchone() == (0,))
+    c.execute("SELECT crsql_config_set('packed-pks', 1)")
+    assert (c.execute("SELECT crsql_config_get('packed-pks')").fetchone() == (1,))
+    close(c)
+
+
+def test_lookaside_stores_packed_pks():
+    c = make_db(True)
+    write(c)
+    rows = c.execute(
+        "SELECT __crsql_packed_pks = crsql_pack_columns(a, b) FROM bar__crsql_pks").fetchall()
+    assert (rows == [(1,), (1,)])
+    rows = c.execute(
+        "SELECT __crsql_packed_pks = crsql_pack_columns(a) FROM foo__crsql_pks").fetchall()
+    assert (rows == [(1,), (1,)])
+    close(c)
+
+
+def test_unpacked_lookaside_is_unchanged():
+    c = make_db(False)
+    cols = [r[0] for r in c.execute(
+        "SELECT name FROM pragma_table_info('foo__crsql_pks')").fetchall()]
+    assert (cols == ['__crsql_key', 'a'])
+    close(c)
+
+
+def test_changes_match_unpacked():
+    packed = make_db(True)
+    unpacked = make_db(False)
+    write(packed)
+    write(unpacked)
+
+    def strip_site(rows):
+        return [r[:6] + r[7:] for r in rows]
+
+    assert (strip_site(packed.execute(changes_query).fetchall())
+            == strip_site(unpacked.execute(changes_query).fetchall()))
+    close(packed)
+    close(unpacked)
+
+
+def test_existing_keys_are_packed_when_enabled_later():
+    c = make_db(False)
+    write(c)
+    before = c.execute(changes_query).fetchall()
+
+    c.execute("SELECT crsql_config_set('packed-pks', 1)")
+    c.execute("SELECT crsql_begin_alter('bar')")
+    c.execute("SELECT crsql_commit_alter('bar')")
+    c.commit()
+    rows = c.execute(
+        "SELECT __crsql_packed_pks = crsql_pack_columns(a, b) FROM bar__crsql_pks").fetchall()
+    assert (rows == [(1,), (1,)])
+    assert (c.execute(changes_query).fetchall() == before)
+    close(c)
+
+
+def test_merge_into_packed():
+    source = make_db(False)
+    write(source)
+    target = make_db(True)
+    sync_left_to_right(source, target, 0)
+    # re-applying finds the existing keys by their packed pks
+    sync_left_to_right(source, target, 0)
+
+    assert (target.execute("SELECT * FROM foo ORDER BY a").fetchall()
+            == source.execute("SELECT * FROM foo ORDER BY a").fetchall())
+    assert (target.execute("SELECT * FROM bar").fetchall()
+            == source.execute("SELECT * FROM bar").fetchall())
+    assert (target.execute("SELECT count(*) FROM bar__crsql_pks").fetchone() == (2,))
+    close(source)
+    close(target)
@@ -98,3 +98,104 @@ def test_site_id_ordinals_do_not_move_on_merge():
                   ("X'2DC8D6BB7F8941088327D9439A7927A4'", 2)])
 
     None
+
+
+site_a = "x'1dc8d6bb7f8941088327d9439a7927a4'"
+site_b = "x'2dc8d6bb7f8941088327d9439a7927a4'"
+
+
+def insert_change(c, pk, site):
+    c.execute(
+        "INSERT INTO crsql_changes VALUES ('foo', {}, 'b', 1, 1, 1, {}, 1, 0)".format(pk, site))
+
+
+def test_rolled_back_ordinal_is_not_reused_for_another_site():
+    a = make_simple_schema()
+    insert_change(a, "x'010901'", site_a)
+    a.rollback()
+
+    # ordinal 1 is handed out again, this time to a different site
+    insert_change(a, "x'010902'", site_b)
+    a.commit()
+    insert_change(a, "x'010903'", site_a)
+    a.commit()
+
+    assert (a.execute("SELECT quote(site_id), ordinal FROM crsql_site_id WHERE ordinal != 0").fetchall()
+            == [("X'2DC8D6BB7F8941088327D9439A7927A4'", 1),
+                ("X'1DC8D6BB7F8941088327D9439A7927A4'", 2)])
+    assert (a.execute("SELECT quote(site_id) FROM crsql_changes ORDER BY pk").fetchall()
+            == [("X'2DC8D6BB7F8941088327D9439A7927A4'",),
+                ("X'1DC8D6BB7F8941088327D9439A7927A4'",)])
+
+
+def test_ordinal_rolled_back_to_savepoint_is_forgotten():
+    a = make_simple_schema()
+    a.execute("SAVEPOINT outer_sp")
+    insert_change(a, "x'010901'", site_a)
+    a.execute("SAVEPOINT inner_sp")
+    insert_change(a, "x'010902'", site_b)
+    a.execute("ROLLBACK TO inner_sp")
+    insert_change(a, "x'010903'", "x'3dc8d6bb7f8941088327d9439a7927a4'")
+    # site_b's ordinal went to the third site
+    insert_change(a, "x'010904'", site_b)
+    a.execute("RELEASE outer_sp")
+    a.commit()
+
+    assert (a.execute("SELECT quote(site_id) FROM crsql_changes ORDER BY pk").fetchall()
+            == [("X'1DC8D6BB7F8941088327D9439A7927A4'",),
+                ("X'3DC8D6BB7F8941088327D9439A7927A4'",),
+                ("X'2DC8D6BB7F8941088327D9439A7927A4'",)])
+    assert (a.execute("SELECT ordinal FROM crsql_site_id WHERE ordinal != 0").fetchall()
+            == [(1,), (2,), (3,)])
+
+
+def test_site_id_filters_on_ordinals():
+    a = make_simple_schema()
+    a.execute("INSERT INTO foo VALUES (1, 1)")
+    a.commit()
+    insert_change(a, "x'010902'", site_a)
+    insert_change(a, "x'010903'", site_b)
+    a.commit()
+
+    def count(where, params=()):
+        return a.execute("SELECT count(*) FROM crsql_changes WHERE " + where, params).fetchone()[0]
+
+    assert (count("site_id = {}".format(site_a)) == 1)
+    assert (count("site_id IS {}".format(site_b)) == 1)
+    assert (count("site_id != {}".format(site_a)) == 2)
+    assert (count("site_id IS NOT {}".format(site_a)) == 2)
+    assert (count("site_id IS NOT crsql_site_id()") == 2)
+    assert (count("site_id IS NOT NULL") == 3)
+    assert (count("site_id IS NULL") == 0)
+    # a site id this db has never seen
+    unknown = "x'ffc8d6bb7f8941088327d9439a7927a4'"
+    assert (count("site_id = {}".format(unknown)) == 0)
+    assert (count("site_id IS NOT {}".format(unknown)) == 3)
+    assert (count("site_id = ?", (None,)) == 0)
+    assert (count("site_id IS ?", (None,)) == 0)
+    # not expressible on ordinals, joins in the site ids
+    assert (count("site_id >= {0} AND site_id <= {0}".format(site_b)) == 1)
+    assert (a.execute("SELECT quote(site_id) FROM crsql_changes WHERE site_id != crsql_site_id() ORDER BY site_id DESC").fetchall()
+            == [("X'2DC8D6BB7F8941088327D9439A7927A4'",),
+                ("X'1DC8D6BB7F8941088327D9439A7927A4'",)])
+
+
+def test_site_ids_assigned_by_another_connection(tmpdir):
+    dbfile = str(tmpdir.join("site_ids.db"))
+    a = connect(dbfile)
+    a.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b INTEGER) STRICT;")
+    a.execute("SELECT crsql_as_crr('foo')")
+    a.commit()
+    # load the dictionary
+    a.execute("SELECT * FROM crsql_changes").fetchall()
+
+    b = connect(dbfile)
+    insert_change(b, "x'010901'", site_a)
+    b.commit()
+    close(b)
+
+    assert (a.execute("SELECT quote(site_id) FROM crsql_changes").fetchall()
+            == [("X'1DC8D6BB7F8941088327D9439A7927A4'",)])
+    assert (a.execute("SELECT count(*) FROM crsql_changes WHERE site_id = {}".format(site_a)).fetchone()
+            == (1,))
+    close(a)
@@ -0,0 +1,74 @@
+# Compares the size of a db and the speed of `crsql_changes WHERE db_version > ?`
+# scans with and without the covering-clock-index option.
+#
+# python3 clock_index.py [rows]
+import sqlite3
+import os
+import sys
+import time
+
+rows = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+
+
+def connect(filename):
+    c = sqlite3.connect(filename)
+    c.execute("PRAGMA journal_mode = WAL")
+    c.execute("PRAGMA synchronous = NORMAL")
+    c.enable_load_extension(True)
+    c.execute("select load_extension('../../core/dist/crsqlite')")
+    return c
+
+
+def remove(filename):
+    for f in [filename, "{}-wal".format(filename), "{}-shm".format(filename)]:
+        try:
+            os.remove(f)
+        except OSError:
+            None
+
+
+def setup(filename, covering):
+    remove(filename)
+    c = connect(filename)
+    c.execute("SELECT crsql_config_set('covering-clock-index', ?)", (covering,))
+    c.execute("CREATE TABLE item (id INTEGER PRIMARY KEY NOT NULL, a, b, c)")
+    c.execute("SELECT crsql_as_crr('item')")
+    c.commit()
+    for i in range(0, rows, 1000):
+        c.executemany("INSERT INTO item VALUES (?, ?, ?, ?)",
+                      [(j, j, str(j), j * 2) for j in range(i, min(i + 1000, rows))])
+        c.commit()
+    c.execute("ANALYZE")
+    c.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+    c.commit()
+    return c
+
+
+def timed(c, sql, since, repeat=5):
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        c.execute(sql, (since,)).fetchall()
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+queries = {
+    "metadata": "SELECT [table], pk, cid, col_version, db_version, site_id, cl, seq FROM crsql_changes WHERE db_version > ?",
+    "with val": "SELECT * FROM crsql_changes WHERE db_version > ?",
+}
+
+for covering in [0, 1]:
+    filename = "./clock_index_{}.db".format(covering)
+    c = setup(filename, covering)
+    max_dbv = c.execute("SELECT crsql_db_version()").fetchone()[0]
+    print("covering-clock-index = {}: {:.1f} MiB".format(
+        covering, os.path.getsize(filename) / 1024 / 1024))
+    for (name, sql) in queries.items():
+        for fraction in [1.0, 0.1, 0.01]:
+            since = int(max_dbv * (1 - fraction))
+            print("  {:<8} {:>5.0%} of changes: {:.4f}s".format(
+                name, fraction, timed(c, sql, since)))
+    c.close()
+    remove(filename)